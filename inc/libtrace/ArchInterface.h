@@ -3,6 +3,7 @@
 
 #include "RecordTypes.h"
 
+#include <atomic>
 #include <string>
 
 namespace libtrace {
@@ -12,6 +13,10 @@ namespace libtrace {
 		virtual ~ArchInterface();
 		
 		virtual std::string DisassembleInstruction(const InstructionCodeRecord &record) = 0;
+
+		// Architectures with more than one ISA mode should override this;
+		// by default the mode is ignored
+		virtual std::string DisassembleInstruction(uint32_t isa_mode, const InstructionCodeRecord &record);
 		
 		virtual std::string GetRegisterSlotName(int index) = 0;
 		virtual std::string GetRegisterBankName(int index) = 0;
@@ -23,6 +28,7 @@ namespace libtrace {
 	class DefaultArchInterface : public ArchInterface {
 		virtual ~DefaultArchInterface();
 		
+		using ArchInterface::DisassembleInstruction;
 		virtual std::string DisassembleInstruction(const InstructionCodeRecord &record) override;
 		
 		virtual std::string GetRegisterSlotName(int index) override;
@@ -32,6 +38,58 @@ namespace libtrace {
 		virtual uint32_t GetRegisterBankWidth(int index) override;
 	};
 
+	// Memoises another ArchInterface. Disassembly is keyed by ISA mode and
+	// instruction word, so it must not depend on anything else in the
+	// record, and register names and widths by index. Results are kept in a
+	// fixed-size table which can be used from several threads at once; once
+	// the table is full, new results are passed through without being
+	// cached. The wrapped interface is only called on misses, but several
+	// threads may miss at once.
+	class CachingArchInterface : public ArchInterface {
+	public:
+		static const size_t kDefaultCapacity = 1 << 16;
+
+		// capacity is in entries, and is rounded up to a power of two
+		CachingArchInterface(ArchInterface *arch, size_t capacity = kDefaultCapacity);
+		virtual ~CachingArchInterface();
+
+		ArchInterface *GetArch() const { return arch_; }
+
+		virtual std::string DisassembleInstruction(const InstructionCodeRecord &record) override;
+		virtual std::string DisassembleInstruction(uint32_t isa_mode, const InstructionCodeRecord &record) override;
+
+		virtual std::string GetRegisterSlotName(int index) override;
+		virtual std::string GetRegisterBankName(int index) override;
+
+		virtual uint32_t GetRegisterSlotWidth(int index) override;
+		virtual uint32_t GetRegisterBankWidth(int index) override;
+
+	private:
+		enum EntryKind {
+			Entry_Disassembly,
+			Entry_RegisterSlot,
+			Entry_RegisterBank
+		};
+
+		struct Entry {
+			EntryKind kind;
+			uint64_t key;
+			std::string text;
+			uint32_t width;
+		};
+
+		CachingArchInterface(const CachingArchInterface&) = delete;
+		CachingArchInterface &operator=(const CachingArchInterface&) = delete;
+
+		const Entry *Find(EntryKind kind, uint64_t key) const;
+		void Insert(EntryKind kind, uint64_t key, const std::string &text, uint32_t width);
+		const Entry *GetRegister(EntryKind kind, int index, Entry &uncached);
+
+		ArchInterface *arch_;
+		std::atomic<Entry*> *table_;
+		uint64_t mask_;
+	};
+
 }
 
 #endif
@@ -0,0 +1,42 @@
+#ifndef ARCHMODULE_H
+#define ARCHMODULE_H
+
+#include "ArchInterface.h"
+
+#include <string>
+
+// Architecture modules are shared objects which define their ArchInterface
+// with this, e.g. LIBTRACE_ARCH_MODULE(ArmArchInterface)
+#define LIBTRACE_ARCH_MODULE(x) extern "C" libtrace::ArchInterface *libtrace_create_arch_interface() { return new x(); }
+
+namespace libtrace {
+
+	// An ArchInterface loaded from a shared object at runtime. The module
+	// stays loaded, and the interface valid, until the ArchModule is
+	// destroyed or another module is loaded.
+	class ArchModule
+	{
+	public:
+		ArchModule();
+		~ArchModule();
+
+		// Returns false, with the reason in GetError, if the module cannot
+		// be loaded or does not define an interface
+		bool Load(const std::string &path);
+		void Unload();
+
+		ArchInterface *GetInterface() const { return interface_; }
+		const std::string &GetError() const { return error_; }
+
+	private:
+		ArchModule(const ArchModule&) = delete;
+		ArchModule &operator=(const ArchModule&) = delete;
+
+		void *handle_;
+		ArchInterface *interface_;
+		std::string error_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,126 @@
+#ifndef CACHESIMULATOR_H
+#define CACHESIMULATOR_H
+
+#include "RecordBlockReader.h"
+
+#include <cstdint>
+#include <string>
+#include <unordered_map>
+#include <vector>
+
+namespace libtrace {
+
+	enum ReplacementPolicy {
+		Replacement_LRU,
+		Replacement_PLRU,	// tree pseudo-LRU
+		Replacement_RRIP	// static RRIP with 2-bit re-reference predictions
+	};
+
+	struct CacheConfig {
+		uint64_t size;		// bytes, or 0 if the cache is not present
+		uint32_t associativity;
+		uint32_t line_size;
+		ReplacementPolicy policy;
+		bool write_back;
+		bool write_allocate;
+
+		// Parse '<size>[k|m]:<ways>:<line size>[:<lru|plru|rrip>][:<wb|wt>][:<wa|nwa>]',
+		// or 'none'
+		bool Parse(const std::string &spec, std::string &error);
+	};
+
+	struct CacheStats {
+		uint64_t reads, writes;
+		uint64_t read_misses, write_misses;
+		uint64_t writebacks;
+	};
+
+	// A single set-associative cache. The tags and replacement state of each
+	// set are stored contiguously, so a lookup touches one or two host cache
+	// lines.
+	class Cache
+	{
+	public:
+		struct Result {
+			bool hit;
+			bool writeback;		// a dirty line was evicted
+			uint64_t writeback_address;
+		};
+
+		Cache(const CacheConfig &config);
+
+		Result Access(uint64_t address, bool write);
+
+		const CacheConfig &GetConfig() const { return config_; }
+		const CacheStats &GetStats() const { return stats_; }
+
+	private:
+		void Touch(uint64_t set, uint32_t way, bool fill);
+		uint32_t ChooseVictim(uint64_t set);
+
+		CacheConfig config_;
+		CacheStats stats_;
+		uint32_t line_bits_;
+		uint64_t set_mask_;
+
+		// per line, indexed by set * associativity + way. The state holds
+		// the dirty bit and the LRU age or RRIP prediction.
+		std::vector<uint64_t> tags_;
+		std::vector<uint8_t> state_;
+
+		// per set pseudo-LRU tree
+		std::vector<uint64_t> plru_;
+	};
+
+	// Split L1 instruction and data caches backed by optional unified L2 and
+	// L3 caches. Misses are attributed to the PC of the instruction which
+	// caused them.
+	class CacheHierarchy
+	{
+	public:
+		enum Level {
+			Level_L1I,
+			Level_L1D,
+			Level_L2,
+			Level_L3,
+			Level_Count
+		};
+
+		struct PCMisses {
+			uint64_t misses[Level_Count];
+		};
+
+		CacheHierarchy(const CacheConfig (&configs)[Level_Count]);
+
+		void Fetch(uint64_t pc);
+		void Read(uint64_t pc, uint64_t address, uint32_t width);
+		void Write(uint64_t pc, uint64_t address, uint32_t width);
+
+		// Simulate every instruction fetch and memory access in a trace
+		void Run(const RecordBlockReader &reader);
+
+		static const char *GetLevelName(Level level);
+
+		bool HasLevel(Level level) const { return caches_[level].GetConfig().size != 0; }
+		const Cache &GetCache(Level level) const { return caches_[level]; }
+		const std::unordered_map<uint64_t, PCMisses> &GetPCMisses() const { return pc_misses_; }
+
+		uint64_t GetInstructionCount() const { return instructions_; }
+		uint64_t GetMemoryReads() const { return memory_reads_; }
+		uint64_t GetMemoryWrites() const { return memory_writes_; }
+
+	private:
+		void Access(int level, uint64_t pc, uint64_t address, uint32_t width, bool write);
+		void AccessLine(int level, uint64_t pc, uint64_t address, bool write);
+
+		std::vector<Cache> caches_;
+		int next_level_[Level_Count];
+
+		std::unordered_map<uint64_t, PCMisses> pc_misses_;
+		uint64_t instructions_;
+		uint64_t memory_reads_, memory_writes_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,104 @@
+#ifndef CONTROLFLOWGRAPH_H
+#define CONTROLFLOWGRAPH_H
+
+#include "RecordBlockReader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <unordered_map>
+#include <unordered_set>
+#include <vector>
+
+namespace libtrace {
+
+	// Reconstructs basic blocks and the edges between them from the PC
+	// stream of a trace. Two consecutive instructions are sequential if the
+	// second follows the first by at most max_instruction_size bytes; any
+	// other change of PC ends a block.
+	//
+	// While PCs are being added the graph records runs of sequential
+	// instructions. Graphs built from consecutive parts of a trace can be
+	// merged, joining up any run which crosses the boundary, so a trace can
+	// be processed in parallel. Finish then splits the runs into basic
+	// blocks, so that every block is entered only at its start and left only
+	// at its end.
+	class ControlFlowGraph
+	{
+	public:
+		struct BasicBlock {
+			uint64_t start, end;	// PCs of the first and last instructions
+			uint64_t instructions;
+			uint64_t executions;
+		};
+
+		struct Edge {
+			uint64_t from, to;		// block start PCs
+			uint64_t count;
+		};
+
+		static const uint64_t kDefaultMaxInstructionSize = 4;
+
+		ControlFlowGraph(uint64_t max_instruction_size = kDefaultMaxInstructionSize);
+
+		// Build the graph for a whole trace using the given number of threads
+		void Build(const RecordBlockReader &reader, unsigned threads);
+
+		// Add the PCs of the instruction headers in records [first, last)
+		void Accumulate(const RecordBlockReader &reader, uint64_t first, uint64_t last);
+		void AddPC(uint64_t pc);
+
+		// Append a graph built from the part of the trace immediately after
+		// this one
+		void Merge(const ControlFlowGraph &next);
+
+		// Close the last run and compute the basic blocks and edges. No more
+		// PCs can be added afterwards.
+		void Finish();
+
+		uint64_t GetInstructionCount() const { return instructions_; }
+
+		// Sorted by start PC, and by (from, to)
+		const std::vector<BasicBlock> &GetBlocks() const { return blocks_; }
+		const std::vector<Edge> &GetEdges() const { return edges_; }
+
+		// Compact binary form of the finished graph
+		bool Save(FILE *f) const;
+		bool Load(FILE *f);
+
+		// Write the blocks starting in [low, high) and their edges as a
+		// graphviz digraph
+		void WriteDot(FILE *f, uint64_t low, uint64_t high) const;
+
+	private:
+		struct PCPair {
+			uint64_t first, second;
+			bool operator==(const PCPair &other) const { return first == other.first && second == other.second; }
+		};
+		struct PCPairHash {
+			size_t operator()(const PCPair &p) const { return (p.first * 0x9e3779b97f4a7c15ULL) ^ (p.second + (p.second << 17)); }
+		};
+		typedef std::unordered_map<PCPair, uint64_t, PCPairHash> pair_counts_t;
+
+		bool IsSequential(uint64_t from, uint64_t to) const { return to > from && to - from <= max_instruction_size_; }
+
+		uint64_t max_instruction_size_;
+		uint64_t instructions_;
+
+		// runs of sequential instructions, keyed by (first PC, last PC), and
+		// the discontinuities between them, keyed by (last PC, next PC)
+		pair_counts_t runs_;
+		pair_counts_t jumps_;
+		std::unordered_set<uint64_t> pcs_;
+
+		// the run in progress, and the end of the first run (which may need
+		// to be joined to the end of a previous graph)
+		uint64_t first_pc_, first_run_end_, run_start_, prev_pc_;
+		bool first_run_closed_;
+
+		std::vector<BasicBlock> blocks_;
+		std::vector<Edge> edges_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,88 @@
+#ifndef FILTEREXPRESSION_H
+#define FILTEREXPRESSION_H
+
+#include "InstructionState.h"
+
+#include <cstdint>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace libtrace {
+
+	// A predicate over instructions, written in a small C-like expression
+	// language and compiled to a flat stack bytecode. For example:
+	//
+	//   (pc & 0xf0000000) != 0xc0000000 && asid == 3
+	//   mode == 0 && writes_mem(0x1000, 0x2000)
+	//
+	// Fields: pc, code, isa, mode (exception mode), asid, index (instruction
+	// number), reg_writes, mem_reads and mem_writes (counts).
+	// Functions, which take constant arguments:
+	//   reg(n)             value written to register n, or 0
+	//   writes_reg(n)      whether register n is written
+	//   reads_mem(lo, hi)  whether any read falls in [lo, hi)
+	//   writes_mem(lo, hi), accesses_mem(lo, hi)
+	// Operators have their C meanings and precedences: ! ~ - * + << >> < <=
+	// > >= == != & ^ | && ||. Both sides of && and || are always evaluated.
+	//
+	// Expressions which only compare the PC against constants are reduced to
+	// a set of PC ranges and evaluated without the interpreter.
+	class FilterExpression
+	{
+	public:
+		static const uint32_t kDefaultASIDRegister = 0xf0;
+
+		FilterExpression();
+
+		bool Compile(const std::string &text, std::string &error);
+
+		// The ASID is tracked as the last value written to this register
+		// before each instruction (see RecordASIDCat)
+		void SetASIDRegister(uint32_t reg) { asid_register_ = reg; }
+
+		// Evaluate the expression for each instruction of a batch, in trace
+		// order. Batches must be passed in order, so that the ASID can be
+		// tracked across them.
+		void Evaluate(const InstructionStateBatch &batch, std::vector<uint8_t> &matches);
+
+		bool IsPCRangeFilter() const { return pc_range_filter_; }
+		const std::vector<std::pair<uint64_t, uint64_t>> &GetPCRanges() const { return pc_ranges_; }
+
+	private:
+		enum Opcode {
+			Op_Const,
+			Op_PC, Op_Code, Op_ISA, Op_Mode, Op_ASID, Op_Index,
+			Op_RegWrites, Op_MemReads, Op_MemWrites,
+			Op_Reg, Op_WritesReg, Op_ReadsMem, Op_WritesMem, Op_AccessesMem,
+			Op_Not, Op_BitNot, Op_Negate,
+			Op_Mul, Op_Add, Op_Sub, Op_Shl, Op_Shr,
+			Op_Lt, Op_Le, Op_Gt, Op_Ge, Op_Eq, Op_Ne,
+			Op_And, Op_Xor, Op_Or, Op_LogicalAnd, Op_LogicalOr
+		};
+
+		struct Instruction {
+			Opcode opcode;
+			uint64_t a, b;
+		};
+
+		class Parser;
+
+		uint64_t Execute(const InstructionStateBatch &batch, const InstructionState &insn, uint64_t index) const;
+		void TrackASID(const InstructionStateBatch &batch, const InstructionState &insn);
+
+		std::vector<Instruction> code_;
+		size_t stack_depth_;
+		bool uses_asid_;
+
+		// sorted, disjoint, inclusive [low, high] ranges
+		bool pc_range_filter_;
+		std::vector<std::pair<uint64_t, uint64_t>> pc_ranges_;
+
+		uint32_t asid_register_;
+		uint64_t asid_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,97 @@
+#ifndef INSTRUCTIONBATCH_H
+#define INSTRUCTIONBATCH_H
+
+#include "InstructionState.h"
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace libtrace {
+
+	// A block of decoded instructions stored as a structure of arrays, so
+	// that analyses which only need a few fields loop over dense arrays of
+	// them (which the compiler can vectorise) rather than striding through
+	// InstructionStates.
+	//
+	// Register and memory accesses have arrays of their own, in trace order.
+	// The accesses of instruction i are [reg_offset[i], reg_offset[i+1]) and
+	// [mem_offset[i], mem_offset[i+1]). Values have their extensions
+	// applied, memory data is masked to its width, and registers are
+	// identified as in InstructionState.
+	//
+	// The arrays act as an arena: they are only ever grown, so a batch which
+	// is reused for each block of a trace stops allocating once it has seen
+	// the largest block. Only the first instructions, reg_accesses and
+	// mem_accesses entries of each are valid.
+	struct InstructionBatch {
+		// global index of the first instruction in the batch
+		uint64_t first_instruction;
+
+		size_t instructions;
+		size_t reg_accesses;
+		size_t mem_accesses;
+
+		// per instruction
+		std::vector<uint64_t> record_idx;
+		std::vector<uint64_t> pc;
+		std::vector<uint64_t> code;
+		std::vector<uint16_t> isa_mode;
+		std::vector<uint16_t> exception_mode;
+		std::vector<uint32_t> reg_offset;	// instructions + 1 entries
+		std::vector<uint32_t> mem_offset;
+
+		// per register access
+		std::vector<uint32_t> reg_index;
+		std::vector<uint64_t> reg_value;
+		std::vector<uint8_t> reg_write;		// 1 for writes, 0 for reads
+
+		// per memory access
+		std::vector<uint64_t> mem_address;
+		std::vector<uint64_t> mem_data;
+		std::vector<uint32_t> mem_width;
+		std::vector<uint8_t> mem_write;
+
+		InstructionBatch() : first_instruction(0), instructions(0), reg_accesses(0), mem_accesses(0) {}
+
+		// Replace the contents of the batch with the instructions whose
+		// headers are in records [0, count), where records[0] is record
+		// base_idx of the trace. Records before the first header are
+		// skipped. Unless final is set, the last instruction is left out,
+		// since the rest of it may be past the end of the span. Returns the
+		// number of records used, which is where the next span should start.
+		size_t Decode(const Record *records, size_t count, uint64_t base_idx, bool final);
+
+		// Drop every instruction from the nth on
+		void Truncate(size_t n);
+
+	private:
+		void Reserve(size_t count);
+	};
+
+	// Decodes the instructions whose headers are in records [first, last) of
+	// a trace into batches. Unlike InstructionStateReader this runs on the
+	// caller's thread, and can start part way through an instruction.
+	class InstructionBatchReader
+	{
+	public:
+		static const size_t kDefaultBatchRecords = 1 << 16;
+
+		// The first instruction found is numbered first_instruction
+		InstructionBatchReader(const RecordBlockReader &reader, uint64_t first = 0, uint64_t last = UINT64_MAX, uint64_t first_instruction = 0, size_t batch_records = kDefaultBatchRecords);
+
+		// Fill the batch with the next instructions. Returns false once
+		// there are none left.
+		bool Next(InstructionBatch &batch);
+
+	private:
+		const RecordBlockReader &reader_;
+		uint64_t position_, last_;
+		uint64_t instruction_;
+		std::vector<Record> buffer_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,66 @@
+#ifndef INSTRUCTIONINDEXER_H
+#define INSTRUCTIONINDEXER_H
+
+#include "RecordBlockReader.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libtrace {
+
+	// Progressively builds bookmarks (the record index of every Nth
+	// instruction header) on a background thread. Bookmarks can be queried
+	// while indexing is in progress, so interactive tools can use the part of
+	// the trace which has already been indexed straight away.
+	class InstructionIndexer
+	{
+	public:
+		InstructionIndexer(const RecordBlockReader &reader, uint64_t bookmark_width);
+		~InstructionIndexer();
+
+		uint64_t GetBookmarkWidth() const { return bookmark_width_; }
+
+		// Find the closest bookmark at or before instruction insn. Returns
+		// false if the instruction has not been indexed (yet).
+		bool GetBookmark(uint64_t insn, uint64_t &bookmark_insn, uint64_t &record_idx);
+
+		// Find the instruction which record record_idx belongs to. Returns
+		// false if the record has not been indexed (yet).
+		bool GetInstruction(uint64_t record_idx, uint64_t &insn);
+
+		// Progress so far: the number of instructions found, and the number of
+		// records scanned
+		uint64_t GetInstructionCount() const { return instructions_; }
+		uint64_t GetScannedRecords() const { return scanned_records_; }
+		uint64_t GetTotalRecords() const { return reader_.Size(); }
+
+		bool IsComplete() const { return complete_; }
+
+		// Continue indexing from where the last scan stopped, for when the
+		// reader has grown since it completed. Returns true if a new scan was
+		// started. Should only be called from one thread.
+		bool Update();
+
+	private:
+		void Run();
+
+		const RecordBlockReader &reader_;
+		uint64_t bookmark_width_;
+
+		std::mutex lock_;
+		std::vector<uint64_t> bookmarks_;
+
+		std::atomic<uint64_t> instructions_;
+		std::atomic<uint64_t> scanned_records_;
+		std::atomic<bool> complete_;
+		std::atomic<bool> stopping_;
+
+		std::thread thread_;
+	};
+
+}
+
+#endif
@@ -7,6 +7,7 @@
 
 namespace libtrace {
 
+	class ArchInterface;
 	class RecordIterator;
 	class TracePacketStreamInterface;
 	
@@ -35,6 +36,10 @@ namespace libtrace {
 		{
 			_print_reg_read = _print_reg_write = _print_bank_read = _print_bank_write = _print_mem_read = _print_mem_write = 1;
 		}
+
+		// Print the disassembly of each instruction after its code, or not
+		// if arch is null
+		void SetArchInterface(ArchInterface *arch) { _arch = arch; }
 		
 	private:
 		bool PrintRegRead(std::ostream &str, RegReadRecord *rcd, const extension_list_t& extensions);
@@ -48,6 +53,7 @@ namespace libtrace {
 		bool FormatData(std::ostream &str, uint32_t data_low, const extension_list_t &extensions);
 		
 		bool _print_reg_read, _print_reg_write, _print_bank_read, _print_bank_write, _print_mem_read, _print_mem_write;
+		ArchInterface *_arch;
 	};
 
 }
@@ -0,0 +1,104 @@
+#ifndef INSTRUCTIONSTATE_H
+#define INSTRUCTIONSTATE_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libtrace {
+
+	// Registers in banks are identified by kBankedRegister | bank << 8 | regnum
+	static const uint32_t kBankedRegister = 0x10000;
+
+	struct RegAccess {
+		uint32_t index;
+		uint64_t value;
+	};
+
+	struct MemAccess {
+		uint64_t address;
+		uint64_t data;
+		uint32_t width;
+	};
+
+	// The architectural effects of a single instruction. Register and memory
+	// accesses live in flat arrays in the owning batch, and are referred to
+	// by [begin, end) offsets.
+	struct InstructionState {
+		uint64_t record_idx;
+		uint64_t pc;
+		uint64_t code;
+		uint16_t isa_mode;
+		uint16_t exception_mode;
+
+		uint32_t reg_write_begin, reg_write_end;
+		uint32_t mem_read_begin, mem_read_end;
+		uint32_t mem_write_begin, mem_write_end;
+	};
+
+	struct InstructionStateBatch {
+		// global index of the first instruction in the batch
+		uint64_t first_instruction;
+
+		std::vector<InstructionState> instructions;
+		std::vector<RegAccess> reg_writes;
+		std::vector<MemAccess> mem_reads;
+		std::vector<MemAccess> mem_writes;
+
+		void Clear();
+
+		const RegAccess *RegWritesBegin(const InstructionState &i) const { return reg_writes.data() + i.reg_write_begin; }
+		const RegAccess *RegWritesEnd(const InstructionState &i) const { return reg_writes.data() + i.reg_write_end; }
+		const MemAccess *MemReadsBegin(const InstructionState &i) const { return mem_reads.data() + i.mem_read_begin; }
+		const MemAccess *MemReadsEnd(const InstructionState &i) const { return mem_reads.data() + i.mem_read_end; }
+		const MemAccess *MemWritesBegin(const InstructionState &i) const { return mem_writes.data() + i.mem_write_begin; }
+		const MemAccess *MemWritesEnd(const InstructionState &i) const { return mem_writes.data() + i.mem_write_end; }
+	};
+
+	// Decodes instructions from a trace into batches of InstructionStates on
+	// a background thread, so that reading and decoding the trace overlaps
+	// with whatever the consumer does with the batches. Batches are recycled,
+	// so no allocation happens once the reader has warmed up.
+	class InstructionStateReader
+	{
+	public:
+		static const size_t kBatchInstructions = 1 << 14;
+		static const size_t kQueueDepth = 4;
+
+		// Start decoding at record_idx, which must be an instruction header,
+		// and number that instruction first_instruction.
+		InstructionStateReader(const RecordBlockReader &reader, uint64_t record_idx, uint64_t first_instruction);
+		~InstructionStateReader();
+
+		// Get the next batch of instructions, or nullptr at the end of the
+		// trace. The batch remains valid until the next call.
+		const InstructionStateBatch *Next();
+
+	private:
+		void Run();
+		void Publish(InstructionStateBatch *batch);
+		InstructionStateBatch *GetFreeBatch();
+
+		const RecordBlockReader &reader_;
+		uint64_t record_idx_;
+		uint64_t first_instruction_;
+
+		std::vector<InstructionStateBatch> batches_;
+		std::deque<InstructionStateBatch*> free_, full_;
+		InstructionStateBatch *current_;
+		bool finished_, stopping_;
+
+		std::mutex lock_;
+		std::condition_variable cond_;
+		std::thread thread_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,44 @@
+#ifndef PCSTREAM_H
+#define PCSTREAM_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace libtrace {
+
+	// Sequentially extracts the PC of each instruction in a trace, starting at
+	// an instruction header. PCs are widened to 64 bits using the header's data
+	// extension when one is present.
+	class PCStreamReader
+	{
+	public:
+		static const size_t kBufferRecords = 1 << 16;
+
+		PCStreamReader(const RecordBlockReader &reader, uint64_t record_idx = 0);
+
+		// Read up to count PCs. Returns the number read, which is less than
+		// count only at the end of the trace.
+		size_t Read(uint64_t *pcs, size_t count);
+
+		// Index of the next unread record
+		uint64_t GetRecordIndex() const { return buffer_base_ + buffer_pos_; }
+
+	private:
+		bool Fill();
+
+		const RecordBlockReader &reader_;
+		std::vector<Record> buffer_;
+		uint64_t buffer_base_;
+		size_t buffer_pos_, buffer_end_;
+	};
+
+	// Returns the index of the first element which differs between a and b, or
+	// count if they are identical.
+	size_t FindFirstMismatch(const uint64_t *a, const uint64_t *b, size_t count);
+
+}
+
+#endif
@@ -0,0 +1,91 @@
+#ifndef RECORDBLOCKREADER_H
+#define RECORDBLOCKREADER_H
+
+#include "RecordTypes.h"
+#include "TraceRecordStream.h"
+
+#include <atomic>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+namespace libtrace {
+
+	// Reads blocks of records directly from a trace file descriptor using pread.
+	// Unlike RecordFile there is no shared buffer or file position, so a single
+	// reader can be used from several threads at once.
+	class RecordBlockReader
+	{
+	public:
+		// With complete_only, the initial size is found as by RefreshComplete
+		RecordBlockReader(FILE *f, bool complete_only = false);
+		RecordBlockReader(int fd, bool complete_only = false);
+		RecordBlockReader(const RecordBlockReader &other);
+		RecordBlockReader &operator=(const RecordBlockReader &other);
+
+		// Read up to count records starting at record index first. Returns the
+		// number of complete records read, which is less than count at the end
+		// of the file.
+		size_t Read(uint64_t first, Record *buffer, size_t count) const;
+
+		// Copy up to count records starting at record index first to out_fd
+		// at byte offset out_offset, without going through user space where
+		// the kernel supports it. Neither file position is used, so several
+		// copies can run at once. Returns the number of records copied.
+		uint64_t CopyTo(uint64_t first, uint64_t count, int out_fd, uint64_t out_offset) const;
+
+		// Like CopyTo, but write at out_fd's file position, which also works
+		// for pipes (using splice) and files opened for appending. Returns the
+		// number of records written.
+		uint64_t WriteTo(uint64_t first, uint64_t count, int out_fd) const;
+
+		// Re-read the size of the underlying file, for traces which are still
+		// being written.
+		uint64_t Refresh();
+
+		// Like Refresh, but stop before the last instruction header in the
+		// file, so that an instruction (or record) which is still being
+		// written is never exposed. The size never shrinks, and this can be
+		// called while other threads are reading.
+		uint64_t RefreshComplete();
+
+		// A hash of the file's identity (device, inode and modification
+		// time), its size, and its first and last records. Files built from
+		// a trace (such as indices and summaries) store this so that they
+		// can tell when the trace has been rewritten, even in place.
+		uint64_t GetIdentityHash() const;
+
+		uint64_t Size() const { return count_; }
+		int GetFD() const { return fd_; }
+
+	private:
+		uint64_t GetFileRecords() const;
+
+		int fd_;
+		std::atomic<uint64_t> count_;
+	};
+
+	// Random access to the records of a RecordBlockReader through a private
+	// page buffer. Each thread should use its own buffer.
+	class RecordBlockBuffer : public RecordBufferInterface
+	{
+	public:
+		RecordBlockBuffer(const RecordBlockReader &reader);
+
+		// Returns an Unknown record if i is beyond the end of the trace, so
+		// callers should check i against Size()
+		Record Get(size_t i) override;
+		size_t Size() override { return reader_.Size(); }
+
+	private:
+		static const size_t kPageRecords = 1 << 16;
+
+		const RecordBlockReader &reader_;
+		std::vector<Record> page_;
+		uint64_t page_base_;
+		size_t page_count_;
+	};
+
+}
+
+#endif
@@ -5,7 +5,9 @@
 #include "RecordIterator.h"
 #include "TraceRecordStream.h"
 
+#include <algorithm>
 #include <cassert>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
 
@@ -22,6 +24,19 @@ namespace libtrace {
 		Record Get(size_t i) { if(i >= _count) assert(false); if(!_buffer || _buffer_page != BufferPage(i)) loadBuffer(i); return _buffer[BufferOffset(i)]; }
 		uint64_t Size() { return _count; }
 		
+		// Re-read the size of the file, for traces which are still being
+		// written, exposing at most limit records
+		uint64_t Refresh(uint64_t limit = UINT64_MAX) {
+			clearerr(_file);
+			fseek(_file, 0, SEEK_END);
+			uint64_t size = ftell(_file);
+			_count = std::min<uint64_t>(size / sizeof(Record), limit);
+			
+			// the buffered page may have been read before it was filled in
+			_buffer_page = UINT64_MAX;
+			return _count;
+		}
+		
 	private:
 		static const uint64_t kBufferBits = 17;
 		static const uint64_t kBufferCount = 1 << kBufferBits;
@@ -28,7 +28,7 @@ namespace libtrace {
 			
 			size_t GetSize() const { return 4 + reader_.extensions_.size() * 4; }
 			uint32_t AsU32() const { return reader_.GetRecord().GetData32(); }
-			uint64_t AsU64() const { return (uint64_t)reader_.GetRecord().GetData32() | ((uint64_t)reader_.GetExtensions().at(0).GetData32() << 32); }
+			uint64_t AsU64() const { return (uint64_t)reader_.GetRecord().GetData32() | (reader_.GetExtensions().empty() ? 0 : (uint64_t)reader_.GetExtensions()[0].GetData32() << 32); }
 			
 		private:
 			const RecordReader &reader_;
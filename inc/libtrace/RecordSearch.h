@@ -0,0 +1,81 @@
+#ifndef RECORDSEARCH_H
+#define RECORDSEARCH_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+#include "TraceSummary.h"
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace libtrace {
+
+	// Searches a trace for the nearest record, in either direction, whose
+	// data satisfies (data & mask) == value and whose type is in a set of
+	// record types. The range to search is split into chunks which are
+	// handed out to a pool of threads in order of distance from the start,
+	// so the search stops as soon as the nearest match is known. Given a
+	// TraceSummary, chunks which cannot match are skipped without reading.
+	//
+	// Searches run in the background and can be cancelled at any time.
+	class RecordSearch
+	{
+	public:
+		static const uint32_t kAllTypes = ~0u;
+
+		static uint32_t TypeBit(TraceRecordType type) { return 1u << type; }
+
+		RecordSearch(const RecordBlockReader &reader, unsigned threads);
+		~RecordSearch();
+
+		// Start searching from record index from (inclusive). types is a
+		// bitmap of TypeBit()s. Any search already in progress is cancelled.
+		void Start(uint32_t value, uint32_t mask, uint32_t types, uint64_t from, bool reverse);
+		void Cancel();
+		void Wait();
+
+		// Skip chunks of the trace which the summary shows cannot match. The
+		// summary is not owned and may be null.
+		void SetSummary(const TraceSummary *summary);
+
+		bool IsRunning() const { return running_ != 0; }
+
+		// The result of the last completed search. Returns false if nothing
+		// matched or the search was cancelled.
+		bool GetMatch(uint64_t &record_idx) const;
+
+		// Progress of the current search, in records
+		uint64_t GetScannedRecords() const { return scanned_; }
+		uint64_t GetTotalRecords() const { return total_; }
+
+	private:
+		void Run();
+		bool GetChunk(uint64_t chunk, uint64_t &begin, uint64_t &end) const;
+		void Join();
+
+		const RecordBlockReader &reader_;
+		unsigned thread_count_;
+		std::vector<std::thread> threads_;
+
+		uint32_t value_, mask_, types_;
+		const TraceSummary *summary_;
+		uint64_t from_;
+		bool reverse_;
+
+		std::mutex lock_;
+		uint64_t match_;
+
+		std::atomic<uint64_t> next_chunk_;
+		std::atomic<uint64_t> best_chunk_;
+		std::atomic<uint64_t> scanned_;
+		std::atomic<unsigned> running_;
+		std::atomic<bool> cancelled_;
+		uint64_t total_, chunk_count_;
+	};
+
+}
+
+#endif
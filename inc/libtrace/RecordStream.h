@@ -3,34 +3,68 @@
 
 #include "RecordTypes.h"
 #include "RecordIterator.h"
+#include "TraceFollower.h"
 
 #include <cassert>
 #include <cstdio>
 #include <cstdlib>
+#include <cstring>
 
 namespace libtrace {
 
+// Reads records from a file or pipe in order. With a follower, reaching the
+// end of the file waits for more to be written (like tail -f) rather than
+// ending the stream, and a partly written record is held back until the rest
+// of it arrives.
 class RecordStream
 {
 public:
-	RecordStream(FILE *f) : _file(f), _buffer(0), _buffer_ptr(0), _good(true) { _buffer = new Record[kBufferEntries]; _buffer_ptr = _buffer+kBufferEntries; }
+	RecordStream(FILE *f, TraceFollower *follower = nullptr) : _file(f), _follower(follower), _buffer(0), _buffer_ptr(0), _buffer_end(0), _partial(0), _good(true) { _buffer = new Record[kBufferEntries]; _buffer_ptr = _buffer_end = _buffer+kBufferEntries; }
 	
-	const Record &next() { if(buffer_empty()) refill_buffer(); return *_buffer_ptr++; }
-	const Record &peek() { if(buffer_empty()) refill_buffer(); return *_buffer_ptr; }
-	bool good() { return _good; }
+	const Record &next() { if(buffer_empty()) refill_buffer(); return buffer_empty() ? _empty : *_buffer_ptr++; }
+	const Record &peek() { if(buffer_empty()) refill_buffer(); return buffer_empty() ? _empty : *_buffer_ptr; }
+	bool good() { if(buffer_empty()) refill_buffer(); return _good; }
 	
+	// true if the next record can be read without waiting
+	bool available() const { return _buffer_ptr != _buffer_end; }
 	
 private:
 	static const uint32_t kBufferEntries = 1 << 10;
 
 	FILE *_file;
+	TraceFollower *_follower;
 	
 	Record *_buffer;
 	Record *_buffer_ptr;
+	Record *_buffer_end;
+	size_t _partial;
 	bool _good;
 	
-	bool buffer_empty() { return (_buffer_ptr == (_buffer+kBufferEntries)); }
-	void refill_buffer() { _good = (!feof(_file) && (fread(_buffer, sizeof(Record), kBufferEntries, _file) >= 0)); _buffer_ptr = _buffer; }
+	// returned once the stream has ended
+	Record _empty;
+	
+	bool buffer_empty() { return _buffer_ptr == _buffer_end; }
+	void refill_buffer() {
+		if(!_good) return;
+		
+		// keep the start of a record which was cut off by the last read
+		char *data = (char*)_buffer;
+		size_t bytes = _partial;
+		memmove(data, _buffer_end, _partial);
+		
+		while(true) {
+			bytes += fread(data + bytes, 1, kBufferEntries * sizeof(Record) - bytes, _file);
+			if(bytes >= sizeof(Record) || !_follower) break;
+			
+			clearerr(_file);
+			_follower->WaitForGrowth(-1);
+		}
+		
+		_buffer_ptr = _buffer;
+		_buffer_end = _buffer + bytes / sizeof(Record);
+		_partial = bytes % sizeof(Record);
+		_good = (_buffer_ptr != _buffer_end);
+	}
 };
 
 }
@@ -0,0 +1,81 @@
+#ifndef REUSEDISTANCE_H
+#define REUSEDISTANCE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <map>
+#include <set>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace libtrace {
+
+	// Measures the reuse (LRU stack) distance of a stream of memory
+	// accesses at a given block granularity: the number of distinct blocks
+	// accessed since the last access to the same block. Each block's most
+	// recent access time is marked in a Fenwick tree, so a distance is a
+	// prefix sum and each access costs O(log n). Timestamps are compacted
+	// when the tree fills up, so the tree stays proportional to the number
+	// of blocks being tracked.
+	//
+	// Memory can be bounded by spatially sampling blocks (SHARDS): only
+	// blocks whose hash falls below a threshold are tracked, and distances
+	// and counts are scaled by the sampling rate. With a fixed rate, memory
+	// is proportional to the number of distinct blocks; with max_blocks set,
+	// the threshold is lowered whenever more than max_blocks blocks are
+	// being tracked.
+	//
+	// Distances are collected into power of two buckets, so the miss ratio
+	// of a fully associative LRU cache is exact for any power of two size.
+	class ReuseDistance
+	{
+	public:
+		// bucket 0 holds distance 0, and bucket k holds [2^(k-1), 2^k)
+		static const size_t kBuckets = 65;
+
+		struct Histogram {
+			double buckets[kBuckets];
+			double cold;
+			double accesses;
+		};
+
+		ReuseDistance(unsigned block_bits, double sample_rate = 1.0, size_t max_blocks = 0);
+
+		// Record an access, attributing its distance to a group (e.g. an
+		// ASID or a region of code)
+		void Access(uint64_t address, uint64_t group = 0);
+
+		unsigned GetBlockBits() const { return block_bits_; }
+		double GetSampleRate() const;
+
+		const std::map<uint64_t, Histogram> &GetHistograms() const { return histograms_; }
+
+		// The miss ratio of an LRU cache of 2^k blocks, for each k up to and
+		// including the first size with only cold misses
+		static std::vector<double> GetMissRatioCurve(const Histogram &histogram);
+
+	private:
+		void Mark(uint64_t timestamp, int32_t delta);
+		uint64_t CountMarks(uint64_t timestamp) const;
+		void Compact();
+		void Evict();
+
+		unsigned block_bits_;
+		size_t max_blocks_;
+		uint64_t threshold_;
+
+		// 1-based timestamps of the most recent access to each block
+		std::unordered_map<uint64_t, uint64_t> last_access_;
+		std::vector<int32_t> tree_;
+		uint64_t now_;
+
+		// sampled blocks ordered by hash, when the sample size is bounded
+		std::set<std::pair<uint64_t, uint64_t>> sampled_;
+
+		std::map<uint64_t, Histogram> histograms_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,50 @@
+#ifndef REVERSEINSTRUCTIONSCANNER_H
+#define REVERSEINSTRUCTIONSCANNER_H
+
+#include "RecordBlockReader.h"
+
+#include <cstdint>
+#include <vector>
+
+namespace libtrace {
+
+	// Finds instructions near the end of a trace by reading blocks backwards
+	// from the end of the file, so that the cost depends on how much of the
+	// trace is wanted rather than on how long it is.
+	//
+	// Instruction headers can be recognised from either direction, since no
+	// other record (including DataExtension records) has their type. The
+	// record indices returned are packet starts, so an instruction which
+	// opens a bundle starts at its bundle header.
+	class ReverseInstructionScanner
+	{
+	public:
+		static const size_t kDefaultBlockRecords = 1 << 16;
+
+		ReverseInstructionScanner(const RecordBlockReader &reader, size_t block_records = kDefaultBlockRecords);
+
+		// Find the start of the last count instructions. Returns the number
+		// of instructions found, which is less than count if the trace is
+		// shorter, in which case record_idx is the start of the first one.
+		uint64_t FindLast(uint64_t count, uint64_t &record_idx);
+
+		// Find the start of instruction insn, given the number of
+		// instructions in the trace (from an index or summary). Returns
+		// false if the trace does not contain it.
+		bool FindInstruction(uint64_t insn, uint64_t instruction_count, uint64_t &record_idx);
+
+		// The start of the packet whose instruction header is at header_idx
+		static uint64_t GetPacketStart(const RecordBlockReader &reader, uint64_t header_idx);
+
+		// Records read by the scans so far
+		uint64_t GetScannedRecords() const { return scanned_records_; }
+
+	private:
+		const RecordBlockReader &reader_;
+		std::vector<Record> buffer_;
+		uint64_t scanned_records_;
+	};
+
+}
+
+#endif
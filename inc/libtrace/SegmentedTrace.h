@@ -0,0 +1,137 @@
+#ifndef SEGMENTEDTRACE_H
+#define SEGMENTEDTRACE_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+#include "TraceRecordStream.h"
+#include "TraceSink.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace libtrace {
+
+	// One file of a trace which has been split into segments. Each segment
+	// starts at an instruction boundary, so it is a complete trace by
+	// itself.
+	struct TraceSegment {
+		std::string path;		// relative to the manifest's directory
+		uint64_t first_record, records;
+		uint64_t first_instruction, instructions;
+	};
+
+	// The list of segments making up a trace, stored as a text file with
+	// one line per segment
+	class TraceManifest
+	{
+	public:
+		static std::string GetManifestPath(const std::string &prefix);
+		static std::string GetSegmentPath(const std::string &prefix, size_t segment);
+
+		bool Load(const std::string &path);
+
+		// The manifest is replaced atomically, so readers never see a
+		// partly written one
+		bool Save(const std::string &path) const;
+
+		std::vector<TraceSegment> &GetSegments() { return segments_; }
+		const std::vector<TraceSegment> &GetSegments() const { return segments_; }
+		size_t GetSegmentCount() const { return segments_.size(); }
+
+		uint64_t GetRecordCount() const;
+		uint64_t GetInstructionCount() const;
+
+		// The segment holding a global record or instruction index, or
+		// GetSegmentCount() if it is past the end of the trace
+		size_t FindRecord(uint64_t record_idx) const;
+		size_t FindInstruction(uint64_t insn) const;
+
+	private:
+		std::vector<TraceSegment> segments_;
+	};
+
+	// Writes a trace as a series of files <prefix>.0000, <prefix>.0001, ...
+	// A new segment is started at the first instruction boundary after the
+	// current one reaches max_records records or max_instructions
+	// instructions (0 for no limit). The manifest, <prefix>.manifest, is
+	// rewritten whenever a segment is finished and on every Flush.
+	class SegmentedFileTraceSink : public TraceSink
+	{
+	public:
+		SegmentedFileTraceSink(const std::string &prefix, uint64_t max_records, uint64_t max_instructions = 0);
+		~SegmentedFileTraceSink();
+
+		void SinkPackets(const TraceRecord *start, const TraceRecord *end) override;
+		void Flush() override;
+
+		const TraceManifest &GetManifest() const { return manifest_; }
+
+	private:
+		void OpenSegment();
+		void Roll();
+		void Buffer(const TraceRecord *start, const TraceRecord *end);
+		void WriteBuffer();
+
+		std::string prefix_;
+		uint64_t max_records_, max_instructions_;
+
+		FILE *file_;
+		TraceManifest manifest_;
+		std::vector<TraceRecord> records_;
+	};
+
+	// Presents the segments listed in a manifest as one trace, with global
+	// record and instruction numbering. Like RecordBlockReader, Read can be
+	// used from several threads at once; Get uses a private page buffer.
+	class SegmentedTraceReader : public RecordBufferInterface
+	{
+	public:
+		SegmentedTraceReader();
+		~SegmentedTraceReader();
+
+		// Returns false if the manifest or any of its segments cannot be
+		// opened
+		bool Open(const std::string &manifest_path);
+
+		// Reload the manifest, for traces which are still being written
+		bool Refresh();
+
+		// Returns an Unknown record if i is beyond the end of the trace, so
+		// callers should check i against Size()
+		Record Get(size_t i) override;
+		size_t Size() override { return record_count_; }
+
+		// Read up to count records starting at global record index first
+		size_t Read(uint64_t first, Record *buffer, size_t count) const;
+
+		const TraceManifest &GetManifest() const { return manifest_; }
+		const RecordBlockReader &GetSegmentReader(size_t segment) const { return readers_.at(segment); }
+		std::string GetSegmentPath(size_t segment) const;
+
+		// Find the global record index of the header of global instruction
+		// insn. Returns false if the trace does not contain it.
+		bool GetInstructionRecord(uint64_t insn, uint64_t &record_idx) const;
+
+	private:
+		static const size_t kPageRecords = 1 << 16;
+
+		void Close();
+
+		std::string manifest_path_;
+		std::string directory_;
+		TraceManifest manifest_;
+		uint64_t record_count_;
+
+		std::vector<int> fds_;
+		std::vector<RecordBlockReader> readers_;
+
+		std::vector<Record> page_;
+		uint64_t page_base_;
+		size_t page_count_;
+	};
+
+}
+
+#endif
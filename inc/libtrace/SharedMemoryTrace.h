@@ -0,0 +1,101 @@
+#ifndef SHAREDMEMORYTRACE_H
+#define SHAREDMEMORYTRACE_H
+
+#include "RecordTypes.h"
+#include "TraceRecordStream.h"
+#include "TraceSink.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace libtrace {
+
+	struct SharedTraceHeader;
+
+	// Publishes records into a ring buffer in POSIX shared memory, so that
+	// analysers in other processes can follow a trace while it is being
+	// generated without it touching the disk.
+	//
+	// Any number of readers (up to kMaxReaders at once) can attach and
+	// detach at any time, and each consumes at its own rate. By default the
+	// producer never waits, and readers which fall more than a ring behind
+	// lose records. With blocking set, the producer instead waits for the
+	// slowest attached reader.
+	class SharedMemoryTraceSink : public TraceSink
+	{
+	public:
+		static const size_t kDefaultCapacity = 1 << 22;
+		static const size_t kMaxReaders = 16;
+
+		// capacity is in records, and is rounded up to a power of two
+		SharedMemoryTraceSink(const std::string &name, size_t capacity = kDefaultCapacity, bool blocking = false);
+
+		// Marks the trace as finished, so readers stop once they have
+		// consumed the rest of it, and removes the name
+		~SharedMemoryTraceSink();
+
+		void SinkPackets(const TraceRecord *start, const TraceRecord *end) override;
+
+		// Records are visible to readers as soon as they are sunk
+		void Flush() override;
+
+	private:
+		void Publish(const TraceRecord *start, size_t count);
+		void WaitForReaders(uint64_t end);
+
+		std::string name_;
+		SharedTraceHeader *header_;
+		Record *ring_;
+		size_t mapping_size_;
+		uint64_t mask_;
+		uint64_t write_position_;
+		bool blocking_;
+	};
+
+	// Follows a trace published by a SharedMemoryTraceSink. Reading starts
+	// at the next instruction header after the live position, and skips to
+	// the next header after any records which were lost.
+	class SharedMemoryTraceReader : public RecordStreamInputInterface
+	{
+	public:
+		SharedMemoryTraceReader();
+		~SharedMemoryTraceReader();
+
+		// Returns false if there is no trace with this name or it already
+		// has kMaxReaders readers
+		bool Attach(const std::string &name);
+		void Detach();
+
+		// Get, Peek and Skip wait for the producer; Good returns false once
+		// the trace has finished (or the producer has exited without
+		// finishing it) and every record has been read
+		Record Get() override;
+		Record Peek() override;
+		bool Good() override;
+		void Skip(size_t i) override;
+
+		// Records overwritten by the producer before they could be read
+		uint64_t GetLostRecords() const { return lost_; }
+
+	private:
+		bool Fill();
+
+		SharedTraceHeader *header_;
+		const Record *ring_;
+		size_t mapping_size_;
+		uint64_t mask_;
+		size_t slot_;
+
+		// records are copied out of the ring in batches, which are checked
+		// for having been overwritten while they were copied
+		std::vector<Record> batch_;
+		size_t batch_position_, batch_size_;
+		uint64_t read_position_;
+		uint64_t lost_;
+		bool resync_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,113 @@
+#ifndef STATEDIFF_H
+#define STATEDIFF_H
+
+#include "InstructionState.h"
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+namespace libtrace {
+
+	enum DivergenceClass {
+		Divergence_PC,
+		Divergence_Code,
+		Divergence_RegWrite,
+		Divergence_MemRead,
+		Divergence_MemWrite,
+
+		Divergence_ClassCount
+	};
+
+	const char *GetDivergenceClassName(DivergenceClass c);
+
+	// Rules describing which differences between two traces are expected.
+	// Each rule has the form
+	//
+	//   <field> <value>[/<mask>] [<class>[,<class>...]]
+	//
+	// where field is one of pc, code, reg or addr, and the classes are those
+	// returned by GetDivergenceClassName (or 'all', the default). pc and code
+	// rules match instructions and suppress the given classes of divergence
+	// for matching instructions. reg rules ignore writes to a register (banked
+	// registers are kBankedRegister | bank << 8 | regnum) and addr rules
+	// ignore memory accesses to matching byte addresses.
+	//
+	// Rules are compiled into one hash table per distinct mask, so lookups
+	// cost one hash probe per mask in use.
+	class StateDiffRules
+	{
+	public:
+		bool AddRule(const std::string &rule, std::string &error);
+		bool LoadRules(FILE *f, std::string &error);
+
+		// Bitmask of ignored divergence classes for an instruction
+		uint32_t GetIgnoredClasses(uint64_t pc, uint64_t code) const { return pc_rules_.Lookup(pc) | code_rules_.Lookup(code); }
+
+		bool IsRegisterIgnored(uint32_t index) const { return reg_rules_.Lookup(index) & (1 << Divergence_RegWrite); }
+		bool IsAddressIgnored(uint64_t address, DivergenceClass c) const { return addr_rules_.Lookup(address) & (1 << c); }
+
+	private:
+		class RuleTable {
+		public:
+			void Add(uint64_t value, uint64_t mask, uint32_t classes);
+			uint32_t Lookup(uint64_t value) const;
+
+		private:
+			std::vector<std::pair<uint64_t, std::unordered_map<uint64_t, uint32_t>>> groups_;
+		};
+
+		RuleTable pc_rules_, code_rules_, reg_rules_, addr_rules_;
+	};
+
+	struct Divergence {
+		DivergenceClass divergence_class;
+
+		const InstructionState *instruction1, *instruction2;
+		uint64_t instruction_idx1, instruction_idx2;
+
+		// The register index or byte address which differs, and the values
+		// seen in each trace. present1/present2 are false if the register or
+		// address was not accessed at all in that trace.
+		uint64_t key;
+		uint64_t value1, value2;
+		bool present1, present2;
+	};
+
+	// Compares the architectural effects of pairs of instructions: the PC and
+	// instruction word, the final value written to each register, and the
+	// bytes read from and written to memory.
+	class StateDiff
+	{
+	public:
+		typedef std::function<void(const Divergence &)> reporter_t;
+
+		StateDiff(const StateDiffRules &rules);
+
+		// Compare instruction i1 of b1 with instruction i2 of b2, calling
+		// reporter for each divergence found. Returns false if the PCs differ,
+		// since the traces can no longer be compared in lockstep.
+		bool Compare(const InstructionStateBatch &b1, size_t i1, const InstructionStateBatch &b2, size_t i2, const reporter_t &reporter);
+
+	private:
+		struct ByteAccess {
+			uint64_t address;
+			uint8_t value;
+		};
+
+		void CollectRegisters(const InstructionStateBatch &batch, const InstructionState &insn, std::vector<RegAccess> &out);
+		void CollectBytes(const MemAccess *begin, const MemAccess *end, bool keep_last, std::vector<ByteAccess> &out);
+
+		const StateDiffRules &rules_;
+
+		// scratch space, reused between instructions
+		std::vector<RegAccess> regs1_, regs2_;
+		std::vector<ByteAccess> bytes1_, bytes2_;
+	};
+
+}
+
+#endif
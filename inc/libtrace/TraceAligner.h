@@ -0,0 +1,86 @@
+#ifndef TRACEALIGNER_H
+#define TRACEALIGNER_H
+
+#include "PCStream.h"
+
+#include <cstdint>
+#include <functional>
+#include <vector>
+
+namespace libtrace {
+
+	// A run of instructions in two traces which does not match. Instruction
+	// indices are zero based, and either length may be zero (e.g. when one
+	// trace takes an extra interrupt).
+	struct DivergentRegion {
+		uint64_t start1, length1;
+		uint64_t start2, length2;
+
+		// false if the traces could not be brought back into step, either
+		// because no anchor was found within the window or because one of
+		// the traces ended
+		bool resynchronised;
+	};
+
+	// Aligns two PC streams in a single pass, reporting every divergent
+	// region rather than stopping at the first difference. After a
+	// divergence, the aligner looks ahead by up to window instructions in
+	// each trace for the nearest anchor: a run of anchor_length PCs which
+	// appears in both traces. The traces are resynchronised at the anchor
+	// which minimises the number of instructions skipped. The look ahead
+	// starts small and doubles up to the window, so a short divergence
+	// only costs a short search.
+	//
+	// If no anchor is found, a window's worth of instructions is skipped in
+	// both traces and the search repeated, so the window should be larger
+	// than the longest expected excursion. The region then ends wherever the
+	// traces next match for at least an anchor's length. Memory use is bounded by the
+	// window size regardless of trace length.
+	class TraceAligner
+	{
+	public:
+		typedef std::function<void(const DivergentRegion &)> reporter_t;
+
+		static const size_t kDefaultWindow = 1 << 16;
+		static const size_t kDefaultAnchorLength = 32;
+
+		TraceAligner(size_t window = kDefaultWindow, size_t anchor_length = kDefaultAnchorLength);
+
+		// Align the streams, which start at instructions start1 and start2.
+		// Returns the number of instructions which matched.
+		uint64_t Align(PCStreamReader &stream1, uint64_t start1, PCStreamReader &stream2, uint64_t start2, const reporter_t &reporter);
+
+	private:
+		class Window {
+		public:
+			Window(PCStreamReader &stream, uint64_t start, size_t capacity);
+
+			// Make sure that at least count PCs are buffered, unless the
+			// stream ends first. Returns the number available.
+			size_t Fill(size_t count);
+			void Consume(size_t count) { head_ += count; base_ += count; }
+
+			const uint64_t *Data() const { return data_.data() + head_; }
+			size_t Available() const { return tail_ - head_; }
+			uint64_t Position() const { return base_; }
+
+		private:
+			PCStreamReader &stream_;
+			std::vector<uint64_t> data_;
+			size_t head_, tail_;
+			uint64_t base_;
+			bool ended_;
+		};
+
+		// Find the anchor minimising i + j, with i and j less than limit.
+		// Returns false if there is none.
+		bool FindAnchor(const Window &w1, const Window &w2, size_t limit, size_t &i, size_t &j);
+
+		size_t window_, anchor_length_;
+		std::vector<uint64_t> anchor_hashes_;
+		std::vector<size_t> anchor_positions_;
+	};
+
+}
+
+#endif
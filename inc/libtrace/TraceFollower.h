@@ -0,0 +1,31 @@
+#ifndef TRACEFOLLOWER_H
+#define TRACEFOLLOWER_H
+
+#include <string>
+
+namespace libtrace {
+
+	// Waits for a trace file which is still being written to grow, like
+	// tail -f. Changes are watched for with inotify, falling back to polling
+	// where that isn't available.
+	class TraceFollower
+	{
+	public:
+		TraceFollower(const std::string &path);
+		~TraceFollower();
+
+		// Wait up to timeout_ms (or forever if negative) for the file to be
+		// written to. Returns true if it may have grown, and false on a
+		// timeout. A timeout of 0 just checks for changes since the last call.
+		bool WaitForGrowth(int timeout_ms);
+
+	private:
+		TraceFollower(const TraceFollower &) = delete;
+		TraceFollower &operator=(const TraceFollower &) = delete;
+
+		int inotify_fd_;
+	};
+
+}
+
+#endif
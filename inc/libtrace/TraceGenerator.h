@@ -0,0 +1,103 @@
+#ifndef TRACEGENERATOR_H
+#define TRACEGENERATOR_H
+
+#include "TraceSource.h"
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+namespace libtrace {
+
+	enum AddressPattern {
+		Address_Stride,		// each instruction walks the working set with a fixed stride
+		Address_Random,		// uniformly random within the working set
+		Address_PointerChase	// a random cycle through the lines of the working set
+	};
+
+	struct TraceGeneratorConfig {
+		uint64_t instructions;
+		uint64_t seed;
+		bool wide;			// 64 bit PCs, register values and addresses
+
+		// the shape of the synthetic program
+		uint32_t blocks;
+		uint32_t block_length;		// mean instructions per basic block
+		double branch_fraction;		// blocks ending in a conditional branch
+		double loop_fraction;		// blocks ending in a loop back edge
+		uint32_t loop_iterations;	// mean iterations of each loop
+
+		// mean operations per instruction
+		double reg_reads, reg_writes;
+		double mem_reads, mem_writes;
+
+		AddressPattern pattern;
+		uint64_t working_set;		// bytes
+		uint32_t stride;
+		uint32_t access_width;
+
+		// the ASID register is written every asid_interval instructions
+		uint64_t asid_interval;		// 0 to never switch
+		uint32_t asids;
+
+		// Parse a pattern name: stride, random or chase
+		static bool ParsePattern(const std::string &name, AddressPattern &pattern);
+	};
+
+	// Generates reproducible synthetic traces. A random program of basic
+	// blocks is built from the seed, and then executed: each static
+	// instruction has a fixed PC, encoding and set of register and memory
+	// operations, and control flow follows loops and biased branches between
+	// the blocks.
+	class TraceGenerator
+	{
+	public:
+		static const uint32_t kASIDRegister = 0xf0;
+
+		TraceGenerator(const TraceGeneratorConfig &config);
+
+		static TraceGeneratorConfig GetDefaultConfig();
+
+		// Trace config.instructions instructions into source, which should
+		// have a sink set
+		void Generate(TraceSource &source);
+
+	private:
+		enum Terminator {
+			Terminator_FallThrough,
+			Terminator_Branch,
+			Terminator_Loop
+		};
+
+		struct StaticInstruction {
+			uint32_t code;
+			uint8_t reg_reads, reg_writes;
+			uint8_t mem_reads, mem_writes;
+			uint8_t first_reg;
+		};
+
+		struct Block {
+			uint32_t first, length;	// indices into instructions_
+			Terminator terminator;
+			uint32_t target;
+			uint32_t taken_probability;	// out of 2^32, for branches
+		};
+
+		template<typename word_t> void Run(TraceSource &source);
+		template<typename word_t> word_t NextAddress(uint32_t insn, uint64_t &state);
+
+		TraceGeneratorConfig config_;
+		std::vector<StaticInstruction> instructions_;
+		std::vector<Block> blocks_;
+
+		// per static instruction position in the working set, for strides
+		std::vector<uint64_t> stride_offsets_;
+
+		// the next line of the pointer chase cycle, for each line
+		std::vector<uint32_t> chase_next_;
+		uint32_t chase_position_;
+	};
+
+}
+
+#endif
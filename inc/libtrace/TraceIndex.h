@@ -0,0 +1,99 @@
+#ifndef TRACEINDEX_H
+#define TRACEINDEX_H
+
+#include "RecordBlockReader.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace libtrace {
+
+	// An index over fixed-size blocks of instructions in a trace. For each
+	// block we store the record index of its first instruction header and a
+	// hash of the PCs of the instructions in the block.
+	//
+	// The PC hashes are polynomial, so the hash of a run of consecutive blocks
+	// can be computed from the per-block hashes. This lets two traces be
+	// compared for divergence by bisection instead of instruction by
+	// instruction.
+	//
+	// Indices can be stored next to the trace (see GetSidecarPath) so that
+	// they only need to be built once.
+	class TraceIndex
+	{
+	public:
+		static const uint64_t kDefaultBlockSize = 1 << 16;
+
+		struct Block {
+			uint64_t record_idx;
+			uint64_t pc_hash;
+		};
+
+		TraceIndex(uint64_t block_size = kDefaultBlockSize);
+
+		// Build the index by scanning the whole trace using the given number
+		// of threads.
+		void Build(const RecordBlockReader &reader, unsigned threads);
+
+		// Load an index previously written with Save. Fails if the index was
+		// built for a different trace, or one which has since been rewritten
+		// (see RecordBlockReader::GetIdentityHash).
+		bool Load(FILE *f, const RecordBlockReader &reader);
+
+		// Save the index of the trace read by reader
+		bool Save(FILE *f, const RecordBlockReader &reader) const;
+
+		static std::string GetSidecarPath(const std::string &trace_path);
+
+		// Load the sidecar index for a trace if there is an up to date one,
+		// otherwise build it and try to write the sidecar.
+		void LoadOrBuild(const std::string &trace_path, const RecordBlockReader &reader, unsigned threads);
+
+		uint64_t GetBlockSize() const { return block_size_; }
+		uint64_t GetRecordCount() const { return record_count_; }
+		uint64_t GetInstructionCount() const { return instruction_count_; }
+
+		size_t GetBlockCount() const { return blocks_.size(); }
+		const Block &GetBlock(size_t i) const { return blocks_.at(i); }
+
+		// Find the record index of the header of instruction insn, scanning
+		// forwards from the start of its block. Returns false if the trace
+		// does not contain that instruction.
+		bool GetInstructionRecord(const RecordBlockReader &reader, uint64_t insn, uint64_t &record_idx) const;
+
+		// Number of instructions in block i (only the last block may be short)
+		uint64_t GetBlockInstructionCount(size_t i) const;
+
+		// Hash of all of the PCs in blocks [first, last)
+		uint64_t GetRangeHash(size_t first, size_t last) const;
+
+		// Hash of the PCs of instructions [first, last), which need not be
+		// on block boundaries. Any partial blocks are hashed from the trace,
+		// so this costs at most two blocks' worth of reading.
+		uint64_t GetInstructionRangeHash(const RecordBlockReader &reader, uint64_t first, uint64_t last) const;
+
+		// Polynomial hash primitives. The hash of a sequence S followed by T
+		// is Append(hash(S), |T|, hash(T)).
+		static uint64_t HashStep(uint64_t hash, uint64_t pc);
+		static uint64_t Append(uint64_t hash, uint64_t count, uint64_t tail_hash);
+
+	private:
+		uint64_t block_size_;
+		uint64_t record_count_;
+		uint64_t instruction_count_;
+		std::vector<Block> blocks_;
+
+		// prefix_[i] is the hash of all of the PCs in blocks [0, i)
+		std::vector<uint64_t> prefix_;
+
+		void BuildPrefixHashes();
+
+		// Hash of the PCs of instructions [0, insn)
+		uint64_t GetPrefixHash(const RecordBlockReader &reader, uint64_t insn) const;
+	};
+
+}
+
+#endif
@@ -0,0 +1,51 @@
+#ifndef TRACEINPUT_H
+#define TRACEINPUT_H
+
+#include "TraceFollower.h"
+
+#include <cstdio>
+#include <functional>
+#include <memory>
+
+namespace libtrace {
+
+	// The trace a command line tool reads with a RecordStream: a file, or
+	// standard input for "-", and optionally followed as it is written
+	// (the -f option).
+	class TraceInput
+	{
+	public:
+		typedef std::function<bool(int opt, const char *arg)> option_handler_t;
+
+		// The line describing -f, for the tool's usage message
+		static const char *kFollowUsage;
+
+		TraceInput();
+		~TraceInput();
+
+		// Parse the command line with getopt, handling -f and passing the
+		// tool's own options (in getopt's format) to handler. Returns false
+		// on an unknown option or if the handler fails.
+		bool ParseOptions(int argc, char **argv, const char *options = "", const option_handler_t &handler = option_handler_t());
+
+		// Open the trace, reporting why on stderr if it cannot be opened or
+		// followed
+		bool Open(const char *path);
+
+		FILE *GetFile() const { return file_; }
+		TraceFollower *GetFollower() const { return follower_.get(); }
+		bool IsFollowing() const { return follow_; }
+		bool IsStdin() const { return file_ == stdin; }
+
+	private:
+		TraceInput(const TraceInput &) = delete;
+		TraceInput &operator=(const TraceInput &) = delete;
+
+		bool follow_;
+		FILE *file_;
+		std::unique_ptr<TraceFollower> follower_;
+	};
+
+}
+
+#endif
@@ -0,0 +1,119 @@
+#ifndef TRACEPIPELINE_H
+#define TRACEPIPELINE_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+#include "TraceSink.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <vector>
+
+namespace libtrace {
+
+	// A batch of records holding only whole instructions, which stages may
+	// edit in place
+	struct RecordBatch {
+		uint64_t first_record;	// index of the first record in the source trace
+		std::vector<Record> records;
+	};
+
+	// A bounded single producer, single consumer queue of batches. Neither
+	// side takes a lock while batches are flowing. A full or empty queue is
+	// waited on by yielding for a while and then blocking, so that a stalled
+	// stage does not keep a core busy.
+	class BatchQueue
+	{
+	public:
+		BatchQueue(size_t capacity);
+
+		void Push(RecordBatch *batch);
+		RecordBatch *Pop();
+
+	private:
+		std::vector<RecordBatch*> slots_;
+
+		// the consumer's and producer's positions, kept on separate cache
+		// lines
+		std::atomic<size_t> head_;
+		char padding_[64 - sizeof(std::atomic<size_t>)];
+		std::atomic<size_t> tail_;
+
+		// Wait until position no longer has the given value
+		void Wait(const std::atomic<size_t> &position, size_t value);
+
+		// Wake the other side if it is blocked
+		void Wake();
+
+		std::mutex lock_;
+		std::condition_variable changed_;
+		std::atomic<unsigned> waiters_;
+	};
+
+	class PipelineStage
+	{
+	public:
+		virtual ~PipelineStage();
+
+		// Transform a batch in place. Records may be removed, but each batch
+		// should still contain only whole instructions.
+		virtual void Process(RecordBatch &batch) = 0;
+
+		// Called once the last batch has been processed
+		virtual void Finish();
+	};
+
+	// Keeps the instructions for which a predicate is true. The predicate is
+	// given the records of each instruction, starting with its header.
+	class InstructionFilterStage : public PipelineStage
+	{
+	public:
+		typedef std::function<bool(const Record *begin, const Record *end)> predicate_t;
+
+		InstructionFilterStage(const predicate_t &predicate);
+
+		void Process(RecordBatch &batch) override;
+
+	private:
+		predicate_t predicate_;
+	};
+
+	// Runs a chain of stages over the records [first, last) of a trace and
+	// passes the results to a TraceSink. The source, each stage and the sink
+	// run on their own threads, and batches are passed between them by
+	// pointer and recycled, so records are never copied between stages.
+	class TracePipeline
+	{
+	public:
+		static const size_t kDefaultBatchRecords = 1 << 16;
+		static const size_t kDefaultQueueDepth = 4;
+
+		TracePipeline(const RecordBlockReader &reader, size_t batch_records = kDefaultBatchRecords, size_t queue_depth = kDefaultQueueDepth);
+
+		// Stages are run in the order they were added, and are not owned by
+		// the pipeline
+		void AddStage(PipelineStage *stage);
+		void SetSink(TraceSink *sink);
+
+		// Run the pipeline to completion. The sink is flushed at the end.
+		void Run(uint64_t first = 0, uint64_t last = ~0ULL);
+
+	private:
+		void RunSource(BatchQueue &free, BatchQueue &out, uint64_t first, uint64_t last);
+		void RunStage(PipelineStage *stage, BatchQueue &in, BatchQueue &out);
+		void RunSink(BatchQueue &in, BatchQueue &free);
+
+		const RecordBlockReader &reader_;
+		size_t batch_records_;
+		size_t queue_depth_;
+
+		std::vector<PipelineStage*> stages_;
+		TraceSink *sink_;
+	};
+
+}
+
+#endif
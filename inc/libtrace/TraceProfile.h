@@ -0,0 +1,62 @@
+#ifndef TRACEPROFILE_H
+#define TRACEPROFILE_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+
+#include <cstdint>
+#include <map>
+#include <unordered_map>
+#include <unordered_set>
+#include <utility>
+#include <vector>
+
+namespace libtrace {
+
+	// Summary statistics for a whole trace, gathered in a single pass.
+	// Every statistic is a function of individual record packets, so the
+	// trace can be split into ranges which are profiled independently (in
+	// parallel) and then merged.
+	struct TraceProfile
+	{
+		static const unsigned kPageBits = 12;
+
+		struct MemStats {
+			uint64_t accesses;
+			uint64_t misaligned;
+		};
+
+		TraceProfile();
+
+		// Profile a trace using the given number of threads
+		void Build(const RecordBlockReader &reader, unsigned threads);
+
+		// Add the records [first, last) of the trace to the profile.
+		// Extension records before first belong to the previous range and
+		// are only counted in the record type mix.
+		void Accumulate(const RecordBlockReader &reader, uint64_t first, uint64_t last);
+		void Merge(const TraceProfile &other);
+
+		typedef std::vector<std::pair<uint64_t, uint64_t>> histogram_t;
+
+		// The n most common keys of a histogram, most common first
+		static histogram_t GetTop(const std::unordered_map<uint64_t, uint64_t> &counts, size_t n);
+
+		uint64_t records;
+		uint64_t instructions;
+		uint64_t record_types[DataExtension + 2];
+
+		std::unordered_map<uint64_t, uint64_t> pcs;
+		std::unordered_map<uint64_t, uint64_t> codes;
+
+		// keyed by access width
+		std::map<uint32_t, MemStats> mem_reads, mem_writes;
+		std::unordered_set<uint64_t> pages;
+
+		// instructions executed in each exception mode
+		std::map<uint32_t, uint64_t> exception_modes;
+	};
+
+}
+
+#endif
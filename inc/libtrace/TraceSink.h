@@ -10,22 +10,27 @@
 
 #include <algorithm>
 #include <cassert>
+#include <condition_variable>
 #include <cstdio>
+#include <deque>
+#include <mutex>
+#include <string>
+#include <thread>
 #include <vector>
 #include <fstream>
 
+#include "ArchInterface.h"
 #include "RecordTypes.h"
 #include "TraceRecordPacket.h"
 #include "TraceRecordStream.h"
 
 namespace libtrace {
 
-class ArchInterface;
-
 	class TraceSink
 	{
 	public:
 		TraceSink();
+		virtual ~TraceSink();
 
 		virtual void SinkPackets(const TraceRecord *start, const TraceRecord *end) = 0;
 		virtual void Flush() = 0;
@@ -45,6 +50,63 @@ class ArchInterface;
 		std::vector<TraceRecord> records_;
 	};
 
+	// Writes records to a file from a background thread, so that tracing
+	// carries on filling one buffer while the previous ones are written.
+	// The buffers are allocated once and aligned for O_DIRECT, and file
+	// space is reserved ahead of the writes with fallocate.
+	class AsyncFileTraceSink : public TraceSink
+	{
+	public:
+		static const size_t kDefaultBufferRecords = 1 << 20;
+		static const size_t kDefaultBufferCount = 2;
+
+		// Write from the current position of outfile, which is closed when
+		// the sink is destroyed
+		AsyncFileTraceSink(FILE *outfile, size_t buffer_records = kDefaultBufferRecords, size_t buffer_count = kDefaultBufferCount);
+
+		// Create the file at path. If direct is set, writes bypass the page
+		// cache where the filesystem supports it.
+		AsyncFileTraceSink(const std::string &path, bool direct, size_t buffer_records = kDefaultBufferRecords, size_t buffer_count = kDefaultBufferCount);
+		~AsyncFileTraceSink();
+
+		void SinkPackets(const TraceRecord* start, const TraceRecord* end) override;
+
+		// Write everything sunk so far and wait for it to reach the file
+		void Flush() override;
+
+	private:
+		struct Buffer {
+			TraceRecord *records;
+			size_t count;
+			uint64_t offset;	// in bytes
+		};
+
+		void Start(size_t buffer_records, size_t buffer_count);
+		void Submit();
+		void WaitIdle();
+		void RunWriter();
+		void WriteBuffer(const Buffer &buffer);
+
+		FILE *file_;		// null if the sink opened the file itself
+		int fd_;
+		int direct_fd_;		// an O_DIRECT descriptor for the same file, or -1
+
+		size_t buffer_records_;
+		std::vector<Buffer> buffers_;
+		Buffer *current_;
+		uint64_t offset_;	// where the current buffer will be written
+
+		// only used by the writer thread
+		uint64_t reserved_;
+		bool reserve_failed_;
+
+		std::thread writer_;
+		std::mutex lock_;
+		std::condition_variable changed_;
+		std::deque<Buffer*> pending_, free_;
+		bool writing_, stopping_;
+	};
+
 	class TextFileTraceSink : public TraceSink
 	{
 	public:
@@ -55,6 +117,7 @@ class ArchInterface;
 		void Flush() override;
 
 	private:
+		void WritePacket(const TraceRecord *start, size_t length);
 		void WritePacket(const TraceRecordPacket &pkt);
 
 		void WriteInstructionHeader(const InstructionHeaderRecord* record);
@@ -69,13 +132,16 @@ class ArchInterface;
 		void WriteMemWriteData(const MemWriteDataRecord* record);
 
 		FILE *outfile_;
-		ArchInterface *interface_;
+
+		// the same few instructions are usually disassembled over and over
+		CachingArchInterface interface_;
 
 		uint32_t isa_mode_;
 		uint32_t pc_;
-		
-		RecordStreamOutputInterface *record_output_stream_;
-		PacketStreamInterface *packet_input_stream_;
+
+		// a record whose extensions have not all been sunk yet, followed by
+		// those which have
+		std::vector<TraceRecord> partial_;
 	};
 }
 
@@ -0,0 +1,48 @@
+#ifndef TRACESLICER_H
+#define TRACESLICER_H
+
+#include "RecordBlockReader.h"
+#include "TraceIndex.h"
+
+#include <cstdint>
+
+namespace libtrace {
+
+	// The records making up a range of instructions, [first_record,
+	// end_record)
+	struct TraceSlice {
+		uint64_t first_record, end_record;
+
+		uint64_t GetRecordCount() const { return end_record - first_record; }
+	};
+
+	// Cuts ranges of instructions out of a trace. The boundaries are found
+	// with the trace's index, and the records themselves are copied by the
+	// kernel where possible, so the cost of a slice is a seek and a copy
+	// rather than a scan. Several slices can be copied at once.
+	class TraceSlicer
+	{
+	public:
+		TraceSlicer(const RecordBlockReader &reader, const TraceIndex &index);
+
+		// Find the records of instructions [first, end). end is clamped to
+		// the end of the trace, and a slice from instruction 0 also takes any
+		// records before the first header. Returns false if the trace does
+		// not contain instruction first.
+		bool Locate(uint64_t first, uint64_t end, TraceSlice &slice) const;
+
+		// Copy a slice to out_fd at out_offset, or to out_fd's file position
+		// (see RecordBlockReader). Return the number of records copied.
+		uint64_t CopyTo(const TraceSlice &slice, int out_fd, uint64_t out_offset) const;
+		uint64_t WriteTo(const TraceSlice &slice, int out_fd) const;
+
+	private:
+		bool GetPacketStart(uint64_t insn, uint64_t &record_idx) const;
+
+		const RecordBlockReader &reader_;
+		const TraceIndex &index_;
+	};
+
+}
+
+#endif
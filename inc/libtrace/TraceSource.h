@@ -2,9 +2,11 @@
 #define TRACESOURCE_H_
 
 #include "RecordTypes.h"
+#include "TraceStatistics.h"
 
 #include <cassert>
 #include <cstdint>
+#include <cstdio>
 #include <string>
 #include <vector>
 
@@ -58,7 +60,7 @@ namespace libtrace {
 		 */
 		inline void Trace_Vector_Bank_Reg_Read(bool Trace, uint8_t Bank, uint8_t Regnum, uint8_t Regindex, uint32_t Value)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
 			// XXX TODO
@@ -66,7 +68,7 @@ namespace libtrace {
 
 		inline void Trace_Vector_Bank_Reg_Write(bool Trace, uint8_t Bank, uint8_t Regnum, uint8_t Regindex, uint32_t Value)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
 			// XXX TODO
@@ -78,7 +80,7 @@ namespace libtrace {
 
 		inline void Trace_Bank_Reg_Read(bool Trace, uint8_t Bank, uint8_t Regnum, uint32_t Value)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
 			BankRegReadRecord *header = (BankRegReadRecord*)(getNextPacket());
@@ -87,7 +89,7 @@ namespace libtrace {
 
 		inline void Trace_Bank_Reg_Write(bool Trace, uint8_t Bank, uint8_t Regnum, uint32_t Value)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
 			BankRegWriteRecord *header = (BankRegWriteRecord*)(getNextPacket());
@@ -110,11 +112,11 @@ namespace libtrace {
 	public:
 		template<typename AddrT, typename DataT> void Trace_Mem_Read(bool Trace, AddrT Addr, DataT Value, uint32_t Width=4)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
-			TraceMemReadAddr(Width, Addr);
-			TraceMemReadData(Width, Value);
+			TraceMemReadAddr(Addr, Width);
+			TraceMemReadData(Value, Width);
 		}
 		
 	private:
@@ -124,11 +126,11 @@ namespace libtrace {
 	public:	
 		template<typename AddrT, typename DataT> void Trace_Mem_Write(bool Trace, AddrT Addr, DataT Value, uint32_t Width=4)
 		{
-			if(!IsPacketOpen()) return;
+			if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 			assert(!IsTerminated() && IsPacketOpen());
 
-			TraceMemWriteAddr(Width, Addr);
-			TraceMemWriteData(Width, Value);
+			TraceMemWriteAddr(Addr, Width);
+			TraceMemWriteData(Value, Width);
 		}
 
 		inline bool IsTerminated() const
@@ -157,6 +159,28 @@ namespace libtrace {
 
 		void Flush();
 
+		// Statistics are always kept on dropped operations and full buffers.
+		// Per type record counts and sink timings are only kept when enabled,
+		// either here or by setting LIBTRACE_STATISTICS in the environment.
+		// They are printed to the statistics file (stderr by default) on
+		// Terminate.
+		void SetStatisticsEnabled(bool b)
+		{
+			statistics_enabled_ = b;
+		}
+		bool GetStatisticsEnabled() const
+		{
+			return statistics_enabled_;
+		}
+		void SetStatisticsFile(FILE *f)
+		{
+			statistics_file_ = f;
+		}
+		const TraceStatistics &GetStatistics() const
+		{
+			return statistics_;
+		}
+
 	protected:
 		uint32_t IO_Packet_Count;
 		uint32_t Tracing_Packet_Count;
@@ -165,7 +189,12 @@ namespace libtrace {
 	private:		
 		TraceRecord *getNextPacket()
 		{
-			if(packet_buffer_pos_ == packet_buffer_end_ || GetAggressiveFlush()) EmitPackets();
+			if(packet_buffer_pos_ == packet_buffer_end_) {
+				statistics_.buffer_full_emits++;
+				EmitPackets();
+			} else if(GetAggressiveFlush()) {
+				EmitPackets();
+			}
 			return packet_buffer_pos_++;
 		}
 
@@ -178,6 +207,10 @@ namespace libtrace {
 		bool is_terminated_;
 		bool aggressive_flushing_;
 
+		bool statistics_enabled_;
+		FILE *statistics_file_;
+		TraceStatistics statistics_;
+
 		TraceSource();
 	};
 	
@@ -217,7 +250,7 @@ namespace libtrace {
 	
 	template <> inline void TraceSource::Trace_Reg_Read(bool Trace, uint8_t Regnum, uint64_t Value)
 	{
-		if(!IsPacketOpen()) return;
+		if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 		assert(!IsTerminated() && IsPacketOpen());
 
 		RegReadRecord *record = (RegReadRecord*)(getNextPacket());
@@ -229,7 +262,7 @@ namespace libtrace {
 	
 	template <> inline void TraceSource::Trace_Reg_Read(bool Trace, uint8_t Regnum, uint32_t Value)
 	{
-		if(!IsPacketOpen()) return;
+		if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 		assert(!IsTerminated() && IsPacketOpen());
 
 		RegReadRecord *header = (RegReadRecord*)(getNextPacket());
@@ -246,7 +279,7 @@ namespace libtrace {
 	
 	template <> inline void TraceSource::Trace_Reg_Write(bool Trace, uint8_t Regnum, uint64_t Value)
 	{
-		if(!IsPacketOpen()) return;
+		if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 		assert(!IsTerminated() && IsPacketOpen());
 
 		RegWriteRecord *record = (RegWriteRecord*)(getNextPacket());
@@ -257,7 +290,7 @@ namespace libtrace {
 	}
 	template <> inline void TraceSource::Trace_Reg_Write(bool Trace, uint8_t Regnum, uint32_t Value)
 	{
-		if(!IsPacketOpen()) return;
+		if(!IsPacketOpen()) { statistics_.dropped_operations++; return; }
 		assert(!IsTerminated() && IsPacketOpen());
 
 		RegWriteRecord *record = (RegWriteRecord*)(getNextPacket());
@@ -275,11 +308,11 @@ namespace libtrace {
 	
 	template<> inline void TraceSource::TraceMemReadAddr(uint32_t Addr, uint32_t Width) {
 		auto *record = (MemReadAddrRecord*)getNextPacket();
-		*record = MemReadAddrRecord(Addr, Width, 0);
+		*record = MemReadAddrRecord(Width, Addr, 0);
 	}
 	template<> inline void TraceSource::TraceMemReadAddr(uint64_t Addr, uint32_t Width) {
 		auto *record = (MemReadAddrRecord*)getNextPacket();
-		*record = MemReadAddrRecord(Addr, Width, 1);
+		*record = MemReadAddrRecord(Width, Addr, 1);
 		
 		auto *extension = (DataExtensionRecord*)getNextPacket();
 		*extension = DataExtensionRecord(MemReadAddr, Addr >> 32);
@@ -287,11 +320,11 @@ namespace libtrace {
 	
 	template<> inline void TraceSource::TraceMemReadData(uint32_t Data, uint32_t Width) {
 		auto *record = (MemReadDataRecord*)getNextPacket();
-		*record = MemReadDataRecord(Data, Width, 0);
+		*record = MemReadDataRecord(Width, Data, 0);
 	}
 	template<> inline void TraceSource::TraceMemReadData(uint64_t Data, uint32_t Width) {
 		auto *record = (MemReadDataRecord*)getNextPacket();
-		*record = MemReadDataRecord(Data, Width, 1);
+		*record = MemReadDataRecord(Width, Data, 1);
 		
 		auto *extension = (DataExtensionRecord*)getNextPacket();
 		*extension = DataExtensionRecord(MemReadData, Data >> 32);		
@@ -299,11 +332,11 @@ namespace libtrace {
 	
 	template<> inline void TraceSource::TraceMemWriteAddr(uint32_t Addr, uint32_t Width) {
 		auto *record = (MemWriteAddrRecord*)getNextPacket();
-		*record = MemWriteAddrRecord(Addr, Width, 0);
+		*record = MemWriteAddrRecord(Width, Addr, 0);
 	}
 	template<> inline void TraceSource::TraceMemWriteAddr(uint64_t Addr, uint32_t Width) {
 		auto *record = (MemWriteAddrRecord*)getNextPacket();
-		*record = MemWriteAddrRecord(Addr, Width, 1);
+		*record = MemWriteAddrRecord(Width, Addr, 1);
 		
 		auto *extension = (DataExtensionRecord*)getNextPacket();
 		*extension = DataExtensionRecord(MemWriteAddr, Addr >> 32);
@@ -311,11 +344,11 @@ namespace libtrace {
 
 	template<> inline void TraceSource::TraceMemWriteData(uint32_t Data, uint32_t Width) {
 		auto *record = (MemWriteDataRecord*)getNextPacket();
-		*record = MemWriteDataRecord(Data, Width, 0);
+		*record = MemWriteDataRecord(Width, Data, 0);
 	}
 	template<> inline void TraceSource::TraceMemWriteData(uint64_t Data, uint32_t Width) {
 		auto *record = (MemWriteDataRecord*)getNextPacket();
-		*record = MemWriteDataRecord(Data, Width, 1);
+		*record = MemWriteDataRecord(Width, Data, 1);
 		
 		auto *extension = (DataExtensionRecord*)getNextPacket();
 		*extension = DataExtensionRecord(MemWriteData, Data >> 32);
@@ -0,0 +1,52 @@
+#ifndef TRACESTATISTICS_H
+#define TRACESTATISTICS_H
+
+#include "RecordTypes.h"
+
+#include <cstdint>
+#include <cstdio>
+
+namespace libtrace {
+
+	// A histogram of durations in power of two nanosecond buckets: bucket k
+	// holds [2^k, 2^(k+1)) ns, and bucket 0 also holds 0.
+	struct LatencyHistogram {
+		static const size_t kBuckets = 40;
+
+		uint64_t count;
+		uint64_t total_ns;
+		uint64_t max_ns;
+		uint64_t buckets[kBuckets];
+
+		void Add(uint64_t ns);
+
+		// The upper bound of the bucket holding the given quantile (0-1)
+		uint64_t GetQuantile(double quantile) const;
+	};
+
+	// Counters kept by a TraceSource about what it traced and how long its
+	// sink took to accept it
+	struct TraceStatistics {
+		// records emitted by type, with the last entry counting invalid types
+		uint64_t records[DataExtension + 2];
+		uint64_t bytes;
+
+		// EmitPackets calls because the packet buffer was full, rather than
+		// for aggressive flushing or an explicit flush
+		uint64_t buffer_full_emits;
+
+		// tracing calls made outside of an instruction, and records emitted
+		// without a sink, which are thrown away
+		uint64_t dropped_operations;
+		uint64_t dropped_records;
+
+		LatencyHistogram emit;		// whole EmitPackets calls
+		LatencyHistogram sink;		// TraceSink::SinkPackets
+		LatencyHistogram flush;		// TraceSink::Flush
+
+		void Print(FILE *f) const;
+	};
+
+}
+
+#endif
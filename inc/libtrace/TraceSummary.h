@@ -0,0 +1,170 @@
+#ifndef TRACESUMMARY_H
+#define TRACESUMMARY_H
+
+#include "RecordBlockReader.h"
+#include "RecordTypes.h"
+#include "TraceSink.h"
+
+#include <cstdint>
+#include <cstdio>
+#include <string>
+#include <vector>
+
+namespace libtrace {
+
+	// Summaries of fixed-size chunks of records, which let scans skip whole
+	// chunks that cannot contain what they are looking for. Each chunk has
+	// the range of PCs and memory addresses it contains, the set of record
+	// types and ASIDs seen in it, and Bloom filters over its PCs and the
+	// cache lines it accesses.
+	//
+	// Every query answers "may contain": false means the chunk definitely
+	// has no match, true means it has to be scanned.
+	//
+	// Summaries are stored next to the trace (see GetSidecarPath). They can
+	// be built from an existing trace, or while it is being written with a
+	// SummaryTraceSink.
+	class TraceSummary
+	{
+	public:
+		static const uint64_t kDefaultChunkRecords = 1 << 16;
+		static const uint32_t kDefaultASIDRegister = 0xf0;
+		static const size_t kBloomWords = 256;
+		static const uint32_t kLineBits = 6;
+
+		struct Chunk {
+			uint64_t instructions;		// headers in the chunk
+			uint64_t last_pc;		// PC of the last of them
+			uint64_t min_pc, max_pc;
+			uint64_t min_address, max_address;
+			uint64_t asids;			// bit (asid % 64) of each ASID active in the chunk
+			uint64_t last_asid;		// the ASID at the end of the chunk, if wrote_asid
+			uint32_t types;			// bit (1 << type) of each record type
+			uint32_t wrote_asid;
+
+			// keyed on the low 32 bits of each PC, and of each address
+			// shifted down to a line, so that searches over record data can
+			// use them too
+			uint64_t pc_bloom[kBloomWords];
+			uint64_t line_bloom[kBloomWords];
+		};
+
+		TraceSummary(uint64_t chunk_records = kDefaultChunkRecords, uint32_t asid_register = kDefaultASIDRegister);
+
+		// Build the summary by scanning the whole trace using the given
+		// number of threads.
+		void Build(const RecordBlockReader &reader, unsigned threads);
+
+		// Summarise records as they are appended to the end of the trace.
+		// Records should be given a whole number of instructions at a time.
+		void Append(const Record *records, size_t count);
+
+		// Load a summary previously written with Save. Fails if it was built
+		// with different parameters or for a different trace, including one
+		// which has since been rewritten (see
+		// RecordBlockReader::GetIdentityHash).
+		bool Load(FILE *f, const RecordBlockReader &reader);
+
+		// Save the summary of the trace read by reader, which must hold
+		// exactly the records summarised
+		bool Save(FILE *f, const RecordBlockReader &reader) const;
+
+		static std::string GetSidecarPath(const std::string &trace_path);
+
+		// Load the sidecar summary for a trace if there is an up to date one.
+		// Does not build a missing summary.
+		bool LoadSidecar(const std::string &trace_path, const RecordBlockReader &reader);
+		bool SaveSidecar(const std::string &trace_path, const RecordBlockReader &reader) const;
+
+		// Save the sidecar, reading the trace from trace_path
+		bool SaveSidecar(const std::string &trace_path) const;
+
+		// Load the sidecar summary for a trace if there is an up to date one,
+		// otherwise build it and try to write the sidecar.
+		void LoadOrBuild(const std::string &trace_path, const RecordBlockReader &reader, unsigned threads);
+
+		uint64_t GetChunkRecords() const { return chunk_records_; }
+		uint64_t GetRecordCount() const { return record_count_; }
+		size_t GetChunkCount() const { return chunks_.size(); }
+		const Chunk &GetChunk(size_t i) const { return chunks_.at(i); }
+
+		// The chunk holding record record_idx
+		size_t GetChunkIndex(uint64_t record_idx) const { return record_idx / chunk_records_; }
+
+		bool MayContainType(size_t chunk, TraceRecordType type) const;
+		bool MayContainPC(size_t chunk, uint64_t pc) const;
+
+		// Whether the chunk may contain an access starting in the same line
+		// as address
+		bool MayContainAddress(size_t chunk, uint64_t address) const;
+		bool MayContainASID(size_t chunk, uint64_t asid) const;
+
+		// Whether the chunk may contain a record whose type is in the bitmap
+		// types and whose data satisfies (data & mask) == value, as searched
+		// for by RecordSearch
+		bool MayMatch(size_t chunk, uint32_t value, uint32_t mask, uint32_t types) const;
+
+	private:
+		// The state of a scan over a contiguous run of records. Values with
+		// an extension are held until the extension record is seen.
+		struct ScanState {
+			uint64_t position;
+			bool asid_known;
+			uint64_t asid;
+
+			TraceRecordType pending_type;
+			uint64_t pending_chunk, pending_value;
+		};
+
+		ScanState StartScan(uint64_t position, bool asid_known, uint64_t asid) const;
+		void Scan(ScanState &state, const Record *records, size_t count);
+
+		// Complete any value still waiting for its extension. next is the
+		// record after the run, if there is one.
+		void FinishScan(ScanState &state, const Record *next);
+
+		void Apply(ScanState &state, TraceRecordType type, uint64_t chunk, uint64_t value);
+
+		// Whether a query about the chunk can be answered from its summary.
+		// A partial last chunk is never trusted as the trace may have grown
+		// since it was summarised.
+		bool IsComplete(size_t chunk) const;
+
+		Chunk &GetChunkForUpdate(uint64_t chunk);
+
+		// Fill in the ASID active at the start of each chunk, and set up
+		// Append to continue from the end of the trace
+		void ResolveASIDs();
+
+		uint64_t chunk_records_;
+		uint32_t asid_register_;
+		uint64_t record_count_;
+		std::vector<Chunk> chunks_;
+
+		ScanState append_state_;
+	};
+
+	// Passes records on to another sink, summarising them on the way.
+	// The summary is written to the trace's sidecar on every Flush. A sink
+	// which modifies the file after its last Flush (as AsyncFileTraceSink
+	// does when it is closed) makes the sidecar stale, so it should be
+	// saved again once the file is closed.
+	class SummaryTraceSink : public TraceSink
+	{
+	public:
+		SummaryTraceSink(TraceSink *sink, const std::string &trace_path, uint64_t chunk_records = TraceSummary::kDefaultChunkRecords);
+
+		void SinkPackets(const TraceRecord *start, const TraceRecord *end) override;
+		void Flush() override;
+
+		const TraceSummary &GetSummary() const { return summary_; }
+
+	private:
+		TraceSink *sink_;
+		std::string trace_path_;
+		TraceSummary summary_;
+	};
+
+}
+
+#endif
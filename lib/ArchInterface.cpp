@@ -2,11 +2,27 @@
 
 using namespace libtrace;
 
+namespace {
+	// entries are placed in the first free slot of a short run, so that a
+	// miss never has to look far
+	const size_t kMaxProbes = 8;
+
+	uint64_t GetFirstSlot(uint32_t kind, uint64_t key)
+	{
+		return ((key ^ ((uint64_t)kind << 61)) * 0x9e3779b97f4a7c15ULL) >> 32;
+	}
+}
+
 ArchInterface::~ArchInterface()
 {
 
 }
 
+std::string ArchInterface::DisassembleInstruction(uint32_t isa_mode, const InstructionCodeRecord &record)
+{
+	return DisassembleInstruction(record);
+}
+
 DefaultArchInterface::~DefaultArchInterface()
 {
 }
@@ -29,4 +45,99 @@ uint32_t DefaultArchInterface::GetRegisterSlotWidth(int idx) {
 uint32_t DefaultArchInterface::GetRegisterBankWidth(int idx) {
 	return 0;
 }
-	
\ No newline at end of file
+
+CachingArchInterface::CachingArchInterface(ArchInterface* arch, size_t capacity) : arch_(arch)
+{
+	uint64_t slots = kMaxProbes;
+	while(slots < capacity) slots <<= 1;
+	mask_ = slots - 1;
+
+	table_ = new std::atomic<Entry*>[slots];
+	for(uint64_t i = 0; i < slots; ++i) table_[i].store(nullptr, std::memory_order_relaxed);
+}
+
+CachingArchInterface::~CachingArchInterface()
+{
+	for(uint64_t i = 0; i <= mask_; ++i) delete table_[i].load(std::memory_order_relaxed);
+	delete [] table_;
+}
+
+const CachingArchInterface::Entry* CachingArchInterface::Find(EntryKind kind, uint64_t key) const
+{
+	uint64_t slot = GetFirstSlot(kind, key);
+	for(size_t i = 0; i < kMaxProbes; ++i) {
+		const Entry *entry = table_[(slot + i) & mask_].load(std::memory_order_acquire);
+		if(!entry) return nullptr;
+		if(entry->kind == kind && entry->key == key) return entry;
+	}
+	return nullptr;
+}
+
+void CachingArchInterface::Insert(EntryKind kind, uint64_t key, const std::string& text, uint32_t width)
+{
+	Entry *entry = new Entry {kind, key, text, width};
+
+	uint64_t slot = GetFirstSlot(kind, key);
+	for(size_t i = 0; i < kMaxProbes; ++i) {
+		Entry *existing = nullptr;
+		if(table_[(slot + i) & mask_].compare_exchange_strong(existing, entry, std::memory_order_acq_rel)) return;
+
+		// another thread got there first
+		if(existing->kind == kind && existing->key == key) break;
+	}
+	delete entry;
+}
+
+std::string CachingArchInterface::DisassembleInstruction(const InstructionCodeRecord& record)
+{
+	return DisassembleInstruction(0, record);
+}
+
+std::string CachingArchInterface::DisassembleInstruction(uint32_t isa_mode, const InstructionCodeRecord& record)
+{
+	uint64_t key = ((uint64_t)isa_mode << 32) | record.GetIR();
+	const Entry *entry = Find(Entry_Disassembly, key);
+	if(entry) return entry->text;
+
+	std::string text = arch_->DisassembleInstruction(isa_mode, record);
+	Insert(Entry_Disassembly, key, text, 0);
+	return text;
+}
+
+const CachingArchInterface::Entry* CachingArchInterface::GetRegister(EntryKind kind, int index, Entry& uncached)
+{
+	const Entry *entry = Find(kind, (uint32_t)index);
+	if(entry) return entry;
+
+	// the name and width are looked up together, as they are usually
+	// wanted together
+	bool slot = kind == Entry_RegisterSlot;
+	uncached.text = slot ? arch_->GetRegisterSlotName(index) : arch_->GetRegisterBankName(index);
+	uncached.width = slot ? arch_->GetRegisterSlotWidth(index) : arch_->GetRegisterBankWidth(index);
+	Insert(kind, (uint32_t)index, uncached.text, uncached.width);
+	return &uncached;
+}
+
+std::string CachingArchInterface::GetRegisterSlotName(int index)
+{
+	Entry uncached;
+	return GetRegister(Entry_RegisterSlot, index, uncached)->text;
+}
+
+std::string CachingArchInterface::GetRegisterBankName(int index)
+{
+	Entry uncached;
+	return GetRegister(Entry_RegisterBank, index, uncached)->text;
+}
+
+uint32_t CachingArchInterface::GetRegisterSlotWidth(int index)
+{
+	Entry uncached;
+	return GetRegister(Entry_RegisterSlot, index, uncached)->width;
+}
+
+uint32_t CachingArchInterface::GetRegisterBankWidth(int index)
+{
+	Entry uncached;
+	return GetRegister(Entry_RegisterBank, index, uncached)->width;
+}
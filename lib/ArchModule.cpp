@@ -0,0 +1,56 @@
+#include "libtrace/ArchModule.h"
+
+#include <dlfcn.h>
+
+using namespace libtrace;
+
+namespace {
+	typedef ArchInterface *(*ArchModuleFactory)();
+
+	const char *kFactoryName = "libtrace_create_arch_interface";
+}
+
+ArchModule::ArchModule() : handle_(nullptr), interface_(nullptr)
+{
+
+}
+
+ArchModule::~ArchModule()
+{
+	Unload();
+}
+
+bool ArchModule::Load(const std::string& path)
+{
+	Unload();
+
+	// a bare name would be searched for on the library path rather than
+	// in the current directory
+	std::string name = path.find('/') == std::string::npos ? "./" + path : path;
+	handle_ = dlopen(name.c_str(), RTLD_NOW | RTLD_LOCAL);
+	if(!handle_) {
+		error_ = dlerror();
+		return false;
+	}
+
+	ArchModuleFactory factory = (ArchModuleFactory)dlsym(handle_, kFactoryName);
+	interface_ = factory ? factory() : nullptr;
+	if(!interface_) {
+		error_ = path + ": no architecture interface defined";
+		Unload();
+		return false;
+	}
+
+	error_.clear();
+	return true;
+}
+
+void ArchModule::Unload()
+{
+	// the interface's code is in the module
+	delete interface_;
+	interface_ = nullptr;
+
+	if(handle_) dlclose(handle_);
+	handle_ = nullptr;
+}
@@ -0,0 +1,307 @@
+#include "libtrace/CacheSimulator.h"
+#include "libtrace/InstructionState.h"
+
+#include <cassert>
+#include <cstdlib>
+#include <sstream>
+
+using namespace libtrace;
+
+namespace {
+	const uint64_t kInvalidTag = ~0ULL;
+	const uint8_t kDirty = 0x80;
+	const uint8_t kReplacementMask = 0x7f;
+	const uint8_t kMaxRRPV = 3;
+
+	bool IsPowerOfTwo(uint64_t value)
+	{
+		return value && !(value & (value - 1));
+	}
+
+	uint32_t Log2(uint64_t value)
+	{
+		uint32_t bits = 0;
+		while((1ULL << bits) < value) bits++;
+		return bits;
+	}
+}
+
+bool CacheConfig::Parse(const std::string& spec, std::string& error)
+{
+	*this = CacheConfig {0, 1, 64, Replacement_LRU, true, true};
+	if(spec == "none") return true;
+
+	std::vector<std::string> fields;
+	std::istringstream stream (spec);
+	std::string field;
+	while(std::getline(stream, field, ':')) fields.push_back(field);
+
+	if(fields.size() < 3) {
+		error = "Expected '<size>:<ways>:<line size>[:<policy>][:<wb|wt>][:<wa|nwa>]': " + spec;
+		return false;
+	}
+
+	char *end;
+	size = strtoull(fields[0].c_str(), &end, 0);
+	if(*end == 'k' || *end == 'K') size <<= 10;
+	else if(*end == 'm' || *end == 'M') size <<= 20;
+	associativity = strtoul(fields[1].c_str(), NULL, 0);
+	line_size = strtoul(fields[2].c_str(), NULL, 0);
+
+	for(size_t i = 3; i < fields.size(); ++i) {
+		if(fields[i] == "lru") policy = Replacement_LRU;
+		else if(fields[i] == "plru") policy = Replacement_PLRU;
+		else if(fields[i] == "rrip") policy = Replacement_RRIP;
+		else if(fields[i] == "wb") write_back = true;
+		else if(fields[i] == "wt") write_back = false;
+		else if(fields[i] == "wa") write_allocate = true;
+		else if(fields[i] == "nwa") write_allocate = false;
+		else {
+			error = "Unknown cache option: " + fields[i];
+			return false;
+		}
+	}
+
+	if(!IsPowerOfTwo(line_size) || associativity == 0 || associativity > 64 || size % ((uint64_t)associativity * line_size) || !IsPowerOfTwo(size / ((uint64_t)associativity * line_size))) {
+		error = "Cache geometry must have a power of two line size and number of sets, and at most 64 ways: " + spec;
+		return false;
+	}
+	if(policy == Replacement_PLRU && !IsPowerOfTwo(associativity)) {
+		error = "Tree PLRU needs a power of two associativity: " + spec;
+		return false;
+	}
+	return true;
+}
+
+Cache::Cache(const CacheConfig& config) : config_(config), stats_ {0, 0, 0, 0, 0}, line_bits_(0), set_mask_(0)
+{
+	if(!config_.size) return;
+
+	uint64_t sets = config_.size / ((uint64_t)config_.associativity * config_.line_size);
+	assert(IsPowerOfTwo(sets) && IsPowerOfTwo(config_.line_size));
+
+	line_bits_ = Log2(config_.line_size);
+	set_mask_ = sets - 1;
+
+	tags_.assign(sets * config_.associativity, kInvalidTag);
+	state_.assign(sets * config_.associativity, 0);
+	plru_.assign(sets, 0);
+
+	// LRU ages are a permutation of the ways in each set
+	if(config_.policy == Replacement_LRU) {
+		for(uint64_t i = 0; i < state_.size(); ++i) state_[i] = i % config_.associativity;
+	}
+}
+
+Cache::Result Cache::Access(uint64_t address, bool write)
+{
+	const uint32_t ways = config_.associativity;
+	uint64_t line = address >> line_bits_;
+	uint64_t set = line & set_mask_;
+	uint64_t *tags = tags_.data() + set * ways;
+	uint8_t *state = state_.data() + set * ways;
+
+	if(write) stats_.writes++;
+	else stats_.reads++;
+
+	for(uint32_t way = 0; way < ways; ++way) {
+		if(tags[way] != line) continue;
+
+		Touch(set, way, false);
+		if(write && config_.write_back) state[way] |= kDirty;
+		return Result {true, false, 0};
+	}
+
+	if(write) stats_.write_misses++;
+	else stats_.read_misses++;
+
+	Result result {false, false, 0};
+	if(write && !config_.write_allocate) return result;
+
+	uint32_t victim = ChooseVictim(set);
+	if(tags[victim] != kInvalidTag && (state[victim] & kDirty)) {
+		result.writeback = true;
+		result.writeback_address = tags[victim] << line_bits_;
+		stats_.writebacks++;
+	}
+
+	tags[victim] = line;
+	state[victim] &= kReplacementMask;
+	Touch(set, victim, true);
+	if(write && config_.write_back) state[victim] |= kDirty;
+
+	return result;
+}
+
+void Cache::Touch(uint64_t set, uint32_t way, bool fill)
+{
+	const uint32_t ways = config_.associativity;
+	uint8_t *state = state_.data() + set * ways;
+
+	switch(config_.policy) {
+		case Replacement_LRU: {
+			// age every line which was more recently used than this one
+			uint8_t age = state[way] & kReplacementMask;
+			for(uint32_t i = 0; i < ways; ++i) {
+				if((state[i] & kReplacementMask) < age) state[i]++;
+			}
+			state[way] &= kDirty;
+			break;
+		}
+		case Replacement_PLRU: {
+			// point every node on the path to this way away from it
+			uint64_t &tree = plru_[set];
+			uint64_t node = 1;
+			for(uint32_t bit = ways >> 1; bit; bit >>= 1) {
+				bool right = way & bit;
+				if(right) tree &= ~(1ULL << node);
+				else tree |= 1ULL << node;
+				node = node * 2 + right;
+			}
+			break;
+		}
+		case Replacement_RRIP:
+			state[way] = (state[way] & kDirty) | (fill ? kMaxRRPV - 1 : 0);
+			break;
+	}
+}
+
+uint32_t Cache::ChooseVictim(uint64_t set)
+{
+	const uint32_t ways = config_.associativity;
+	const uint64_t *tags = tags_.data() + set * ways;
+	uint8_t *state = state_.data() + set * ways;
+
+	for(uint32_t way = 0; way < ways; ++way) {
+		if(tags[way] == kInvalidTag) return way;
+	}
+
+	switch(config_.policy) {
+		case Replacement_LRU:
+			for(uint32_t way = 0; way < ways; ++way) {
+				if((state[way] & kReplacementMask) == ways - 1) return way;
+			}
+			break;
+
+		case Replacement_PLRU: {
+			uint64_t tree = plru_[set];
+			uint64_t node = 1;
+			uint32_t way = 0;
+			for(uint32_t bit = ways >> 1; bit; bit >>= 1) {
+				bool right = (tree >> node) & 1;
+				way = way * 2 + right;
+				node = node * 2 + right;
+			}
+			return way;
+		}
+
+		case Replacement_RRIP:
+			// evict the first line predicted to be re-referenced furthest in
+			// the future, ageing the whole set until there is one
+			while(true) {
+				for(uint32_t way = 0; way < ways; ++way) {
+					if((state[way] & kReplacementMask) == kMaxRRPV) return way;
+				}
+				for(uint32_t way = 0; way < ways; ++way) state[way]++;
+			}
+	}
+
+	assert(false && "No victim found");
+	return 0;
+}
+
+CacheHierarchy::CacheHierarchy(const CacheConfig (&configs)[Level_Count]) : instructions_(0), memory_reads_(0), memory_writes_(0)
+{
+	for(int i = 0; i < Level_Count; ++i) caches_.push_back(Cache(configs[i]));
+
+	// each level is backed by the next one which is present, and finally
+	// by memory (-1)
+	next_level_[Level_L3] = -1;
+	next_level_[Level_L2] = HasLevel(Level_L3) ? Level_L3 : -1;
+	next_level_[Level_L1I] = next_level_[Level_L1D] = HasLevel(Level_L2) ? Level_L2 : next_level_[Level_L2];
+}
+
+const char* CacheHierarchy::GetLevelName(Level level)
+{
+	switch(level) {
+		case Level_L1I: return "l1i";
+		case Level_L1D: return "l1d";
+		case Level_L2: return "l2";
+		case Level_L3: return "l3";
+		default: return "unknown";
+	}
+}
+
+void CacheHierarchy::Fetch(uint64_t pc)
+{
+	instructions_++;
+	Access(HasLevel(Level_L1I) ? Level_L1I : next_level_[Level_L1I], pc, pc, 1, false);
+}
+
+void CacheHierarchy::Read(uint64_t pc, uint64_t address, uint32_t width)
+{
+	Access(HasLevel(Level_L1D) ? Level_L1D : next_level_[Level_L1D], pc, address, width, false);
+}
+
+void CacheHierarchy::Write(uint64_t pc, uint64_t address, uint32_t width)
+{
+	Access(HasLevel(Level_L1D) ? Level_L1D : next_level_[Level_L1D], pc, address, width, true);
+}
+
+void CacheHierarchy::Access(int level, uint64_t pc, uint64_t address, uint32_t width, bool write)
+{
+	if(level < 0) {
+		AccessLine(level, pc, address, write);
+		return;
+	}
+
+	// split accesses which cross lines
+	uint64_t line_size = caches_[level].GetConfig().line_size;
+	uint64_t first = address & ~(line_size - 1);
+	uint64_t last = (address + (width ? width - 1 : 0)) & ~(line_size - 1);
+	for(uint64_t line = first; ; line += line_size) {
+		AccessLine(level, pc, line, write);
+		if(line == last) break;
+	}
+}
+
+void CacheHierarchy::AccessLine(int level, uint64_t pc, uint64_t address, bool write)
+{
+	if(level < 0) {
+		if(write) memory_writes_++;
+		else memory_reads_++;
+		return;
+	}
+
+	Cache &cache = caches_[level];
+	const CacheConfig &config = cache.GetConfig();
+	Cache::Result result = cache.Access(address, write);
+	int next = next_level_[level];
+
+	if(!result.hit) {
+		pc_misses_[pc].misses[level]++;
+
+		// fill the line from the next level, unless this is a write which
+		// doesn't allocate
+		if(!write || config.write_allocate) Access(next, pc, address, config.line_size, false);
+	}
+
+	// write through caches pass every write on, as do write misses which
+	// don't allocate
+	if(write && (!config.write_back || (!result.hit && !config.write_allocate))) Access(next, pc, address, config.line_size, true);
+
+	if(result.writeback) Access(next, pc, result.writeback_address, config.line_size, true);
+}
+
+void CacheHierarchy::Run(const RecordBlockReader& reader)
+{
+	InstructionStateReader states (reader, 0, 0);
+
+	while(const InstructionStateBatch *batch = states.Next()) {
+		for(auto &insn : batch->instructions) {
+			Fetch(insn.pc);
+			for(auto access = batch->MemReadsBegin(insn); access != batch->MemReadsEnd(insn); ++access) Read(insn.pc, access->address, access->width);
+			for(auto access = batch->MemWritesBegin(insn); access != batch->MemWritesEnd(insn); ++access) Write(insn.pc, access->address, access->width);
+		}
+	}
+}
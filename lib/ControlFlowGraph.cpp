@@ -0,0 +1,252 @@
+#include "libtrace/ControlFlowGraph.h"
+#include "libtrace/RecordTypes.h"
+
+#include <algorithm>
+#include <cassert>
+#include <thread>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kScanRecords = 1 << 16;
+	const uint64_t kGraphMagic = 0x3130474643544c00ULL;
+
+	struct GraphHeader {
+		uint64_t magic;
+		uint64_t max_instruction_size;
+		uint64_t instructions;
+		uint64_t block_count;
+		uint64_t edge_count;
+	};
+}
+
+ControlFlowGraph::ControlFlowGraph(uint64_t max_instruction_size) : max_instruction_size_(max_instruction_size), instructions_(0), first_pc_(0), first_run_end_(0), run_start_(0), prev_pc_(0), first_run_closed_(false)
+{
+
+}
+
+void ControlFlowGraph::Build(const RecordBlockReader& reader, unsigned threads)
+{
+	uint64_t record_count = reader.Size();
+	if(threads == 0) threads = 1;
+
+	// Each range is processed independently and the graphs joined up in
+	// order afterwards
+	uint64_t chunks = std::max<uint64_t>(1, std::min<uint64_t>(threads, record_count / kScanRecords));
+	std::vector<ControlFlowGraph> graphs (chunks, ControlFlowGraph(max_instruction_size_));
+
+	std::vector<std::thread> workers;
+	for(uint64_t i = 1; i < chunks; ++i) {
+		workers.push_back(std::thread([&, i]() {
+			graphs[i].Accumulate(reader, (record_count * i) / chunks, (record_count * (i+1)) / chunks);
+		}));
+	}
+	Accumulate(reader, 0, record_count / chunks);
+	for(auto &i : workers) i.join();
+
+	for(uint64_t i = 1; i < chunks; ++i) Merge(graphs[i]);
+	Finish();
+}
+
+void ControlFlowGraph::Accumulate(const RecordBlockReader& reader, uint64_t first, uint64_t last)
+{
+	std::vector<Record> buffer (kScanRecords + 1);
+
+	for(uint64_t pos = first; pos < last; pos += kScanRecords) {
+		// read one record past the range so that a trailing header's
+		// extension is available
+		size_t want = std::min<uint64_t>(kScanRecords, last - pos);
+		size_t read = reader.Read(pos, buffer.data(), want + 1);
+		if(read < want) want = read;
+
+		for(size_t i = 0; i < want; ++i) {
+			const TraceRecord &tr = (const TraceRecord&)buffer[i];
+			if(tr.GetType() != InstructionHeader) continue;
+
+			uint64_t pc = tr.GetData32();
+			if(tr.GetExtensionCount() && i + 1 < read) pc |= (uint64_t)buffer[i+1].GetData() << 32;
+			AddPC(pc);
+		}
+	}
+}
+
+void ControlFlowGraph::AddPC(uint64_t pc)
+{
+	pcs_.insert(pc);
+
+	if(instructions_ == 0) {
+		first_pc_ = run_start_ = pc;
+	} else if(!IsSequential(prev_pc_, pc)) {
+		runs_[PCPair {run_start_, prev_pc_}]++;
+		jumps_[PCPair {prev_pc_, pc}]++;
+
+		if(!first_run_closed_) {
+			first_run_closed_ = true;
+			first_run_end_ = prev_pc_;
+		}
+		run_start_ = pc;
+	}
+
+	prev_pc_ = pc;
+	instructions_++;
+}
+
+void ControlFlowGraph::Merge(const ControlFlowGraph& next)
+{
+	if(next.instructions_ == 0) return;
+	if(instructions_ == 0) {
+		*this = next;
+		return;
+	}
+
+	for(auto &i : next.runs_) runs_[i.first] += i.second;
+	for(auto &i : next.jumps_) jumps_[i.first] += i.second;
+	pcs_.insert(next.pcs_.begin(), next.pcs_.end());
+
+	if(IsSequential(prev_pc_, next.first_pc_)) {
+		// our last run carries on into the next graph's first run. If that
+		// run was closed, it actually started in this graph.
+		if(next.first_run_closed_) {
+			PCPair partial {next.first_pc_, next.first_run_end_};
+			if(--runs_[partial] == 0) runs_.erase(partial);
+			runs_[PCPair {run_start_, next.first_run_end_}]++;
+
+			if(!first_run_closed_) {
+				first_run_closed_ = true;
+				first_run_end_ = next.first_run_end_;
+			}
+			run_start_ = next.run_start_;
+		}
+	} else {
+		runs_[PCPair {run_start_, prev_pc_}]++;
+		jumps_[PCPair {prev_pc_, next.first_pc_}]++;
+
+		if(!first_run_closed_) {
+			first_run_closed_ = true;
+			first_run_end_ = prev_pc_;
+		}
+		run_start_ = next.run_start_;
+	}
+
+	prev_pc_ = next.prev_pc_;
+	instructions_ += next.instructions_;
+}
+
+void ControlFlowGraph::Finish()
+{
+	if(instructions_) runs_[PCPair {run_start_, prev_pc_}]++;
+
+	std::vector<uint64_t> pcs (pcs_.begin(), pcs_.end());
+	std::sort(pcs.begin(), pcs.end());
+
+	// A block starts at the start of every run (any jump target), and after
+	// the end of every run (any jump source)
+	std::vector<uint64_t> starts;
+	starts.reserve(runs_.size() * 2);
+	for(auto &i : runs_) {
+		starts.push_back(i.first.first);
+		auto next = std::upper_bound(pcs.begin(), pcs.end(), i.first.second);
+		if(next != pcs.end()) starts.push_back(*next);
+	}
+	std::sort(starts.begin(), starts.end());
+	starts.erase(std::unique(starts.begin(), starts.end()), starts.end());
+
+	// split each run into blocks, with a fall through edge between each
+	std::unordered_map<uint64_t, BasicBlock> blocks;
+	std::unordered_map<uint64_t, uint64_t> block_ends;
+	pair_counts_t edges;
+	blocks.reserve(starts.size());
+	block_ends.reserve(starts.size());
+
+	for(auto &i : runs_) {
+		uint64_t start = i.first.first, end = i.first.second, count = i.second;
+		auto pc = std::lower_bound(pcs.begin(), pcs.end(), start);
+		auto boundary = std::upper_bound(starts.begin(), starts.end(), start);
+
+		while(true) {
+			bool split = boundary != starts.end() && *boundary <= end;
+			auto stop = split ? std::lower_bound(pc, pcs.end(), *boundary) : std::upper_bound(pc, pcs.end(), end);
+			assert(stop > pc);
+
+			BasicBlock &block = blocks[start];
+			block.start = start;
+			block.end = *(stop - 1);
+			block.instructions = stop - pc;
+			block.executions += count;
+			block_ends[block.end] = start;
+
+			if(!split) break;
+			edges[PCPair {start, *boundary}] += count;
+			start = *boundary++;
+			pc = stop;
+		}
+	}
+
+	// and then the edges for each jump
+	for(auto &i : jumps_) {
+		auto from = block_ends.find(i.first.first);
+		assert(from != block_ends.end());
+		edges[PCPair {from->second, i.first.second}] += i.second;
+	}
+
+	blocks_.clear();
+	blocks_.reserve(blocks.size());
+	for(auto &i : blocks) blocks_.push_back(i.second);
+	std::sort(blocks_.begin(), blocks_.end(), [](const BasicBlock &a, const BasicBlock &b) { return a.start < b.start; });
+
+	edges_.clear();
+	edges_.reserve(edges.size());
+	for(auto &i : edges) edges_.push_back(Edge {i.first.first, i.first.second, i.second});
+	std::sort(edges_.begin(), edges_.end(), [](const Edge &a, const Edge &b) { return a.from != b.from ? a.from < b.from : a.to < b.to; });
+
+	// the runs are no longer needed
+	pair_counts_t().swap(runs_);
+	pair_counts_t().swap(jumps_);
+	std::unordered_set<uint64_t>().swap(pcs_);
+}
+
+bool ControlFlowGraph::Save(FILE* f) const
+{
+	GraphHeader header { kGraphMagic, max_instruction_size_, instructions_, blocks_.size(), edges_.size() };
+	if(fwrite(&header, sizeof(header), 1, f) != 1) return false;
+	if(fwrite(blocks_.data(), sizeof(BasicBlock), blocks_.size(), f) != blocks_.size()) return false;
+	return fwrite(edges_.data(), sizeof(Edge), edges_.size(), f) == edges_.size();
+}
+
+bool ControlFlowGraph::Load(FILE* f)
+{
+	GraphHeader header;
+	if(fread(&header, sizeof(header), 1, f) != 1) return false;
+	if(header.magic != kGraphMagic) return false;
+
+	std::vector<BasicBlock> blocks (header.block_count);
+	std::vector<Edge> edges (header.edge_count);
+	if(fread(blocks.data(), sizeof(BasicBlock), blocks.size(), f) != blocks.size()) return false;
+	if(fread(edges.data(), sizeof(Edge), edges.size(), f) != edges.size()) return false;
+
+	max_instruction_size_ = header.max_instruction_size;
+	instructions_ = header.instructions;
+	blocks_.swap(blocks);
+	edges_.swap(edges);
+	return true;
+}
+
+void ControlFlowGraph::WriteDot(FILE* f, uint64_t low, uint64_t high) const
+{
+	auto in_range = [low, high](uint64_t pc) { return pc >= low && pc < high; };
+
+	fprintf(f, "digraph cfg {\n");
+	fprintf(f, "\tnode [shape=box fontname=monospace];\n");
+
+	auto first = std::lower_bound(blocks_.begin(), blocks_.end(), low, [](const BasicBlock &block, uint64_t pc) { return block.start < pc; });
+	for(auto i = first; i != blocks_.end() && i->start < high; ++i) {
+		fprintf(f, "\t\"%lx\" [label=\"%lx-%lx\\n%lu insns, %lu execs\"];\n", i->start, i->start, i->end, i->instructions, i->executions);
+	}
+
+	for(auto &edge : edges_) {
+		if(!in_range(edge.from) && !in_range(edge.to)) continue;
+		fprintf(f, "\t\"%lx\" -> \"%lx\" [label=\"%lu\"];\n", edge.from, edge.to, edge.count);
+	}
+
+	fprintf(f, "}\n");
+}
@@ -0,0 +1,457 @@
+#include "libtrace/FilterExpression.h"
+
+#include <algorithm>
+#include <cctype>
+#include <cstdlib>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kMaxStackDepth = 64;
+	const uint64_t kMaxPC = ~0ULL;
+
+	typedef std::vector<std::pair<uint64_t, uint64_t>> ranges_t;
+
+	ranges_t Normalise(ranges_t ranges)
+	{
+		std::sort(ranges.begin(), ranges.end());
+		ranges_t result;
+		for(auto &i : ranges) {
+			if(!result.empty() && (result.back().second == kMaxPC || i.first <= result.back().second + 1)) {
+				result.back().second = std::max(result.back().second, i.second);
+			} else {
+				result.push_back(i);
+			}
+		}
+		return result;
+	}
+
+	ranges_t Union(const ranges_t &a, const ranges_t &b)
+	{
+		ranges_t result (a);
+		result.insert(result.end(), b.begin(), b.end());
+		return Normalise(result);
+	}
+
+	ranges_t Intersect(const ranges_t &a, const ranges_t &b)
+	{
+		ranges_t result;
+		for(size_t i = 0, j = 0; i < a.size() && j < b.size(); ) {
+			uint64_t low = std::max(a[i].first, b[j].first);
+			uint64_t high = std::min(a[i].second, b[j].second);
+			if(low <= high) result.push_back(std::make_pair(low, high));
+			if(a[i].second < b[j].second) i++;
+			else j++;
+		}
+		return result;
+	}
+
+	ranges_t Complement(const ranges_t &a)
+	{
+		ranges_t result;
+		uint64_t next = 0;
+		bool done = false;
+		for(auto &i : a) {
+			if(i.first > next) result.push_back(std::make_pair(next, i.first - 1));
+			if(i.second == kMaxPC) {
+				done = true;
+				break;
+			}
+			next = i.second + 1;
+		}
+		if(!done) result.push_back(std::make_pair(next, kMaxPC));
+		return result;
+	}
+
+	struct Token {
+		enum Kind { End, Number, Identifier, Operator } kind;
+		std::string text;
+		uint64_t value;
+	};
+}
+
+// Recursive descent parser which emits postfix code as it goes, and works out
+// alongside it whether each subexpression is a constant, the PC, or a set of
+// PC ranges.
+class FilterExpression::Parser
+{
+public:
+	struct Value {
+		enum Kind { Other, Constant, PC, Ranges } kind;
+		uint64_t constant;
+		ranges_t ranges;
+	};
+
+	Parser(const std::string &text, std::vector<Instruction> &code) : text_(text), pos_(0), code_(code) { Next(); }
+
+	bool Parse(Value &value, std::string &error)
+	{
+		value = ParseBinary(0);
+		if(error_.empty() && token_.kind != Token::End) Fail("Unexpected '" + token_.text + "'");
+		error = error_;
+		return error_.empty();
+	}
+
+private:
+	struct BinaryOperator {
+		const char *text;
+		int precedence;
+		Opcode opcode;
+	};
+
+	static const BinaryOperator *FindBinaryOperator(const Token &token)
+	{
+		static const BinaryOperator operators[] = {
+			{ "||", 1, Op_LogicalOr }, { "&&", 2, Op_LogicalAnd },
+			{ "|", 3, Op_Or }, { "^", 4, Op_Xor }, { "&", 5, Op_And },
+			{ "==", 6, Op_Eq }, { "!=", 6, Op_Ne },
+			{ "<", 7, Op_Lt }, { "<=", 7, Op_Le }, { ">", 7, Op_Gt }, { ">=", 7, Op_Ge },
+			{ "<<", 8, Op_Shl }, { ">>", 8, Op_Shr },
+			{ "+", 9, Op_Add }, { "-", 9, Op_Sub }, { "*", 10, Op_Mul }
+		};
+		if(token.kind != Token::Operator) return nullptr;
+		for(auto &i : operators) {
+			if(token.text == i.text) return &i;
+		}
+		return nullptr;
+	}
+
+	void Fail(const std::string &message)
+	{
+		if(error_.empty()) error_ = message;
+	}
+
+	void Next()
+	{
+		while(pos_ < text_.size() && isspace(text_[pos_])) pos_++;
+		token_.text.clear();
+		token_.value = 0;
+
+		if(pos_ == text_.size()) {
+			token_.kind = Token::End;
+			token_.text = "end of expression";
+			return;
+		}
+
+		char c = text_[pos_];
+		if(isdigit(c)) {
+			char *end;
+			token_.kind = Token::Number;
+			token_.value = strtoull(text_.c_str() + pos_, &end, 0);
+			size_t length = end - (text_.c_str() + pos_);
+			token_.text = text_.substr(pos_, length);
+			pos_ += length;
+		} else if(isalpha(c) || c == '_') {
+			token_.kind = Token::Identifier;
+			while(pos_ < text_.size() && (isalnum(text_[pos_]) || text_[pos_] == '_')) token_.text += text_[pos_++];
+		} else {
+			static const char *two_char[] = { "||", "&&", "==", "!=", "<=", ">=", "<<", ">>" };
+			token_.kind = Token::Operator;
+			token_.text = c;
+			for(auto op : two_char) {
+				if(text_.compare(pos_, 2, op) == 0) token_.text = op;
+			}
+			pos_ += token_.text.size();
+		}
+	}
+
+	bool Expect(const char *op)
+	{
+		if(token_.kind != Token::Operator || token_.text != op) {
+			Fail(std::string("Expected '") + op + "' but found '" + token_.text + "'");
+			return false;
+		}
+		Next();
+		return true;
+	}
+
+	void Emit(Opcode opcode, uint64_t a = 0, uint64_t b = 0)
+	{
+		code_.push_back(Instruction {opcode, a, b});
+	}
+
+	Value ParseBinary(int min_precedence)
+	{
+		Value lhs = ParseUnary();
+		while(error_.empty()) {
+			const BinaryOperator *op = FindBinaryOperator(token_);
+			if(!op || op->precedence < min_precedence) break;
+
+			Next();
+			Value rhs = ParseBinary(op->precedence + 1);
+			Emit(op->opcode);
+			lhs = Combine(op->opcode, lhs, rhs);
+		}
+		return lhs;
+	}
+
+	Value ParseUnary()
+	{
+		if(token_.kind == Token::Operator) {
+			Opcode opcode;
+			if(token_.text == "!") opcode = Op_Not;
+			else if(token_.text == "~") opcode = Op_BitNot;
+			else if(token_.text == "-") opcode = Op_Negate;
+			else return ParsePrimary();
+
+			Next();
+			Value operand = ParseUnary();
+			Emit(opcode);
+			if(opcode == Op_Not && operand.kind == Value::Ranges) {
+				operand.ranges = Complement(operand.ranges);
+				return operand;
+			}
+			return Value {Value::Other, 0, ranges_t()};
+		}
+		return ParsePrimary();
+	}
+
+	Value ParsePrimary()
+	{
+		if(token_.kind == Token::Number) {
+			uint64_t value = token_.value;
+			Next();
+			Emit(Op_Const, value);
+			return Value {Value::Constant, value, ranges_t()};
+		}
+
+		if(token_.kind == Token::Operator && token_.text == "(") {
+			Next();
+			Value value = ParseBinary(0);
+			Expect(")");
+			return value;
+		}
+
+		if(token_.kind != Token::Identifier) {
+			Fail("Unexpected '" + token_.text + "'");
+			return Value {Value::Other, 0, ranges_t()};
+		}
+
+		static const struct { const char *name; Opcode opcode; } fields[] = {
+			{ "pc", Op_PC }, { "code", Op_Code }, { "isa", Op_ISA }, { "mode", Op_Mode },
+			{ "asid", Op_ASID }, { "index", Op_Index },
+			{ "reg_writes", Op_RegWrites }, { "mem_reads", Op_MemReads }, { "mem_writes", Op_MemWrites }
+		};
+		static const struct { const char *name; Opcode opcode; int arguments; } functions[] = {
+			{ "reg", Op_Reg, 1 }, { "writes_reg", Op_WritesReg, 1 },
+			{ "reads_mem", Op_ReadsMem, 2 }, { "writes_mem", Op_WritesMem, 2 }, { "accesses_mem", Op_AccessesMem, 2 }
+		};
+
+		std::string name = token_.text;
+		Next();
+
+		for(auto &i : fields) {
+			if(name != i.name) continue;
+			Emit(i.opcode);
+			return Value {i.opcode == Op_PC ? Value::PC : Value::Other, 0, ranges_t()};
+		}
+
+		for(auto &i : functions) {
+			if(name != i.name) continue;
+
+			// arguments must be constants, and are baked into the instruction
+			uint64_t arguments[2] = {0, 0};
+			Expect("(");
+			for(int arg = 0; arg < i.arguments && error_.empty(); ++arg) {
+				if(arg) Expect(",");
+				if(token_.kind != Token::Number) {
+					Fail("Arguments to " + name + " must be constants");
+					break;
+				}
+				arguments[arg] = token_.value;
+				Next();
+			}
+			Expect(")");
+			Emit(i.opcode, arguments[0], arguments[1]);
+			return Value {Value::Other, 0, ranges_t()};
+		}
+
+		Fail("Unknown field or function '" + name + "'");
+		return Value {Value::Other, 0, ranges_t()};
+	}
+
+	static Value Combine(Opcode opcode, const Value &lhs, const Value &rhs)
+	{
+		Value result {Value::Other, 0, ranges_t()};
+
+		if(lhs.kind == Value::Ranges && rhs.kind == Value::Ranges) {
+			if(opcode == Op_LogicalAnd) result.ranges = Intersect(lhs.ranges, rhs.ranges);
+			else if(opcode == Op_LogicalOr) result.ranges = Union(lhs.ranges, rhs.ranges);
+			else return result;
+			result.kind = Value::Ranges;
+			return result;
+		}
+
+		// put comparisons in the form pc <op> constant
+		bool pc_first = lhs.kind == Value::PC && rhs.kind == Value::Constant;
+		bool pc_second = lhs.kind == Value::Constant && rhs.kind == Value::PC;
+		if(!pc_first && !pc_second) return result;
+
+		uint64_t c = pc_first ? rhs.constant : lhs.constant;
+		if(pc_second) {
+			switch(opcode) {
+				case Op_Lt: opcode = Op_Gt; break;
+				case Op_Le: opcode = Op_Ge; break;
+				case Op_Gt: opcode = Op_Lt; break;
+				case Op_Ge: opcode = Op_Le; break;
+				default: break;
+			}
+		}
+
+		switch(opcode) {
+			case Op_Lt: if(c) result.ranges.push_back(std::make_pair(0, c - 1)); break;
+			case Op_Le: result.ranges.push_back(std::make_pair(0, c)); break;
+			case Op_Gt: if(c != kMaxPC) result.ranges.push_back(std::make_pair(c + 1, kMaxPC)); break;
+			case Op_Ge: result.ranges.push_back(std::make_pair(c, kMaxPC)); break;
+			case Op_Eq: result.ranges.push_back(std::make_pair(c, c)); break;
+			case Op_Ne: result.ranges = Complement(ranges_t {std::make_pair(c, c)}); break;
+			default: return result;
+		}
+		result.kind = Value::Ranges;
+		return result;
+	}
+
+	const std::string &text_;
+	size_t pos_;
+	Token token_;
+	std::string error_;
+	std::vector<Instruction> &code_;
+};
+
+FilterExpression::FilterExpression() : stack_depth_(0), uses_asid_(false), pc_range_filter_(false), asid_register_(kDefaultASIDRegister), asid_(0)
+{
+
+}
+
+bool FilterExpression::Compile(const std::string& text, std::string& error)
+{
+	code_.clear();
+	pc_ranges_.clear();
+
+	Parser::Value value;
+	if(!Parser(text, code_).Parse(value, error)) return false;
+
+	// work out how deep the stack gets
+	size_t depth = 0;
+	stack_depth_ = 0;
+	uses_asid_ = false;
+	for(auto &i : code_) {
+		if(i.opcode <= Op_AccessesMem) depth++;
+		else if(i.opcode >= Op_Mul) depth--;
+		stack_depth_ = std::max(stack_depth_, depth);
+		uses_asid_ |= i.opcode == Op_ASID;
+	}
+	if(stack_depth_ > kMaxStackDepth) {
+		error = "Expression is too deeply nested";
+		return false;
+	}
+
+	pc_range_filter_ = value.kind == Parser::Value::Ranges;
+	if(pc_range_filter_) pc_ranges_ = value.ranges;
+	return true;
+}
+
+void FilterExpression::TrackASID(const InstructionStateBatch& batch, const InstructionState& insn)
+{
+	for(auto write = batch.RegWritesBegin(insn); write != batch.RegWritesEnd(insn); ++write) {
+		if(write->index == asid_register_) asid_ = write->value;
+	}
+}
+
+void FilterExpression::Evaluate(const InstructionStateBatch& batch, std::vector<uint8_t>& matches)
+{
+	const size_t count = batch.instructions.size();
+	matches.resize(count);
+
+	if(pc_range_filter_) {
+		// each range test is a single unsigned comparison
+		const InstructionState *insns = batch.instructions.data();
+		for(size_t i = 0; i < count; ++i) {
+			uint64_t pc = insns[i].pc;
+			uint8_t match = 0;
+			for(auto &range : pc_ranges_) match |= (pc - range.first) <= (range.second - range.first);
+			matches[i] = match;
+		}
+		return;
+	}
+
+	for(size_t i = 0; i < count; ++i) {
+		const InstructionState &insn = batch.instructions[i];
+		matches[i] = Execute(batch, insn, batch.first_instruction + i) != 0;
+		if(uses_asid_) TrackASID(batch, insn);
+	}
+}
+
+uint64_t FilterExpression::Execute(const InstructionStateBatch& batch, const InstructionState& insn, uint64_t index) const
+{
+	uint64_t stack[kMaxStackDepth];
+	size_t top = 0;
+
+	for(const Instruction &i : code_) {
+		switch(i.opcode) {
+			case Op_Const: stack[top++] = i.a; break;
+			case Op_PC: stack[top++] = insn.pc; break;
+			case Op_Code: stack[top++] = insn.code; break;
+			case Op_ISA: stack[top++] = insn.isa_mode; break;
+			case Op_Mode: stack[top++] = insn.exception_mode; break;
+			case Op_ASID: stack[top++] = asid_; break;
+			case Op_Index: stack[top++] = index; break;
+			case Op_RegWrites: stack[top++] = insn.reg_write_end - insn.reg_write_begin; break;
+			case Op_MemReads: stack[top++] = insn.mem_read_end - insn.mem_read_begin; break;
+			case Op_MemWrites: stack[top++] = insn.mem_write_end - insn.mem_write_begin; break;
+
+			case Op_Reg:
+			case Op_WritesReg: {
+				uint64_t value = 0;
+				bool written = false;
+				for(auto write = batch.RegWritesBegin(insn); write != batch.RegWritesEnd(insn); ++write) {
+					if(write->index == i.a) {
+						value = write->value;
+						written = true;
+					}
+				}
+				stack[top++] = i.opcode == Op_Reg ? value : written;
+				break;
+			}
+
+			case Op_ReadsMem:
+			case Op_WritesMem:
+			case Op_AccessesMem: {
+				bool found = false;
+				if(i.opcode != Op_WritesMem) {
+					for(auto access = batch.MemReadsBegin(insn); access != batch.MemReadsEnd(insn); ++access) found |= access->address >= i.a && access->address < i.b;
+				}
+				if(i.opcode != Op_ReadsMem) {
+					for(auto access = batch.MemWritesBegin(insn); access != batch.MemWritesEnd(insn); ++access) found |= access->address >= i.a && access->address < i.b;
+				}
+				stack[top++] = found;
+				break;
+			}
+
+			case Op_Not: stack[top-1] = !stack[top-1]; break;
+			case Op_BitNot: stack[top-1] = ~stack[top-1]; break;
+			case Op_Negate: stack[top-1] = -stack[top-1]; break;
+
+#define BINARY(op, expr) case op: { uint64_t b = stack[--top], a = stack[top-1]; stack[top-1] = (expr); break; }
+			BINARY(Op_Mul, a * b)
+			BINARY(Op_Add, a + b)
+			BINARY(Op_Sub, a - b)
+			BINARY(Op_Shl, b < 64 ? a << b : 0)
+			BINARY(Op_Shr, b < 64 ? a >> b : 0)
+			BINARY(Op_Lt, a < b)
+			BINARY(Op_Le, a <= b)
+			BINARY(Op_Gt, a > b)
+			BINARY(Op_Ge, a >= b)
+			BINARY(Op_Eq, a == b)
+			BINARY(Op_Ne, a != b)
+			BINARY(Op_And, a & b)
+			BINARY(Op_Xor, a ^ b)
+			BINARY(Op_Or, a | b)
+			BINARY(Op_LogicalAnd, a && b)
+			BINARY(Op_LogicalOr, a || b)
+#undef BINARY
+		}
+	}
+
+	return stack[0];
+}
@@ -0,0 +1,186 @@
+#include "libtrace/InstructionBatch.h"
+
+#include <algorithm>
+
+using namespace libtrace;
+
+namespace {
+	// What a record of each type contributes to a batch. Types past the end
+	// of the table are treated as Unknown.
+	enum RecordClass : uint8_t {
+		Class_None,
+		Class_Header,
+		Class_Code,
+		Class_Reg,
+		Class_MemAddr,
+		Class_MemData
+	};
+
+	struct TypeInfo {
+		RecordClass record_class;
+		uint8_t write;
+		uint32_t reg_flags;
+	};
+
+	const uint32_t kTypeCount = DataExtension + 1;
+	const TypeInfo kTypes[kTypeCount + 1] = {
+		{Class_None, 0, 0},				// Unknown
+		{Class_Header, 0, 0},				// InstructionHeader
+		{Class_Code, 0, 0},				// InstructionCode
+		{Class_Reg, 0, 0},				// RegRead
+		{Class_Reg, 1, 0},				// RegWrite
+		{Class_Reg, 0, kBankedRegister},		// BankRegRead
+		{Class_Reg, 1, kBankedRegister},		// BankRegWrite
+		{Class_MemAddr, 0, 0},				// MemReadAddr
+		{Class_MemData, 0, 0},				// MemReadData
+		{Class_MemAddr, 1, 0},				// MemWriteAddr
+		{Class_MemData, 1, 0},				// MemWriteData
+		{Class_None, 0, 0},				// InstructionBundleHeader
+		{Class_None, 0, 0},				// DataExtension
+		{Class_None, 0, 0},				// anything else
+	};
+
+	template<typename T> void Grow(std::vector<T> &v, size_t size)
+	{
+		if(v.size() < size) v.resize(size);
+	}
+}
+
+void InstructionBatch::Reserve(size_t count)
+{
+	Grow(record_idx, count);
+	Grow(pc, count);
+	Grow(code, count);
+	Grow(isa_mode, count);
+	Grow(exception_mode, count);
+	Grow(reg_offset, count + 1);
+	Grow(mem_offset, count + 1);
+
+	Grow(reg_index, count);
+	Grow(reg_value, count);
+	Grow(reg_write, count);
+
+	Grow(mem_address, count);
+	Grow(mem_data, count);
+	Grow(mem_width, count);
+	Grow(mem_write, count);
+
+	instructions = reg_accesses = mem_accesses = 0;
+	reg_offset[0] = mem_offset[0] = 0;
+}
+
+size_t InstructionBatch::Decode(const Record* records, size_t count, uint64_t base_idx, bool final)
+{
+	Reserve(count);
+
+	// without the end of the trace, stop at the last header
+	size_t end = count;
+	if(!final) {
+		while(end > 0 && (records[end-1].GetHeader() >> 24) != InstructionHeader) end--;
+		if(end == 0) return count;
+		end--;
+	}
+
+	// skip to the first header
+	size_t i = 0;
+	while(i < end && (records[i].GetHeader() >> 24) != InstructionHeader) i++;
+
+	size_t insns = 0, regs = 0, mems = 0;
+	for(; i < end; ++i) {
+		uint32_t header = records[i].GetHeader();
+		const TypeInfo &info = kTypes[std::min(header >> 24, kTypeCount)];
+		uint32_t data16 = header & 0xffff;
+
+		// Work out the full value without branching: the high half comes
+		// from the following extension if there is one, and data is masked
+		// to its width
+		uint64_t extended = ((header >> 16) & 0xff) != 0 && i + 1 < count;
+		uint64_t value = records[i].GetData() | (((uint64_t)records[i + extended].GetData() << 32) & (0 - extended));
+		uint64_t width_mask = data16 >= 8 ? ~0ULL : (1ULL << (data16 * 8)) - 1;
+
+		// only the stores depend on the kind of record
+		switch(info.record_class) {
+			case Class_Header:
+				record_idx[insns] = base_idx + i;
+				pc[insns] = value;
+				isa_mode[insns] = data16;
+				code[insns] = 0;
+				exception_mode[insns] = 0;
+				reg_offset[insns] = regs;
+				mem_offset[insns] = mems;
+				insns++;
+				break;
+			case Class_Code:
+				code[insns-1] = value;
+				exception_mode[insns-1] = data16;
+				break;
+			case Class_Reg:
+				reg_index[regs] = info.reg_flags | data16;
+				reg_value[regs] = value;
+				reg_write[regs] = info.write;
+				regs++;
+				break;
+			case Class_MemAddr:
+				mem_address[mems] = value;
+				mem_data[mems] = 0;
+				mem_width[mems] = data16;
+				mem_write[mems] = info.write;
+				mems++;
+				break;
+			case Class_MemData:
+				// data follows the address it belongs to
+				if(mems && mem_offset[insns-1] != mems) mem_data[mems-1] = value & width_mask;
+				break;
+			case Class_None:
+				break;
+		}
+	}
+
+	instructions = insns;
+	reg_accesses = regs;
+	mem_accesses = mems;
+	reg_offset[insns] = regs;
+	mem_offset[insns] = mems;
+	return end;
+}
+
+void InstructionBatch::Truncate(size_t n)
+{
+	if(n >= instructions) return;
+
+	instructions = n;
+	reg_accesses = reg_offset[n];
+	mem_accesses = mem_offset[n];
+}
+
+InstructionBatchReader::InstructionBatchReader(const RecordBlockReader& reader, uint64_t first, uint64_t last, uint64_t first_instruction, size_t batch_records) : reader_(reader), position_(first), last_(last), instruction_(first_instruction), buffer_(std::max<size_t>(batch_records, 2))
+{
+
+}
+
+bool InstructionBatchReader::Next(InstructionBatch& batch)
+{
+	while(true) {
+		uint64_t size = reader_.Size();
+		if(position_ >= std::min(last_, size)) return false;
+
+		size_t count = reader_.Read(position_, buffer_.data(), buffer_.size());
+		bool final = position_ + count >= size;
+
+		size_t used = batch.Decode(buffer_.data(), count, position_, final);
+		if(used == 0 && !final) {
+			// a single instruction larger than the buffer
+			buffer_.resize(buffer_.size() * 2);
+			continue;
+		}
+		position_ += used;
+
+		// instructions which start past the range belong to someone else
+		auto begin = batch.record_idx.begin();
+		batch.Truncate(std::lower_bound(begin, begin + batch.instructions, last_) - begin);
+
+		batch.first_instruction = instruction_;
+		instruction_ += batch.instructions;
+		if(batch.instructions) return true;
+	}
+}
@@ -0,0 +1,114 @@
+#include "libtrace/InstructionIndexer.h"
+#include "libtrace/RecordTypes.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kScanRecords = 1 << 16;
+}
+
+InstructionIndexer::InstructionIndexer(const RecordBlockReader& reader, uint64_t bookmark_width) : reader_(reader), bookmark_width_(bookmark_width), instructions_(0), scanned_records_(0), complete_(false), stopping_(false)
+{
+	assert(bookmark_width_ > 0);
+	thread_ = std::thread(&InstructionIndexer::Run, this);
+}
+
+InstructionIndexer::~InstructionIndexer()
+{
+	stopping_ = true;
+	thread_.join();
+}
+
+bool InstructionIndexer::Update()
+{
+	// a scan which is still running will find the new records by itself
+	if(!complete_ || reader_.Size() <= scanned_records_) return false;
+
+	thread_.join();
+	complete_ = false;
+	thread_ = std::thread(&InstructionIndexer::Run, this);
+	return true;
+}
+
+bool InstructionIndexer::GetBookmark(uint64_t insn, uint64_t& bookmark_insn, uint64_t& record_idx)
+{
+	if(insn >= instructions_) return false;
+
+	std::lock_guard<std::mutex> guard (lock_);
+	uint64_t bookmark = insn / bookmark_width_;
+	assert(bookmark < bookmarks_.size());
+
+	bookmark_insn = bookmark * bookmark_width_;
+	record_idx = bookmarks_[bookmark];
+	return true;
+}
+
+bool InstructionIndexer::GetInstruction(uint64_t record_idx, uint64_t& insn)
+{
+	if(record_idx >= scanned_records_) return false;
+
+	uint64_t bookmark, pos;
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		auto i = std::upper_bound(bookmarks_.begin(), bookmarks_.end(), record_idx);
+		if(i == bookmarks_.begin()) {
+			// before the first instruction
+			insn = 0;
+			return true;
+		}
+		--i;
+		bookmark = i - bookmarks_.begin();
+		pos = *i;
+	}
+
+	// count the instruction headers after the bookmark
+	insn = bookmark * bookmark_width_;
+	std::vector<Record> buffer (kScanRecords);
+	pos++;
+	while(pos <= record_idx) {
+		size_t n = reader_.Read(pos, buffer.data(), std::min<uint64_t>(kScanRecords, record_idx + 1 - pos));
+		if(n == 0) break;
+		for(size_t i = 0; i < n; ++i) {
+			if((buffer[i].GetHeader() >> 24) == InstructionHeader) insn++;
+		}
+		pos += n;
+	}
+	return true;
+}
+
+void InstructionIndexer::Run()
+{
+	std::vector<Record> buffer (kScanRecords);
+	std::vector<uint64_t> new_bookmarks;
+
+	// carry on from any earlier scan
+	uint64_t insn = instructions_;
+	uint64_t pos = scanned_records_;
+
+	while(!stopping_) {
+		size_t n = reader_.Read(pos, buffer.data(), kScanRecords);
+		if(n == 0) break;
+
+		for(size_t i = 0; i < n; ++i) {
+			if((buffer[i].GetHeader() >> 24) != InstructionHeader) continue;
+			if((insn % bookmark_width_) == 0) new_bookmarks.push_back(pos + i);
+			insn++;
+		}
+		pos += n;
+
+		// publish the bookmarks before the instruction count, so that any
+		// instruction below the count always has a bookmark
+		if(!new_bookmarks.empty()) {
+			std::lock_guard<std::mutex> guard (lock_);
+			bookmarks_.insert(bookmarks_.end(), new_bookmarks.begin(), new_bookmarks.end());
+			new_bookmarks.clear();
+		}
+		instructions_ = insn;
+		scanned_records_ = pos;
+	}
+
+	complete_ = !stopping_;
+}
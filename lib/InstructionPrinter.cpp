@@ -1,4 +1,5 @@
 #include "libtrace/InstructionPrinter.h"
+#include "libtrace/ArchInterface.h"
 #include "libtrace/RecordIterator.h"
 #include "libtrace/RecordTypes.h"
 #include "libtrace/TraceRecordPacket.h"
@@ -33,7 +34,7 @@ private:
 	const InstructionPrinter::extension_list_t &extensions_;
 };
 
-InstructionPrinter::InstructionPrinter()
+InstructionPrinter::InstructionPrinter() : _arch(nullptr)
 {
 	SetDisplayAll();
 }
@@ -86,6 +87,7 @@ bool InstructionPrinter::PrintInstruction(std::ostream& str, TracePacketStreamIn
 	InstructionCodeReader   code (*(InstructionCodeRecord*)&code_packet.GetRecord(), code_packet.GetExtensions());
 	
 	str << "[" << std::hex << std::setw(8) << std::setfill('0') << hdr.GetPC().AsU32() << "] " << std::hex << std::setw(8) << std::setfill('0') << code.GetCode().AsU32() << " ";
+	if(_arch) str << _arch->DisassembleInstruction(hdr.GetIsaMode(), code.GetRecord()) << " ";
 	
 	while(stream->Good() && (stream->Peek().GetRecord().GetType() != InstructionHeader)) {
 		TraceRecordPacket next_packet = stream->Get();
@@ -0,0 +1,162 @@
+#include "libtrace/InstructionState.h"
+
+#include <algorithm>
+#include <cstring>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kReadRecords = 1 << 16;
+
+	// a record plus the largest possible number of extensions
+	const size_t kMaxPacketRecords = 256;
+
+	uint64_t MaskToWidth(uint64_t value, uint32_t width)
+	{
+		if(width >= 8) return value;
+		return value & ((1ULL << (width * 8)) - 1);
+	}
+}
+
+void InstructionStateBatch::Clear()
+{
+	first_instruction = 0;
+	instructions.clear();
+	reg_writes.clear();
+	mem_reads.clear();
+	mem_writes.clear();
+}
+
+InstructionStateReader::InstructionStateReader(const RecordBlockReader& reader, uint64_t record_idx, uint64_t first_instruction) : reader_(reader), record_idx_(record_idx), first_instruction_(first_instruction), batches_(kQueueDepth), current_(nullptr), finished_(false), stopping_(false)
+{
+	for(auto &i : batches_) free_.push_back(&i);
+	thread_ = std::thread(&InstructionStateReader::Run, this);
+}
+
+InstructionStateReader::~InstructionStateReader()
+{
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		stopping_ = true;
+	}
+	cond_.notify_all();
+	thread_.join();
+}
+
+const InstructionStateBatch* InstructionStateReader::Next()
+{
+	std::unique_lock<std::mutex> guard (lock_);
+	if(current_) {
+		free_.push_back(current_);
+		current_ = nullptr;
+		cond_.notify_all();
+	}
+
+	cond_.wait(guard, [this]() { return !full_.empty() || finished_; });
+	if(full_.empty()) return nullptr;
+
+	current_ = full_.front();
+	full_.pop_front();
+	return current_;
+}
+
+void InstructionStateReader::Publish(InstructionStateBatch* batch)
+{
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		full_.push_back(batch);
+	}
+	cond_.notify_all();
+}
+
+InstructionStateBatch* InstructionStateReader::GetFreeBatch()
+{
+	std::unique_lock<std::mutex> guard (lock_);
+	cond_.wait(guard, [this]() { return !free_.empty() || stopping_; });
+	if(stopping_) return nullptr;
+
+	InstructionStateBatch *batch = free_.front();
+	free_.pop_front();
+	batch->Clear();
+	return batch;
+}
+
+void InstructionStateReader::Run()
+{
+	std::vector<Record> buffer (kReadRecords);
+	uint64_t base = record_idx_;
+	size_t pos = 0, end = 0;
+	uint64_t insn = first_instruction_;
+
+	InstructionStateBatch *batch = GetFreeBatch();
+	if(batch) batch->first_instruction = insn;
+
+	while(batch) {
+		// keep a whole packet in the buffer
+		if(end - pos < kMaxPacketRecords) {
+			memmove(buffer.data(), buffer.data() + pos, (end - pos) * sizeof(Record));
+			base += pos;
+			end -= pos;
+			pos = 0;
+			end += reader_.Read(base + end, buffer.data() + end, buffer.size() - end);
+			if(pos == end) break;
+		}
+
+		const TraceRecord &tr = (const TraceRecord&)buffer[pos];
+		uint64_t record_idx = base + pos;
+		uint64_t value = tr.GetData32();
+		if(tr.GetExtensionCount() && pos + 1 < end) value |= (uint64_t)buffer[pos+1].GetData() << 32;
+		pos = std::min(end, pos + 1 + tr.GetExtensionCount());
+
+		if(tr.GetType() == InstructionHeader) {
+			if(batch->instructions.size() == kBatchInstructions) {
+				Publish(batch);
+				batch = GetFreeBatch();
+				if(!batch) break;
+				batch->first_instruction = insn;
+			}
+
+			uint32_t rw = batch->reg_writes.size(), mr = batch->mem_reads.size(), mw = batch->mem_writes.size();
+			batch->instructions.push_back(InstructionState {record_idx, value, 0, tr.GetData16(), 0, rw, rw, mr, mr, mw, mw});
+			insn++;
+			continue;
+		}
+
+		// ignore anything before the first instruction header
+		if(batch->instructions.empty()) continue;
+		InstructionState &state = batch->instructions.back();
+
+		switch(tr.GetType()) {
+			case InstructionCode:
+				state.code = value;
+				state.exception_mode = tr.GetData16();
+				break;
+			case RegWrite:
+			case BankRegWrite:
+				batch->reg_writes.push_back(RegAccess {(tr.GetType() == BankRegWrite ? kBankedRegister : 0) | tr.GetData16(), value});
+				state.reg_write_end = batch->reg_writes.size();
+				break;
+			case MemReadAddr:
+				batch->mem_reads.push_back(MemAccess {value, 0, tr.GetData16()});
+				state.mem_read_end = batch->mem_reads.size();
+				break;
+			case MemReadData:
+				if(state.mem_read_end != state.mem_read_begin) batch->mem_reads.back().data = MaskToWidth(value, tr.GetData16());
+				break;
+			case MemWriteAddr:
+				batch->mem_writes.push_back(MemAccess {value, 0, tr.GetData16()});
+				state.mem_write_end = batch->mem_writes.size();
+				break;
+			case MemWriteData:
+				if(state.mem_write_end != state.mem_write_begin) batch->mem_writes.back().data = MaskToWidth(value, tr.GetData16());
+				break;
+			default:
+				break;
+		}
+	}
+
+	std::lock_guard<std::mutex> guard (lock_);
+	if(batch && !batch->instructions.empty()) full_.push_back(batch);
+	finished_ = true;
+	cond_.notify_all();
+}
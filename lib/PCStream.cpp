@@ -0,0 +1,73 @@
+#include "libtrace/PCStream.h"
+
+#include <cstring>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace libtrace;
+
+PCStreamReader::PCStreamReader(const RecordBlockReader& reader, uint64_t record_idx) : reader_(reader), buffer_(kBufferRecords), buffer_base_(record_idx), buffer_pos_(0), buffer_end_(0)
+{
+
+}
+
+bool PCStreamReader::Fill()
+{
+	size_t remaining = buffer_end_ - buffer_pos_;
+	memmove(buffer_.data(), buffer_.data() + buffer_pos_, remaining * sizeof(Record));
+	buffer_base_ += buffer_pos_;
+	buffer_pos_ = 0;
+
+	size_t read = reader_.Read(buffer_base_ + remaining, buffer_.data() + remaining, buffer_.size() - remaining);
+	buffer_end_ = remaining + read;
+	return read != 0;
+}
+
+size_t PCStreamReader::Read(uint64_t* pcs, size_t count)
+{
+	size_t n = 0;
+	while(n < count) {
+		// make sure that a header's extension is always buffered alongside it
+		if(buffer_end_ - buffer_pos_ < 2) {
+			if(!Fill() && buffer_pos_ == buffer_end_) break;
+		}
+
+		const TraceRecord *tr = (const TraceRecord*)&buffer_[buffer_pos_];
+		buffer_pos_++;
+
+		if(tr->GetType() != InstructionHeader) continue;
+
+		uint64_t pc = tr->GetData32();
+		if(tr->GetExtensionCount() && buffer_pos_ < buffer_end_) {
+			pc |= (uint64_t)buffer_[buffer_pos_].GetData() << 32;
+		}
+		pcs[n++] = pc;
+	}
+	return n;
+}
+
+size_t libtrace::FindFirstMismatch(const uint64_t* a, const uint64_t* b, size_t count)
+{
+	size_t i = 0;
+
+#if defined(__SSE2__)
+	// compare four PCs per iteration and only drop to scalar code once a
+	// difference has been seen
+	for(; i + 4 <= count; i += 4) {
+		__m128i a0 = _mm_loadu_si128((const __m128i*)(a + i));
+		__m128i a1 = _mm_loadu_si128((const __m128i*)(a + i + 2));
+		__m128i b0 = _mm_loadu_si128((const __m128i*)(b + i));
+		__m128i b1 = _mm_loadu_si128((const __m128i*)(b + i + 2));
+
+		__m128i eq = _mm_and_si128(_mm_cmpeq_epi32(a0, b0), _mm_cmpeq_epi32(a1, b1));
+		if(_mm_movemask_epi8(eq) != 0xffff) break;
+	}
+#endif
+
+	for(; i < count; ++i) {
+		if(a[i] != b[i]) return i;
+	}
+	return count;
+}
@@ -0,0 +1,261 @@
+#include "libtrace/RecordBlockReader.h"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstdlib>
+
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kBounceBufferSize = 1 << 20;
+	const size_t kTailScanRecords = 4096;
+	const size_t kIdentityHashRecords = 1 << 16;
+
+	// Copy through a user space buffer, for when the kernel can't copy
+	// between the two files. Without an output offset, the data is written
+	// at the output's file position.
+	uint64_t BounceCopy(int in_fd, off_t in_offset, int out_fd, const off_t *out_offset, uint64_t bytes)
+	{
+		std::vector<char> buffer (kBounceBufferSize);
+		uint64_t copied = 0;
+
+		while(copied < bytes) {
+			ssize_t count = pread(in_fd, buffer.data(), std::min<uint64_t>(buffer.size(), bytes - copied), in_offset + copied);
+			if(count < 0) {
+				if(errno == EINTR) continue;
+				perror("");
+				abort();
+			}
+			if(count == 0) break;
+
+			for(ssize_t written = 0; written < count; ) {
+				const char *data = buffer.data() + written;
+				ssize_t result = out_offset ? pwrite(out_fd, data, count - written, *out_offset + copied + written) : write(out_fd, data, count - written);
+				if(result < 0) {
+					if(errno == EINTR) continue;
+					perror("");
+					abort();
+				}
+				written += result;
+			}
+			copied += count;
+		}
+
+		return copied;
+	}
+
+	size_t ReadRecords(int fd, uint64_t first, Record *buffer, size_t count)
+	{
+		char *ptr = (char*)buffer;
+		size_t remaining = count * sizeof(Record);
+		off_t offset = first * sizeof(Record);
+
+		while(remaining) {
+			ssize_t bytes = pread(fd, ptr, remaining, offset);
+			if(bytes < 0) {
+				if(errno == EINTR) continue;
+				perror("");
+				abort();
+			}
+			if(bytes == 0) break;
+
+			ptr += bytes;
+			offset += bytes;
+			remaining -= bytes;
+		}
+
+		return (ptr - (char*)buffer) / sizeof(Record);
+	}
+}
+
+RecordBlockReader::RecordBlockReader(FILE *f, bool complete_only) : RecordBlockReader(fileno(f), complete_only)
+{
+
+}
+
+RecordBlockReader::RecordBlockReader(int fd, bool complete_only) : fd_(fd), count_(0)
+{
+	if(complete_only) RefreshComplete();
+	else Refresh();
+}
+
+RecordBlockReader::RecordBlockReader(const RecordBlockReader& other) : fd_(other.fd_), count_(other.count_.load())
+{
+
+}
+
+RecordBlockReader &RecordBlockReader::operator=(const RecordBlockReader& other)
+{
+	fd_ = other.fd_;
+	count_ = other.count_.load();
+	return *this;
+}
+
+uint64_t RecordBlockReader::GetFileRecords() const
+{
+	struct stat st;
+	if(fstat(fd_, &st)) {
+		perror("");
+		abort();
+	}
+	return st.st_size / sizeof(Record);
+}
+
+uint64_t RecordBlockReader::Refresh()
+{
+	count_ = GetFileRecords();
+	return count_;
+}
+
+uint64_t RecordBlockReader::RefreshComplete()
+{
+	uint64_t old_count = count_;
+	uint64_t end = GetFileRecords();
+	if(end <= old_count) return old_count;
+
+	// search backwards for the last header which wasn't already visible
+	std::vector<Record> buffer (kTailScanRecords);
+	while(end > old_count) {
+		uint64_t first = std::max<uint64_t>(old_count, end > kTailScanRecords ? end - kTailScanRecords : 0);
+		uint64_t n = end - first;
+
+		if(ReadRecords(fd_, first, buffer.data(), n) != n) return old_count;
+
+		for(uint64_t i = n; i > 0; --i) {
+			if((buffer[i-1].GetHeader() >> 24) != InstructionHeader) continue;
+			count_ = first + i - 1;
+			return count_;
+		}
+		end = first;
+	}
+	return old_count;
+}
+
+size_t RecordBlockReader::Read(uint64_t first, Record *buffer, size_t count) const
+{
+	uint64_t size = count_;
+	if(first >= size) return 0;
+	if(count > size - first) count = size - first;
+
+	return ReadRecords(fd_, first, buffer, count);
+}
+
+uint64_t RecordBlockReader::GetIdentityHash() const
+{
+	uint64_t size = count_;
+	uint64_t hash = size;
+
+	// a trace rewritten in place may only differ in the middle, which is
+	// too expensive to hash, but it will have been modified since
+	struct stat st;
+	if(!fstat(fd_, &st)) {
+		uint64_t identity[] = { (uint64_t)st.st_dev, (uint64_t)st.st_ino, (uint64_t)st.st_mtim.tv_sec, (uint64_t)st.st_mtim.tv_nsec };
+		for(uint64_t word : identity) {
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash ^= hash >> 29;
+		}
+	}
+
+	// the first and last records, which overlap in a short trace
+	std::vector<Record> buffer (kIdentityHashRecords);
+	uint64_t starts[2] = { 0, size - std::min<uint64_t>(size, kIdentityHashRecords) };
+	for(uint64_t start : starts) {
+		size_t count = ReadRecords(fd_, start, buffer.data(), std::min<uint64_t>(size - start, kIdentityHashRecords));
+		for(size_t i = 0; i < count; ++i) {
+			uint64_t word = ((uint64_t)buffer[i].GetHeader() << 32) | buffer[i].GetData();
+			hash = (hash ^ word) * 0x9e3779b97f4a7c15ULL;
+			hash ^= hash >> 29;
+		}
+	}
+	return hash;
+}
+
+uint64_t RecordBlockReader::CopyTo(uint64_t first, uint64_t count, int out_fd, uint64_t out_offset) const
+{
+	uint64_t size = count_;
+	if(first >= size) return 0;
+	if(count > size - first) count = size - first;
+
+	loff_t in_offset = first * sizeof(Record);
+	loff_t out = out_offset;
+	uint64_t remaining = count * sizeof(Record);
+
+	while(remaining) {
+		ssize_t bytes = copy_file_range(fd_, &in_offset, out_fd, &out, remaining, 0);
+		if(bytes < 0) {
+			if(errno == EINTR) continue;
+			if(errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP) {
+				off_t bounce_offset = out;
+				remaining -= BounceCopy(fd_, in_offset, out_fd, &bounce_offset, remaining);
+				break;
+			}
+			perror("");
+			abort();
+		}
+		if(bytes == 0) break;
+		remaining -= bytes;
+	}
+
+	return count - remaining / sizeof(Record);
+}
+
+uint64_t RecordBlockReader::WriteTo(uint64_t first, uint64_t count, int out_fd) const
+{
+	uint64_t size = count_;
+	if(first >= size) return 0;
+	if(count > size - first) count = size - first;
+
+	struct stat st;
+	if(fstat(out_fd, &st)) {
+		perror("");
+		abort();
+	}
+	bool is_pipe = S_ISFIFO(st.st_mode);
+
+	loff_t in_offset = first * sizeof(Record);
+	uint64_t remaining = count * sizeof(Record);
+
+	while(remaining) {
+		// pipes are fed from the page cache with splice, and anything else
+		// is copied to its file position
+		ssize_t bytes = is_pipe ? splice(fd_, &in_offset, out_fd, nullptr, remaining, SPLICE_F_MORE) : copy_file_range(fd_, &in_offset, out_fd, nullptr, remaining, 0);
+		if(bytes < 0) {
+			if(errno == EINTR) continue;
+
+			// EBADF is returned for files opened for appending
+			if(errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP || errno == EBADF) {
+				remaining -= BounceCopy(fd_, in_offset, out_fd, nullptr, remaining);
+				break;
+			}
+			perror("");
+			abort();
+		}
+		if(bytes == 0) break;
+		remaining -= bytes;
+	}
+
+	return count - remaining / sizeof(Record);
+}
+
+RecordBlockBuffer::RecordBlockBuffer(const RecordBlockReader& reader) : reader_(reader), page_(kPageRecords), page_base_(0), page_count_(0)
+{
+
+}
+
+Record RecordBlockBuffer::Get(size_t i)
+{
+	if(i < page_base_ || i >= page_base_ + page_count_) {
+		page_base_ = i & ~(uint64_t)(kPageRecords - 1);
+		page_count_ = reader_.Read(page_base_, page_.data(), kPageRecords);
+
+		// past the end, perhaps because the trace shrank since Size
+		if(i >= page_base_ + page_count_) return TraceRecord();
+	}
+	return page_[i - page_base_];
+}
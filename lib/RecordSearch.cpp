@@ -0,0 +1,221 @@
+#include "libtrace/RecordSearch.h"
+
+#include <algorithm>
+#include <cassert>
+
+#if defined(__SSE2__)
+#include <emmintrin.h>
+#endif
+
+using namespace libtrace;
+
+namespace {
+	const uint64_t kChunkRecords = 1 << 20;
+	const size_t kReadRecords = 1 << 16;
+	const uint64_t kNoChunk = ~0ULL;
+
+	struct Pattern {
+		uint32_t header_value, header_mask;
+		uint32_t value, mask;
+		uint32_t types;
+	};
+
+	bool Matches(const Record &r, const Pattern &p)
+	{
+		uint32_t type = r.GetHeader() >> 24;
+		return (r.GetData() & p.mask) == p.value && type < 32 && (p.types & (1u << type));
+	}
+
+	// Returns the index of the first (or last, if reverse) match in the
+	// block, or count if there is none
+	size_t ScanBlock(const Record *records, size_t count, const Pattern &p, bool reverse)
+	{
+		size_t found = count;
+		size_t i = 0;
+
+#if defined(__SSE2__)
+		// compare two records (header and data) per vector. If only one type
+		// is wanted it is compared here too, otherwise candidates are checked
+		// against the type set below.
+		const __m128i mask = _mm_setr_epi32(p.header_mask, p.mask, p.header_mask, p.mask);
+		const __m128i value = _mm_setr_epi32(p.header_value, p.value, p.header_value, p.value);
+		for(; i + 4 <= count; i += 4) {
+			__m128i r0 = _mm_loadu_si128((const __m128i*)(records + i));
+			__m128i r1 = _mm_loadu_si128((const __m128i*)(records + i + 2));
+			__m128i eq0 = _mm_cmpeq_epi32(_mm_and_si128(r0, mask), value);
+			__m128i eq1 = _mm_cmpeq_epi32(_mm_and_si128(r1, mask), value);
+
+			int bits = _mm_movemask_ps(_mm_castsi128_ps(eq0)) | (_mm_movemask_ps(_mm_castsi128_ps(eq1)) << 4);
+			if(!(bits & (bits >> 1) & 0x55)) continue;
+
+			for(size_t j = 0; j < 4; ++j) {
+				if(Matches(records[i + j], p)) {
+					if(!reverse) return i + j;
+					found = i + j;
+				}
+			}
+		}
+#endif
+
+		for(; i < count; ++i) {
+			if(Matches(records[i], p)) {
+				if(!reverse) return i;
+				found = i;
+			}
+		}
+		return found;
+	}
+}
+
+RecordSearch::RecordSearch(const RecordBlockReader& reader, unsigned threads) : reader_(reader), thread_count_(std::max(1u, threads)), value_(0), mask_(0), types_(kAllTypes), summary_(nullptr), from_(0), reverse_(false), match_(0), next_chunk_(0), best_chunk_(kNoChunk), scanned_(0), running_(0), cancelled_(false), total_(0), chunk_count_(0)
+{
+
+}
+
+RecordSearch::~RecordSearch()
+{
+	Cancel();
+}
+
+void RecordSearch::Start(uint32_t value, uint32_t mask, uint32_t types, uint64_t from, bool reverse)
+{
+	Cancel();
+
+	value_ = value & mask;
+	mask_ = mask;
+	types_ = types;
+	from_ = from;
+	reverse_ = reverse;
+
+	uint64_t size = reader_.Size();
+	if(reverse) total_ = std::min(from + 1, size);
+	else total_ = from < size ? size - from : 0;
+	chunk_count_ = (total_ + kChunkRecords - 1) / kChunkRecords;
+
+	next_chunk_ = 0;
+	best_chunk_ = kNoChunk;
+	scanned_ = 0;
+	cancelled_ = false;
+	running_ = thread_count_;
+
+	for(unsigned i = 0; i < thread_count_; ++i) {
+		threads_.push_back(std::thread(&RecordSearch::Run, this));
+	}
+}
+
+void RecordSearch::Cancel()
+{
+	cancelled_ = true;
+	Join();
+}
+
+void RecordSearch::Wait()
+{
+	Join();
+}
+
+void RecordSearch::Join()
+{
+	for(auto &thread : threads_) thread.join();
+	threads_.clear();
+}
+
+void RecordSearch::SetSummary(const TraceSummary* summary)
+{
+	Cancel();
+	summary_ = summary;
+}
+
+bool RecordSearch::GetMatch(uint64_t& record_idx) const
+{
+	if(IsRunning() || cancelled_ || best_chunk_ == kNoChunk) return false;
+	record_idx = match_;
+	return true;
+}
+
+bool RecordSearch::GetChunk(uint64_t chunk, uint64_t& begin, uint64_t& end) const
+{
+	if(chunk >= chunk_count_) return false;
+
+	uint64_t offset = chunk * kChunkRecords;
+	uint64_t length = std::min(kChunkRecords, total_ - offset);
+	if(reverse_) {
+		end = from_ + 1 - offset;
+		begin = end - length;
+	} else {
+		begin = from_ + offset;
+		end = begin + length;
+	}
+	return true;
+}
+
+void RecordSearch::Run()
+{
+	Pattern pattern;
+	pattern.value = value_;
+	pattern.mask = mask_;
+	pattern.types = types_;
+
+	// a single type can be checked in the vector compare
+	pattern.header_mask = 0;
+	pattern.header_value = 0;
+	if(types_ && !(types_ & (types_ - 1))) {
+		pattern.header_mask = 0xff000000;
+		pattern.header_value = __builtin_ctz(types_) << 24;
+	}
+
+	std::vector<Record> buffer (kReadRecords);
+
+	while(!cancelled_) {
+		// chunks are claimed in order, so once a match has been found every
+		// chunk nearer the start has already been claimed
+		uint64_t chunk = next_chunk_++;
+		uint64_t begin, end;
+		if(chunk > best_chunk_ || !GetChunk(chunk, begin, end)) break;
+
+		while(begin < end && !cancelled_ && chunk < best_chunk_) {
+			uint64_t first = (reverse_ && end - begin > kReadRecords) ? end - kReadRecords : begin;
+			uint64_t last = std::min<uint64_t>(first + kReadRecords, end);
+
+			if(summary_) {
+				// keep each read within one summary chunk, so that it can be
+				// skipped if the chunk cannot match
+				uint64_t chunk_records = summary_->GetChunkRecords();
+				if(reverse_) first = std::max(first, ((last - 1) / chunk_records) * chunk_records);
+				else last = std::min(last, (first / chunk_records + 1) * chunk_records);
+
+				if(!summary_->MayMatch(summary_->GetChunkIndex(first), value_, mask_, types_)) {
+					scanned_ += last - first;
+					if(reverse_) end = first;
+					else begin = last;
+					continue;
+				}
+			}
+
+			size_t count = last - first;
+			size_t read = reader_.Read(first, buffer.data(), count);
+			if(read < count) {
+				// the file has been truncated
+				end = first + read;
+				if(!reverse_) count = read;
+				else break;
+			}
+
+			size_t idx = ScanBlock(buffer.data(), count, pattern, reverse_);
+			if(idx < count) {
+				std::lock_guard<std::mutex> guard (lock_);
+				if(chunk < best_chunk_) {
+					best_chunk_ = chunk;
+					match_ = first + idx;
+				}
+				break;
+			}
+
+			scanned_ += count;
+			if(reverse_) end = first;
+			else begin = first + count;
+		}
+	}
+
+	running_--;
+}
@@ -0,0 +1,146 @@
+#include "libtrace/ReuseDistance.h"
+
+#include <algorithm>
+#include <cassert>
+#include <iterator>
+
+using namespace libtrace;
+
+namespace {
+	const unsigned kHashBits = 24;
+	const uint64_t kHashRange = 1ULL << kHashBits;
+	const size_t kMinTreeSize = 1 << 16;
+
+	uint64_t HashBlock(uint64_t block)
+	{
+		block ^= block >> 33;
+		block *= 0xff51afd7ed558ccdULL;
+		block ^= block >> 33;
+		block *= 0xc4ceb9fe1a85ec53ULL;
+		block ^= block >> 33;
+		return block & (kHashRange - 1);
+	}
+
+	size_t GetBucket(double distance)
+	{
+		uint64_t d = distance;
+		return d ? 64 - __builtin_clzll(d) : 0;
+	}
+}
+
+ReuseDistance::ReuseDistance(unsigned block_bits, double sample_rate, size_t max_blocks) : block_bits_(block_bits), max_blocks_(max_blocks), now_(1)
+{
+	assert(sample_rate > 0 && sample_rate <= 1);
+	threshold_ = std::max<uint64_t>(1, sample_rate * kHashRange);
+	tree_.assign(kMinTreeSize + 1, 0);
+}
+
+double ReuseDistance::GetSampleRate() const
+{
+	return (double)threshold_ / kHashRange;
+}
+
+void ReuseDistance::Mark(uint64_t timestamp, int32_t delta)
+{
+	for(; timestamp < tree_.size(); timestamp += timestamp & -timestamp) tree_[timestamp] += delta;
+}
+
+uint64_t ReuseDistance::CountMarks(uint64_t timestamp) const
+{
+	int64_t count = 0;
+	for(; timestamp; timestamp -= timestamp & -timestamp) count += tree_[timestamp];
+	return count;
+}
+
+void ReuseDistance::Access(uint64_t address, uint64_t group)
+{
+	uint64_t block = address >> block_bits_;
+	uint64_t hash = HashBlock(block);
+	if(hash >= threshold_) return;
+
+	if(now_ == tree_.size()) Compact();
+
+	// scale sampled distances and counts up to the whole stream
+	double rate = GetSampleRate();
+	Histogram &histogram = histograms_[group];
+	histogram.accesses += 1 / rate;
+
+	uint64_t timestamp = now_++;
+	auto last = last_access_.find(block);
+	if(last == last_access_.end()) {
+		histogram.cold += 1 / rate;
+		last_access_[block] = timestamp;
+		Mark(timestamp, 1);
+
+		if(max_blocks_) {
+			sampled_.insert(std::make_pair(hash, block));
+			if(sampled_.size() > max_blocks_) Evict();
+		}
+		return;
+	}
+
+	// the number of blocks whose latest access was between the two
+	uint64_t distance = CountMarks(timestamp - 1) - CountMarks(last->second);
+	histogram.buckets[GetBucket(distance / rate)] += 1 / rate;
+
+	Mark(last->second, -1);
+	Mark(timestamp, 1);
+	last->second = timestamp;
+}
+
+void ReuseDistance::Compact()
+{
+	// renumber the live timestamps from 1, preserving their order
+	std::vector<std::pair<uint64_t, uint64_t*>> live;
+	live.reserve(last_access_.size());
+	for(auto &i : last_access_) live.push_back(std::make_pair(i.second, &i.second));
+	std::sort(live.begin(), live.end());
+
+	size_t size = std::max(kMinTreeSize, live.size() * 2);
+	tree_.assign(size + 1, 0);
+	for(size_t i = 0; i < live.size(); ++i) *live[i].second = i + 1;
+
+	// build the tree of marks at [1, n] in linear time
+	for(uint64_t i = 1; i <= live.size(); ++i) tree_[i] += 1;
+	for(uint64_t i = 1; i <= size; ++i) {
+		uint64_t parent = i + (i & -i);
+		if(parent <= size) tree_[parent] += tree_[i];
+	}
+
+	now_ = live.size() + 1;
+}
+
+void ReuseDistance::Evict()
+{
+	// lower the threshold to the largest sampled hash, and stop tracking
+	// every block at or above it
+	threshold_ = sampled_.rbegin()->first;
+	while(!sampled_.empty() && sampled_.rbegin()->first >= threshold_) {
+		auto victim = std::prev(sampled_.end());
+		auto last = last_access_.find(victim->second);
+		Mark(last->second, -1);
+		last_access_.erase(last);
+		sampled_.erase(victim);
+	}
+}
+
+std::vector<double> ReuseDistance::GetMissRatioCurve(const Histogram& histogram)
+{
+	std::vector<double> curve;
+	if(histogram.accesses == 0) return curve;
+
+	// a cache of 2^k blocks misses on every access with a distance of at
+	// least 2^k, i.e. those in buckets k+1 and above
+	double misses = histogram.cold;
+	for(size_t i = 0; i < kBuckets; ++i) misses += histogram.buckets[i];
+
+	for(size_t k = 0; k + 1 < kBuckets; ++k) {
+		misses -= histogram.buckets[k];
+		curve.push_back(misses / histogram.accesses);
+
+		bool rest_empty = true;
+		for(size_t j = k + 1; j < kBuckets; ++j) rest_empty &= histogram.buckets[j] == 0;
+		if(rest_empty) break;
+	}
+	return curve;
+}
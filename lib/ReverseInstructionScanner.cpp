@@ -0,0 +1,74 @@
+#include "libtrace/ReverseInstructionScanner.h"
+#include "libtrace/RecordTypes.h"
+
+#include <algorithm>
+#include <cassert>
+
+using namespace libtrace;
+
+namespace {
+	// how far back to look for the bundle header before an instruction
+	const size_t kPacketScanRecords = 64;
+
+	TraceRecordType GetType(const Record &record)
+	{
+		return (TraceRecordType)(record.GetHeader() >> 24);
+	}
+}
+
+ReverseInstructionScanner::ReverseInstructionScanner(const RecordBlockReader& reader, size_t block_records) : reader_(reader), buffer_(block_records), scanned_records_(0)
+{
+	assert(block_records > 0);
+}
+
+uint64_t ReverseInstructionScanner::FindLast(uint64_t count, uint64_t& record_idx)
+{
+	uint64_t end = reader_.Size();
+	uint64_t found = 0;
+	record_idx = end;
+	if(count == 0) return 0;
+
+	while(end > 0) {
+		uint64_t first = end > buffer_.size() ? end - buffer_.size() : 0;
+		size_t n = reader_.Read(first, buffer_.data(), end - first);
+		scanned_records_ += n;
+		if(n != end - first) break;
+
+		for(size_t i = n; i > 0; --i) {
+			if(GetType(buffer_[i-1]) != InstructionHeader) continue;
+
+			record_idx = first + i - 1;
+			if(++found == count) {
+				record_idx = GetPacketStart(reader_, record_idx);
+				return found;
+			}
+		}
+		end = first;
+	}
+
+	// the trace is shorter than requested, so everything from the first
+	// instruction is wanted
+	if(found) record_idx = GetPacketStart(reader_, record_idx);
+	return found;
+}
+
+bool ReverseInstructionScanner::FindInstruction(uint64_t insn, uint64_t instruction_count, uint64_t& record_idx)
+{
+	if(insn >= instruction_count) return false;
+	return FindLast(instruction_count - insn, record_idx) == instruction_count - insn;
+}
+
+uint64_t ReverseInstructionScanner::GetPacketStart(const RecordBlockReader& reader, uint64_t header_idx)
+{
+	if(header_idx == 0) return 0;
+
+	// the records just before the header, which may be a bundle header and
+	// its extensions
+	Record window[kPacketScanRecords];
+	uint64_t first = header_idx > kPacketScanRecords ? header_idx - kPacketScanRecords : 0;
+	size_t n = reader.Read(first, window, header_idx - first);
+
+	while(n > 0 && GetType(window[n-1]) == DataExtension) n--;
+	if(n > 0 && GetType(window[n-1]) == InstructionBundleHeader) return first + n - 1;
+	return header_idx;
+}
@@ -0,0 +1,318 @@
+#include "libtrace/SegmentedTrace.h"
+#include "libtrace/TraceSource.h"
+
+#include <algorithm>
+#include <cstdlib>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+namespace {
+	const char *kManifestHeader = "# libtrace segment manifest\n";
+	const size_t kScanRecords = 1 << 16;
+
+	std::string GetBaseName(const std::string &path)
+	{
+		size_t slash = path.rfind('/');
+		return slash == std::string::npos ? path : path.substr(slash + 1);
+	}
+
+	std::string GetDirectory(const std::string &path)
+	{
+		size_t slash = path.rfind('/');
+		return slash == std::string::npos ? "" : path.substr(0, slash + 1);
+	}
+}
+
+std::string TraceManifest::GetManifestPath(const std::string& prefix)
+{
+	return prefix + ".manifest";
+}
+
+std::string TraceManifest::GetSegmentPath(const std::string& prefix, size_t segment)
+{
+	char suffix[32];
+	snprintf(suffix, sizeof(suffix), ".%04lu", segment);
+	return prefix + suffix;
+}
+
+bool TraceManifest::Load(const std::string& path)
+{
+	FILE *f = fopen(path.c_str(), "r");
+	if(!f) return false;
+
+	std::vector<TraceSegment> segments;
+	char line[4096], name[4096];
+	bool valid = true;
+
+	while(fgets(line, sizeof(line), f)) {
+		if(line[0] == '#' || line[0] == '\n') continue;
+
+		TraceSegment segment;
+		if(sscanf(line, "%4095s %lu %lu %lu %lu", name, &segment.first_record, &segment.records, &segment.first_instruction, &segment.instructions) != 5) {
+			valid = false;
+			break;
+		}
+		segment.path = name;
+		segments.push_back(segment);
+	}
+	fclose(f);
+
+	if(!valid) return false;
+	segments_.swap(segments);
+	return true;
+}
+
+bool TraceManifest::Save(const std::string& path) const
+{
+	std::string temp = path + ".tmp";
+	FILE *f = fopen(temp.c_str(), "w");
+	if(!f) return false;
+
+	bool ok = fputs(kManifestHeader, f) >= 0;
+	for(const auto &segment : segments_) {
+		ok = ok && fprintf(f, "%s %lu %lu %lu %lu\n", segment.path.c_str(), segment.first_record, segment.records, segment.first_instruction, segment.instructions) > 0;
+	}
+	ok = (fclose(f) == 0) && ok;
+
+	if(!ok || rename(temp.c_str(), path.c_str())) {
+		remove(temp.c_str());
+		return false;
+	}
+	return true;
+}
+
+uint64_t TraceManifest::GetRecordCount() const
+{
+	if(segments_.empty()) return 0;
+	return segments_.back().first_record + segments_.back().records;
+}
+
+uint64_t TraceManifest::GetInstructionCount() const
+{
+	if(segments_.empty()) return 0;
+	return segments_.back().first_instruction + segments_.back().instructions;
+}
+
+size_t TraceManifest::FindRecord(uint64_t record_idx) const
+{
+	if(record_idx >= GetRecordCount()) return segments_.size();
+
+	// the last segment starting at or before the record
+	auto it = std::upper_bound(segments_.begin(), segments_.end(), record_idx, [](uint64_t idx, const TraceSegment &segment) { return idx < segment.first_record; });
+	return (it - segments_.begin()) - 1;
+}
+
+size_t TraceManifest::FindInstruction(uint64_t insn) const
+{
+	if(insn >= GetInstructionCount()) return segments_.size();
+
+	auto it = std::upper_bound(segments_.begin(), segments_.end(), insn, [](uint64_t idx, const TraceSegment &segment) { return idx < segment.first_instruction; });
+	size_t segment = (it - segments_.begin()) - 1;
+
+	// segments without instructions share their first instruction with the
+	// next segment
+	while(segments_[segment].instructions == 0) segment++;
+	return segment;
+}
+
+SegmentedFileTraceSink::SegmentedFileTraceSink(const std::string& prefix, uint64_t max_records, uint64_t max_instructions) : TraceSink(), prefix_(prefix), max_records_(max_records), max_instructions_(max_instructions), file_(nullptr)
+{
+	TraceSegment segment { GetBaseName(TraceManifest::GetSegmentPath(prefix_, 0)), 0, 0, 0, 0 };
+	manifest_.GetSegments().push_back(segment);
+	OpenSegment();
+}
+
+SegmentedFileTraceSink::~SegmentedFileTraceSink()
+{
+	Flush();
+	fclose(file_);
+}
+
+void SegmentedFileTraceSink::OpenSegment()
+{
+	std::string path = TraceManifest::GetSegmentPath(prefix_, manifest_.GetSegmentCount() - 1);
+	file_ = fopen(path.c_str(), "w");
+	if(!file_) {
+		perror(path.c_str());
+		abort();
+	}
+
+	if(!manifest_.Save(TraceManifest::GetManifestPath(prefix_))) {
+		perror("Could not write manifest");
+		abort();
+	}
+}
+
+void SegmentedFileTraceSink::Roll()
+{
+	WriteBuffer();
+	fclose(file_);
+
+	const TraceSegment &last = manifest_.GetSegments().back();
+	size_t index = manifest_.GetSegmentCount();
+	TraceSegment segment { GetBaseName(TraceManifest::GetSegmentPath(prefix_, index)), last.first_record + last.records, 0, last.first_instruction + last.instructions, 0 };
+	manifest_.GetSegments().push_back(segment);
+
+	OpenSegment();
+}
+
+void SegmentedFileTraceSink::Buffer(const TraceRecord* start, const TraceRecord* end)
+{
+	records_.insert(records_.end(), start, end);
+	manifest_.GetSegments().back().records += end - start;
+
+	if(records_.size() >= TraceSource::RecordBufferSize) WriteBuffer();
+}
+
+void SegmentedFileTraceSink::WriteBuffer()
+{
+	if(fwrite(records_.data(), sizeof(TraceRecord), records_.size(), file_) != records_.size()) {
+		perror("Could not write segment");
+		abort();
+	}
+	records_.clear();
+}
+
+void SegmentedFileTraceSink::SinkPackets(const TraceRecord* start, const TraceRecord* end)
+{
+	// packets may end part way through an instruction, so segments are
+	// split at the headers themselves
+	const TraceRecord *run = start;
+	for(const TraceRecord *record = start; record != end; ++record) {
+		if(record->GetType() != InstructionHeader) continue;
+
+		TraceSegment &segment = manifest_.GetSegments().back();
+		uint64_t records = segment.records + (record - run);
+		bool full = (max_records_ && records >= max_records_) || (max_instructions_ && segment.instructions >= max_instructions_);
+		if(full && segment.instructions) {
+			Buffer(run, record);
+			run = record;
+			Roll();
+		}
+		manifest_.GetSegments().back().instructions++;
+	}
+	Buffer(run, end);
+}
+
+void SegmentedFileTraceSink::Flush()
+{
+	// the data must reach the file before the manifest says it is there
+	WriteBuffer();
+	fflush(file_);
+	manifest_.Save(TraceManifest::GetManifestPath(prefix_));
+}
+
+SegmentedTraceReader::SegmentedTraceReader() : record_count_(0), page_(kPageRecords), page_base_(0), page_count_(0)
+{
+
+}
+
+SegmentedTraceReader::~SegmentedTraceReader()
+{
+	Close();
+}
+
+void SegmentedTraceReader::Close()
+{
+	for(int fd : fds_) close(fd);
+	fds_.clear();
+	readers_.clear();
+	record_count_ = 0;
+	page_count_ = 0;
+}
+
+bool SegmentedTraceReader::Open(const std::string& manifest_path)
+{
+	Close();
+	manifest_path_ = manifest_path;
+	directory_ = GetDirectory(manifest_path);
+	return Refresh();
+}
+
+std::string SegmentedTraceReader::GetSegmentPath(size_t segment) const
+{
+	return directory_ + manifest_.GetSegments().at(segment).path;
+}
+
+bool SegmentedTraceReader::Refresh()
+{
+	TraceManifest manifest;
+	if(!manifest.Load(manifest_path_)) return false;
+
+	// segments are only ever added, and only the last can grow
+	for(size_t i = fds_.size(); i < manifest.GetSegmentCount(); ++i) {
+		std::string path = directory_ + manifest.GetSegments()[i].path;
+		int fd = open(path.c_str(), O_RDONLY);
+		if(fd < 0) return false;
+
+		fds_.push_back(fd);
+		readers_.push_back(RecordBlockReader(fd));
+	}
+	for(auto &reader : readers_) reader.Refresh();
+
+	manifest_ = manifest;
+	record_count_ = manifest_.GetRecordCount();
+	page_count_ = 0;
+	return true;
+}
+
+size_t SegmentedTraceReader::Read(uint64_t first, Record* buffer, size_t count) const
+{
+	size_t read = 0;
+
+	while(read < count && first < record_count_) {
+		size_t index = manifest_.FindRecord(first);
+		const TraceSegment &segment = manifest_.GetSegments()[index];
+
+		uint64_t local = first - segment.first_record;
+		size_t want = std::min<uint64_t>(count - read, segment.records - local);
+		size_t got = readers_[index].Read(local, buffer + read, want);
+
+		read += got;
+		first += got;
+		if(got < want) break;
+	}
+
+	return read;
+}
+
+Record SegmentedTraceReader::Get(size_t i)
+{
+	if(i < page_base_ || i >= page_base_ + page_count_) {
+		page_base_ = i & ~(uint64_t)(kPageRecords - 1);
+		page_count_ = Read(page_base_, page_.data(), page_.size());
+
+		// past the end, perhaps because a segment shrank since Size
+		if(i >= page_base_ + page_count_) return TraceRecord();
+	}
+	return page_[i - page_base_];
+}
+
+bool SegmentedTraceReader::GetInstructionRecord(uint64_t insn, uint64_t& record_idx) const
+{
+	size_t index = manifest_.FindInstruction(insn);
+	if(index == manifest_.GetSegmentCount()) return false;
+
+	// count headers forwards from the start of the segment
+	const TraceSegment &segment = manifest_.GetSegments()[index];
+	uint64_t remaining = insn - segment.first_instruction;
+	std::vector<Record> buffer (kScanRecords);
+
+	for(uint64_t pos = 0; pos < segment.records; ) {
+		size_t n = readers_[index].Read(pos, buffer.data(), std::min<uint64_t>(kScanRecords, segment.records - pos));
+		if(n == 0) return false;
+
+		for(size_t i = 0; i < n; ++i) {
+			if((buffer[i].GetHeader() >> 24) != InstructionHeader) continue;
+			if(remaining-- == 0) {
+				record_idx = segment.first_record + pos + i;
+				return true;
+			}
+		}
+		pos += n;
+	}
+	return false;
+}
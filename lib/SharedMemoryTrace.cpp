@@ -0,0 +1,355 @@
+#include "libtrace/SharedMemoryTrace.h"
+
+#include <algorithm>
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <new>
+#include <thread>
+
+#include <fcntl.h>
+#include <signal.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace libtrace {
+
+	struct SharedTraceReaderSlot {
+		alignas(64) std::atomic<uint32_t> state;
+		std::atomic<int32_t> pid;
+		std::atomic<uint64_t> position;	// everything before this has been read
+	};
+
+	// The control block at the start of the shared memory. The producer's
+	// and each reader's positions are kept on separate cache lines.
+	struct SharedTraceHeader {
+		std::atomic<uint64_t> magic;	// written last, once the rest is set up
+		uint64_t capacity;
+		uint64_t ring_offset;
+		std::atomic<uint32_t> closed;
+		std::atomic<uint32_t> blocking;
+		std::atomic<int32_t> producer_pid;
+
+		// records [0, write_position) have been published, and records
+		// before reserve_position may be being overwritten
+		alignas(64) std::atomic<uint64_t> write_position;
+		std::atomic<uint64_t> reserve_position;
+
+		SharedTraceReaderSlot readers[SharedMemoryTraceSink::kMaxReaders];
+	};
+
+}
+
+using namespace libtrace;
+
+namespace {
+	const uint64_t kSharedTraceMagic = 0x3230524853544c00ULL; // "\0LTSHR02"
+	const size_t kPageSize = 4096;
+	const size_t kBatchRecords = 4096;
+
+	enum SlotState {
+		Slot_Free,
+		Slot_Claimed,
+		Slot_Active
+	};
+
+	std::string GetShmName(const std::string &name)
+	{
+		return name.size() && name[0] == '/' ? name : "/" + name;
+	}
+
+	void Backoff(unsigned &spins)
+	{
+		if(++spins < 64) std::this_thread::yield();
+		else usleep(50);
+	}
+
+	// Claim a free reader slot. Returns kMaxReaders if there are none.
+	size_t ClaimSlot(SharedTraceHeader *header)
+	{
+		for(size_t i = 0; i < SharedMemoryTraceSink::kMaxReaders; ++i) {
+			uint32_t free = Slot_Free;
+			if(header->readers[i].state.compare_exchange_strong(free, Slot_Claimed)) return i;
+		}
+		return SharedMemoryTraceSink::kMaxReaders;
+	}
+
+	bool ProcessExited(int32_t pid)
+	{
+		return kill(pid, 0) != 0 && errno == ESRCH;
+	}
+
+	// Free the slots of readers which died without detaching. Returns
+	// whether any were freed.
+	bool ReclaimDeadReaders(SharedTraceHeader *header)
+	{
+		bool reclaimed = false;
+		for(auto &slot : header->readers) {
+			if(slot.state.load() != Slot_Active || !ProcessExited(slot.pid.load())) continue;
+
+			uint32_t active = Slot_Active;
+			reclaimed |= slot.state.compare_exchange_strong(active, Slot_Free);
+		}
+		return reclaimed;
+	}
+}
+
+SharedMemoryTraceSink::SharedMemoryTraceSink(const std::string& name, size_t capacity, bool blocking) : TraceSink(), name_(GetShmName(name)), write_position_(0), blocking_(blocking)
+{
+	uint64_t records = kPageSize / sizeof(Record);
+	while(records < capacity) records <<= 1;
+	mask_ = records - 1;
+
+	size_t ring_offset = (sizeof(SharedTraceHeader) + kPageSize - 1) & ~(kPageSize - 1);
+	mapping_size_ = ring_offset + records * sizeof(Record);
+
+	// a segment left behind by an earlier run is cleared
+	int fd = shm_open(name_.c_str(), O_CREAT | O_RDWR, 0600);
+	if(fd < 0 || ftruncate(fd, 0) || ftruncate(fd, mapping_size_)) {
+		perror(name_.c_str());
+		abort();
+	}
+
+	void *mapping = mmap(nullptr, mapping_size_, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) {
+		perror(name_.c_str());
+		abort();
+	}
+
+	header_ = new (mapping) SharedTraceHeader();
+	ring_ = (Record*)((char*)mapping + ring_offset);
+	header_->capacity = records;
+	header_->ring_offset = ring_offset;
+	header_->closed = 0;
+	header_->blocking = blocking;
+	header_->producer_pid = getpid();
+	header_->write_position = 0;
+	header_->reserve_position = 0;
+	for(auto &slot : header_->readers) slot.state = Slot_Free;
+	header_->magic.store(kSharedTraceMagic, std::memory_order_release);
+}
+
+SharedMemoryTraceSink::~SharedMemoryTraceSink()
+{
+	header_->closed.store(1, std::memory_order_release);
+	shm_unlink(name_.c_str());
+	munmap(header_, mapping_size_);
+}
+
+void SharedMemoryTraceSink::WaitForReaders(uint64_t end)
+{
+	unsigned spins = 0;
+	while(true) {
+		uint64_t slowest = end;
+		for(auto &slot : header_->readers) {
+			if(slot.state.load(std::memory_order_acquire) == Slot_Active) slowest = std::min(slowest, slot.position.load(std::memory_order_acquire));
+		}
+		if(end - slowest <= mask_ + 1) return;
+
+		Backoff(spins);
+
+		// a reader which died without detaching would block us forever
+		if((spins % 1024) == 0) ReclaimDeadReaders(header_);
+	}
+}
+
+void SharedMemoryTraceSink::Publish(const TraceRecord* start, size_t count)
+{
+	uint64_t end = write_position_ + count;
+	if(blocking_) WaitForReaders(end);
+
+	// readers check the reservation after copying, to detect records which
+	// were overwritten under them
+	header_->reserve_position.store(end, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+
+	size_t first = write_position_ & mask_;
+	size_t before_wrap = std::min<size_t>(count, mask_ + 1 - first);
+	std::copy(start, start + before_wrap, ring_ + first);
+	std::copy(start + before_wrap, start + count, ring_);
+
+	header_->write_position.store(end, std::memory_order_release);
+	write_position_ = end;
+}
+
+void SharedMemoryTraceSink::SinkPackets(const TraceRecord* start, const TraceRecord* end)
+{
+	// publish in pieces, so that readers can make progress through a large
+	// packet buffer
+	size_t piece = (mask_ + 1) / 4;
+	while(start != end) {
+		size_t count = std::min<size_t>(piece, end - start);
+		Publish(start, count);
+		start += count;
+	}
+}
+
+void SharedMemoryTraceSink::Flush()
+{
+
+}
+
+SharedMemoryTraceReader::SharedMemoryTraceReader() : header_(nullptr), ring_(nullptr), mapping_size_(0), mask_(0), slot_(0), batch_(kBatchRecords), batch_position_(0), batch_size_(0), read_position_(0), lost_(0), resync_(true)
+{
+
+}
+
+SharedMemoryTraceReader::~SharedMemoryTraceReader()
+{
+	Detach();
+}
+
+bool SharedMemoryTraceReader::Attach(const std::string& name)
+{
+	Detach();
+
+	std::string shm_name = GetShmName(name);
+	int fd = shm_open(shm_name.c_str(), O_RDWR, 0);
+	if(fd < 0) return false;
+
+	struct stat st;
+	if(fstat(fd, &st) || (size_t)st.st_size < sizeof(SharedTraceHeader)) {
+		close(fd);
+		return false;
+	}
+
+	void *mapping = mmap(nullptr, st.st_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+	close(fd);
+	if(mapping == MAP_FAILED) return false;
+
+	SharedTraceHeader *header = (SharedTraceHeader*)mapping;
+	if(header->magic.load(std::memory_order_acquire) != kSharedTraceMagic || header->ring_offset + header->capacity * sizeof(Record) > (size_t)st.st_size) {
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	// without a blocking producer nothing else frees the slots of readers
+	// which died, so they are reclaimed here when every slot is taken
+	size_t i = ClaimSlot(header);
+	if(i == SharedMemoryTraceSink::kMaxReaders && ReclaimDeadReaders(header)) i = ClaimSlot(header);
+	if(i == SharedMemoryTraceSink::kMaxReaders) {
+		munmap(mapping, st.st_size);
+		return false;
+	}
+
+	SharedTraceReaderSlot &slot = header->readers[i];
+	header_ = header;
+	ring_ = (const Record*)((char*)mapping + header->ring_offset);
+	mapping_size_ = st.st_size;
+	mask_ = header->capacity - 1;
+	slot_ = i;
+
+	read_position_ = header->write_position.load(std::memory_order_acquire);
+	batch_position_ = batch_size_ = 0;
+	lost_ = 0;
+	resync_ = true;
+
+	slot.pid = getpid();
+	slot.position = read_position_;
+	slot.state.store(Slot_Active, std::memory_order_release);
+	return true;
+}
+
+void SharedMemoryTraceReader::Detach()
+{
+	if(!header_) return;
+
+	header_->readers[slot_].state.store(Slot_Free, std::memory_order_release);
+	munmap(header_, mapping_size_);
+	header_ = nullptr;
+	ring_ = nullptr;
+	batch_position_ = batch_size_ = 0;
+}
+
+bool SharedMemoryTraceReader::Fill()
+{
+	if(!header_) return false;
+
+	const uint64_t capacity = mask_ + 1;
+	unsigned spins = 0;
+
+	while(true) {
+		uint64_t available = header_->write_position.load(std::memory_order_acquire);
+
+		if(available == read_position_) {
+			// A producer which crashed never closes the trace, so it is
+			// treated as closed once the producer has gone. It may have
+			// published more before closing.
+			bool closed = header_->closed.load(std::memory_order_acquire) || ((spins % 1024) == 1023 && ProcessExited(header_->producer_pid.load()));
+			if(closed && header_->write_position.load(std::memory_order_acquire) == read_position_) return false;
+			Backoff(spins);
+			continue;
+		}
+		spins = 0;
+
+		// too far behind: skip to half a ring behind the producer, which
+		// leaves some room before it catches up again
+		if(available - read_position_ > capacity) {
+			uint64_t target = available - capacity / 2;
+			lost_ += target - read_position_;
+			read_position_ = target;
+			resync_ = true;
+		}
+
+		size_t count = std::min<uint64_t>(batch_.size(), available - read_position_);
+		size_t first = read_position_ & mask_;
+		size_t before_wrap = std::min<size_t>(count, capacity - first);
+		memcpy(batch_.data(), ring_ + first, before_wrap * sizeof(Record));
+		memcpy(batch_.data() + before_wrap, ring_, (count - before_wrap) * sizeof(Record));
+
+		std::atomic_thread_fence(std::memory_order_acquire);
+		uint64_t reserved = header_->reserve_position.load(std::memory_order_relaxed);
+		if(reserved - read_position_ > capacity) {
+			// overwritten while it was being copied
+			uint64_t target = reserved - capacity / 2;
+			lost_ += target - read_position_;
+			read_position_ = target;
+			resync_ = true;
+			continue;
+		}
+
+		read_position_ += count;
+		header_->readers[slot_].position.store(read_position_, std::memory_order_release);
+
+		batch_position_ = 0;
+		batch_size_ = count;
+
+		// start from an instruction header, so that the stream can be
+		// decoded into packets
+		if(resync_) {
+			while(batch_position_ < batch_size_ && (batch_[batch_position_].GetHeader() >> 24) != InstructionHeader) batch_position_++;
+			if(batch_position_ == batch_size_) continue;
+			resync_ = false;
+		}
+		return true;
+	}
+}
+
+Record SharedMemoryTraceReader::Get()
+{
+	if(batch_position_ == batch_size_ && !Fill()) return Record();
+	return batch_[batch_position_++];
+}
+
+Record SharedMemoryTraceReader::Peek()
+{
+	if(batch_position_ == batch_size_ && !Fill()) return Record();
+	return batch_[batch_position_];
+}
+
+bool SharedMemoryTraceReader::Good()
+{
+	return batch_position_ < batch_size_ || Fill();
+}
+
+void SharedMemoryTraceReader::Skip(size_t i)
+{
+	while(i && Good()) {
+		size_t count = std::min(i, batch_size_ - batch_position_);
+		batch_position_ += count;
+		i -= count;
+	}
+}
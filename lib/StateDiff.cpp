@@ -0,0 +1,260 @@
+#include "libtrace/StateDiff.h"
+
+#include <algorithm>
+#include <cstdlib>
+#include <sstream>
+
+using namespace libtrace;
+
+namespace {
+	const char *kClassNames[] = { "pc", "code", "reg", "memread", "memwrite" };
+
+	bool ParseValue(const std::string &str, uint64_t &value)
+	{
+		if(str.empty()) return false;
+		char *end;
+		value = strtoull(str.c_str(), &end, 0);
+		return *end == 0;
+	}
+
+	bool ParseClasses(const std::string &str, uint32_t &classes)
+	{
+		classes = 0;
+		std::istringstream stream (str);
+		std::string name;
+		while(std::getline(stream, name, ',')) {
+			if(name == "all") {
+				classes = (1 << Divergence_ClassCount) - 1;
+				continue;
+			}
+
+			int c = 0;
+			while(c < Divergence_ClassCount && name != kClassNames[c]) c++;
+			if(c == Divergence_ClassCount) return false;
+			classes |= 1 << c;
+		}
+		return classes != 0;
+	}
+}
+
+const char* libtrace::GetDivergenceClassName(DivergenceClass c)
+{
+	return kClassNames[c];
+}
+
+void StateDiffRules::RuleTable::Add(uint64_t value, uint64_t mask, uint32_t classes)
+{
+	for(auto &group : groups_) {
+		if(group.first == mask) {
+			group.second[value & mask] |= classes;
+			return;
+		}
+	}
+	groups_.push_back({mask, {{value & mask, classes}}});
+}
+
+uint32_t StateDiffRules::RuleTable::Lookup(uint64_t value) const
+{
+	uint32_t classes = 0;
+	for(const auto &group : groups_) {
+		auto it = group.second.find(value & group.first);
+		if(it != group.second.end()) classes |= it->second;
+	}
+	return classes;
+}
+
+bool StateDiffRules::AddRule(const std::string& rule, std::string& error)
+{
+	std::istringstream stream (rule);
+	std::string field, match, class_list = "all", trailing;
+	stream >> field >> match >> class_list >> trailing;
+
+	if(field.empty() || match.empty() || !trailing.empty()) {
+		error = "Expected '<field> <value>[/<mask>] [<classes>]': " + rule;
+		return false;
+	}
+
+	uint64_t value, mask = ~0ULL;
+	size_t slash = match.find('/');
+	if(!ParseValue(match.substr(0, slash), value) || (slash != std::string::npos && !ParseValue(match.substr(slash+1), mask))) {
+		error = "Could not parse value: " + match;
+		return false;
+	}
+
+	uint32_t classes;
+	if(!ParseClasses(class_list, classes)) {
+		error = "Unknown divergence class: " + class_list;
+		return false;
+	}
+
+	if(field == "pc") pc_rules_.Add(value, mask, classes);
+	else if(field == "code") code_rules_.Add(value, mask, classes);
+	else if(field == "reg") reg_rules_.Add(value, mask, classes);
+	else if(field == "addr") addr_rules_.Add(value, mask, classes);
+	else {
+		error = "Unknown field: " + field;
+		return false;
+	}
+	return true;
+}
+
+bool StateDiffRules::LoadRules(FILE* f, std::string& error)
+{
+	char line[256];
+	while(fgets(line, sizeof(line), f)) {
+		std::string rule (line);
+		rule = rule.substr(0, rule.find('#'));
+		if(rule.find_first_not_of(" \t\r\n") == std::string::npos) continue;
+
+		if(!AddRule(rule, error)) return false;
+	}
+	return true;
+}
+
+StateDiff::StateDiff(const StateDiffRules& rules) : rules_(rules)
+{
+
+}
+
+void StateDiff::CollectRegisters(const InstructionStateBatch& batch, const InstructionState& insn, std::vector<RegAccess>& out)
+{
+	out.assign(batch.RegWritesBegin(insn), batch.RegWritesEnd(insn));
+	std::stable_sort(out.begin(), out.end(), [](const RegAccess &a, const RegAccess &b) { return a.index < b.index; });
+
+	// only the final value written to each register matters
+	size_t n = 0;
+	for(size_t i = 0; i < out.size(); ++i) {
+		if(n && out[n-1].index == out[i].index) out[n-1] = out[i];
+		else out[n++] = out[i];
+	}
+	out.resize(n);
+}
+
+void StateDiff::CollectBytes(const MemAccess* begin, const MemAccess* end, bool keep_last, std::vector<ByteAccess>& out)
+{
+	out.clear();
+	for(auto access = begin; access != end; ++access) {
+		for(uint32_t i = 0; i < access->width && i < 8; ++i) {
+			out.push_back(ByteAccess {access->address + i, (uint8_t)(access->data >> (i*8))});
+		}
+	}
+	std::stable_sort(out.begin(), out.end(), [](const ByteAccess &a, const ByteAccess &b) { return a.address < b.address; });
+
+	// reads keep the first value seen at each address, writes the last
+	size_t n = 0;
+	for(size_t i = 0; i < out.size(); ++i) {
+		if(n && out[n-1].address == out[i].address) {
+			if(keep_last) out[n-1] = out[i];
+		} else {
+			out[n++] = out[i];
+		}
+	}
+	out.resize(n);
+}
+
+static bool SameAccesses(const RegAccess *a, const RegAccess *a_end, const RegAccess *b, const RegAccess *b_end)
+{
+	if(a_end - a != b_end - b) return false;
+	for(; a != a_end; ++a, ++b) {
+		if(a->index != b->index || a->value != b->value) return false;
+	}
+	return true;
+}
+
+static bool SameAccesses(const MemAccess *a, const MemAccess *a_end, const MemAccess *b, const MemAccess *b_end)
+{
+	if(a_end - a != b_end - b) return false;
+	for(; a != a_end; ++a, ++b) {
+		if(a->address != b->address || a->data != b->data || a->width != b->width) return false;
+	}
+	return true;
+}
+
+bool StateDiff::Compare(const InstructionStateBatch& b1, size_t i1, const InstructionStateBatch& b2, size_t i2, const reporter_t& reporter)
+{
+	const InstructionState &insn1 = b1.instructions[i1];
+	const InstructionState &insn2 = b2.instructions[i2];
+
+	Divergence divergence;
+	divergence.instruction1 = &insn1;
+	divergence.instruction2 = &insn2;
+	divergence.instruction_idx1 = b1.first_instruction + i1;
+	divergence.instruction_idx2 = b2.first_instruction + i2;
+
+	auto report = [&](DivergenceClass c, uint64_t key, uint64_t value1, uint64_t value2, bool present1, bool present2) {
+		divergence.divergence_class = c;
+		divergence.key = key;
+		divergence.value1 = value1;
+		divergence.value2 = value2;
+		divergence.present1 = present1;
+		divergence.present2 = present2;
+		reporter(divergence);
+	};
+
+	uint32_t ignored = rules_.GetIgnoredClasses(insn1.pc, insn1.code);
+
+	if(insn1.pc != insn2.pc && !(ignored & (1 << Divergence_PC))) {
+		report(Divergence_PC, 0, insn1.pc, insn2.pc, true, true);
+		return false;
+	}
+
+	if(insn1.code != insn2.code && !(ignored & (1 << Divergence_Code))) {
+		report(Divergence_Code, 0, insn1.code, insn2.code, true, true);
+	}
+
+	// Most instructions match exactly, so only sort the accesses into a
+	// canonical order when the raw access lists differ.
+	if(!(ignored & (1 << Divergence_RegWrite)) && !SameAccesses(b1.RegWritesBegin(insn1), b1.RegWritesEnd(insn1), b2.RegWritesBegin(insn2), b2.RegWritesEnd(insn2))) {
+		CollectRegisters(b1, insn1, regs1_);
+		CollectRegisters(b2, insn2, regs2_);
+
+		auto a = regs1_.begin(), b = regs2_.begin();
+		while(a != regs1_.end() || b != regs2_.end()) {
+			if(b == regs2_.end() || (a != regs1_.end() && a->index < b->index)) {
+				if(!rules_.IsRegisterIgnored(a->index)) report(Divergence_RegWrite, a->index, a->value, 0, true, false);
+				++a;
+			} else if(a == regs1_.end() || b->index < a->index) {
+				if(!rules_.IsRegisterIgnored(b->index)) report(Divergence_RegWrite, b->index, 0, b->value, false, true);
+				++b;
+			} else {
+				if(a->value != b->value && !rules_.IsRegisterIgnored(a->index)) report(Divergence_RegWrite, a->index, a->value, b->value, true, true);
+				++a;
+				++b;
+			}
+		}
+	}
+
+	for(DivergenceClass c : { Divergence_MemRead, Divergence_MemWrite }) {
+		if(ignored & (1 << c)) continue;
+
+		bool reads = c == Divergence_MemRead;
+		const MemAccess *begin1 = reads ? b1.MemReadsBegin(insn1) : b1.MemWritesBegin(insn1);
+		const MemAccess *end1 = reads ? b1.MemReadsEnd(insn1) : b1.MemWritesEnd(insn1);
+		const MemAccess *begin2 = reads ? b2.MemReadsBegin(insn2) : b2.MemWritesBegin(insn2);
+		const MemAccess *end2 = reads ? b2.MemReadsEnd(insn2) : b2.MemWritesEnd(insn2);
+
+		if(SameAccesses(begin1, end1, begin2, end2)) continue;
+
+		// compare byte by byte, so that accesses split differently into
+		// different widths still match
+		CollectBytes(begin1, end1, !reads, bytes1_);
+		CollectBytes(begin2, end2, !reads, bytes2_);
+
+		auto a = bytes1_.begin(), b = bytes2_.begin();
+		while(a != bytes1_.end() || b != bytes2_.end()) {
+			if(b == bytes2_.end() || (a != bytes1_.end() && a->address < b->address)) {
+				if(!rules_.IsAddressIgnored(a->address, c)) report(c, a->address, a->value, 0, true, false);
+				++a;
+			} else if(a == bytes1_.end() || b->address < a->address) {
+				if(!rules_.IsAddressIgnored(b->address, c)) report(c, b->address, 0, b->value, false, true);
+				++b;
+			} else {
+				if(a->value != b->value && !rules_.IsAddressIgnored(a->address, c)) report(c, a->address, a->value, b->value, true, true);
+				++a;
+				++b;
+			}
+		}
+	}
+
+	return true;
+}
@@ -0,0 +1,199 @@
+#include "libtrace/TraceAligner.h"
+
+#include <algorithm>
+#include <cassert>
+#include <cstdint>
+#include <cstring>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kLockstepChunk = 4096;
+
+	// the first look ahead after a divergence, which is doubled until an
+	// anchor is found or it reaches the window size
+	const size_t kInitialSearch = 256;
+	const uint64_t kHashMultiplier = 0x9e3779b97f4a7c15ULL;
+}
+
+TraceAligner::Window::Window(PCStreamReader& stream, uint64_t start, size_t capacity) : stream_(stream), data_(capacity), head_(0), tail_(0), base_(start), ended_(false)
+{
+
+}
+
+size_t TraceAligner::Window::Fill(size_t count)
+{
+	assert(count <= data_.size());
+	if(Available() >= count || ended_) return Available();
+
+	if(head_ + count > data_.size()) {
+		memmove(data_.data(), data_.data() + head_, Available() * sizeof(uint64_t));
+		tail_ -= head_;
+		head_ = 0;
+	}
+
+	size_t want = data_.size() - tail_;
+	size_t read = stream_.Read(data_.data() + tail_, want);
+	tail_ += read;
+	ended_ = read < want;
+
+	return Available();
+}
+
+TraceAligner::TraceAligner(size_t window, size_t anchor_length) : window_(window), anchor_length_(anchor_length)
+{
+	assert(anchor_length_ > 0 && window_ > 0);
+}
+
+bool TraceAligner::FindAnchor(const Window& w1, const Window& w2, size_t limit, size_t& best_i, size_t& best_j)
+{
+	const size_t n1 = w1.Available(), n2 = w2.Available();
+	if(n1 < anchor_length_ || n2 < anchor_length_) return false;
+
+	const size_t limit1 = std::min(n1 - anchor_length_ + 1, limit);
+	const size_t limit2 = std::min(n2 - anchor_length_ + 1, limit);
+	const uint64_t *pcs1 = w1.Data(), *pcs2 = w2.Data();
+
+	// multiplier^anchor_length, to remove the oldest PC from a rolling hash
+	uint64_t outgoing = 1;
+	for(size_t k = 0; k < anchor_length_; ++k) outgoing *= kHashMultiplier;
+
+	// Hash every anchor-length run in the second window into an open
+	// addressing table sized for this search, keeping the first position at
+	// which each hash occurs. Only the part of the table in use is reset, so
+	// a small search stays cheap after a large one.
+	size_t table_size = 1;
+	while(table_size < limit2 * 2) table_size <<= 1;
+	const size_t table_mask = table_size - 1;
+	if(anchor_hashes_.size() < table_size) {
+		anchor_hashes_.resize(table_size);
+		anchor_positions_.resize(table_size);
+	}
+	std::fill(anchor_positions_.begin(), anchor_positions_.begin() + table_size, SIZE_MAX);
+
+	uint64_t hash = 0;
+	for(size_t k = 0; k < anchor_length_; ++k) hash = hash * kHashMultiplier + pcs2[k];
+	for(size_t j = 0; j < limit2; ++j) {
+		size_t slot = (hash >> 17) & table_mask;
+		while(anchor_positions_[slot] != SIZE_MAX && anchor_hashes_[slot] != hash) slot = (slot + 1) & table_mask;
+		if(anchor_positions_[slot] == SIZE_MAX) {
+			anchor_hashes_[slot] = hash;
+			anchor_positions_[slot] = j;
+		}
+		if(j + 1 < limit2) hash = hash * kHashMultiplier + pcs2[j + anchor_length_] - pcs2[j] * outgoing;
+	}
+
+	// then look for the run in the first window which minimises i + j
+	size_t best = SIZE_MAX;
+	hash = 0;
+	for(size_t k = 0; k < anchor_length_; ++k) hash = hash * kHashMultiplier + pcs1[k];
+	for(size_t i = 0; i < limit1 && i < best; ++i) {
+		size_t slot = (hash >> 17) & table_mask;
+		while(anchor_positions_[slot] != SIZE_MAX && anchor_hashes_[slot] != hash) slot = (slot + 1) & table_mask;
+
+		size_t j = anchor_positions_[slot];
+		if(j != SIZE_MAX && i + j < best) {
+			if(FindFirstMismatch(pcs1 + i, pcs2 + j, anchor_length_) == anchor_length_) {
+				best = i + j;
+				best_i = i;
+				best_j = j;
+			}
+		}
+		if(i + 1 < limit1) hash = hash * kHashMultiplier + pcs1[i + anchor_length_] - pcs1[i] * outgoing;
+	}
+
+	return best != SIZE_MAX;
+}
+
+uint64_t TraceAligner::Align(PCStreamReader& stream1, uint64_t start1, PCStreamReader& stream2, uint64_t start2, const reporter_t& reporter)
+{
+	const size_t capacity = window_ + anchor_length_ + kLockstepChunk;
+	Window w1 (stream1, start1, capacity), w2 (stream2, start2, capacity);
+
+	uint64_t matched = 0;
+	DivergentRegion region;
+	bool pending = false;
+
+	while(true) {
+		size_t n1 = w1.Fill(kLockstepChunk);
+		size_t n2 = w2.Fill(kLockstepChunk);
+
+		if(n1 == 0 || n2 == 0) {
+			// whatever is left of the longer trace is divergent
+			if(!pending) region = DivergentRegion {w1.Position(), 0, w2.Position(), 0, false};
+			while(n1 || n2) {
+				region.length1 += n1;
+				region.length2 += n2;
+				w1.Consume(n1);
+				w2.Consume(n2);
+				n1 = w1.Fill(kLockstepChunk);
+				n2 = w2.Fill(kLockstepChunk);
+			}
+			region.resynchronised = false;
+			if(region.length1 || region.length2) reporter(region);
+			break;
+		}
+
+		size_t n = std::min(n1, n2);
+		size_t same = FindFirstMismatch(w1.Data(), w2.Data(), n);
+
+		if(pending && same < n && same < anchor_length_) {
+			// after skipping a window, a match shorter than an anchor is a
+			// coincidence rather than the traces coming back into step
+			region.length1 += same;
+			region.length2 += same;
+		} else {
+			if(pending && same) {
+				region.resynchronised = true;
+				reporter(region);
+				pending = false;
+			}
+			matched += same;
+		}
+
+		w1.Consume(same);
+		w2.Consume(same);
+		if(same == n) continue;
+
+		if(!pending) {
+			region = DivergentRegion {w1.Position(), 0, w2.Position(), 0, false};
+			pending = true;
+		}
+
+		// The traces have diverged: look ahead for somewhere to
+		// resynchronise. An anchor found within limit is only the nearest
+		// one if i + j < limit, as one further into either trace could
+		// still be closer overall, unless the search already covered
+		// everything there is.
+		size_t i, j;
+		bool found = false;
+		for(size_t limit = std::min(kInitialSearch, window_); ; limit = std::min(limit * 2, window_)) {
+			bool ended1 = w1.Fill(limit + anchor_length_) < limit + anchor_length_;
+			bool ended2 = w2.Fill(limit + anchor_length_) < limit + anchor_length_;
+			bool complete = limit == window_ || (ended1 && ended2);
+
+			found = FindAnchor(w1, w2, limit, i, j);
+			if((found && i + j < limit) || complete) break;
+		}
+
+		if(found) {
+			region.length1 += i;
+			region.length2 += j;
+			region.resynchronised = true;
+			reporter(region);
+			pending = false;
+		} else {
+			// nothing in common within the window, so skip over it and
+			// try again
+			i = std::min(window_, w1.Available());
+			j = std::min(window_, w2.Available());
+			region.length1 += i;
+			region.length2 += j;
+		}
+
+		w1.Consume(i);
+		w2.Consume(j);
+	}
+
+	return matched;
+}
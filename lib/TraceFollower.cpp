@@ -0,0 +1,51 @@
+#include "libtrace/TraceFollower.h"
+
+#include <cerrno>
+
+#include <poll.h>
+#include <sys/inotify.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+namespace {
+	// how often the file is checked when it can't be watched
+	const int kPollInterval = 100;
+}
+
+TraceFollower::TraceFollower(const std::string& path) : inotify_fd_(-1)
+{
+	inotify_fd_ = inotify_init1(IN_NONBLOCK | IN_CLOEXEC);
+	if(inotify_fd_ < 0) return;
+
+	if(inotify_add_watch(inotify_fd_, path.c_str(), IN_MODIFY | IN_CLOSE_WRITE) < 0) {
+		close(inotify_fd_);
+		inotify_fd_ = -1;
+	}
+}
+
+TraceFollower::~TraceFollower()
+{
+	if(inotify_fd_ >= 0) close(inotify_fd_);
+}
+
+bool TraceFollower::WaitForGrowth(int timeout_ms)
+{
+	if(inotify_fd_ < 0) {
+		if(timeout_ms < 0 || timeout_ms > kPollInterval) timeout_ms = kPollInterval;
+		if(timeout_ms) usleep(timeout_ms * 1000);
+		return true;
+	}
+
+	struct pollfd pfd = { inotify_fd_, POLLIN, 0 };
+	int result;
+	do {
+		result = poll(&pfd, 1, timeout_ms);
+	} while(result < 0 && errno == EINTR);
+	if(result <= 0) return false;
+
+	// only whether anything happened matters, so the events are discarded
+	char events[4096];
+	while(read(inotify_fd_, events, sizeof(events)) > 0);
+	return true;
+}
@@ -0,0 +1,198 @@
+#include "libtrace/TraceGenerator.h"
+
+#include <algorithm>
+#include <random>
+
+using namespace libtrace;
+
+namespace {
+	const uint32_t kInstructionSize = 4;
+	const uint32_t kChaseLineSize = 64;
+	const uint32_t kRegisters = 16;
+	const uint32_t kMaxLoopDepth = 4;
+
+	uint64_t NextRandom(uint64_t &state)
+	{
+		// xorshift64*
+		state ^= state >> 12;
+		state ^= state << 25;
+		state ^= state >> 27;
+		return state * 0x2545f4914f6cdd1dULL;
+	}
+
+	// a count whose mean is the given (possibly fractional) value
+	uint8_t DrawCount(double mean, std::mt19937_64 &rng)
+	{
+		double whole = (uint32_t)mean;
+		bool extra = std::uniform_real_distribution<double>(0, 1)(rng) < mean - whole;
+		return std::min<uint32_t>(255, whole + extra);
+	}
+}
+
+bool TraceGeneratorConfig::ParsePattern(const std::string& name, AddressPattern& pattern)
+{
+	if(name == "stride") pattern = Address_Stride;
+	else if(name == "random") pattern = Address_Random;
+	else if(name == "chase") pattern = Address_PointerChase;
+	else return false;
+	return true;
+}
+
+TraceGeneratorConfig TraceGenerator::GetDefaultConfig()
+{
+	TraceGeneratorConfig config;
+	config.instructions = 1000000;
+	config.seed = 1;
+	config.wide = false;
+	config.blocks = 1024;
+	config.block_length = 6;
+	config.branch_fraction = 0.3;
+	config.loop_fraction = 0.1;
+	config.loop_iterations = 16;
+	config.reg_reads = 1.5;
+	config.reg_writes = 0.8;
+	config.mem_reads = 0.25;
+	config.mem_writes = 0.1;
+	config.pattern = Address_Stride;
+	config.working_set = 1 << 20;
+	config.stride = 8;
+	config.access_width = 4;
+	config.asid_interval = 0;
+	config.asids = 4;
+	return config;
+}
+
+TraceGenerator::TraceGenerator(const TraceGeneratorConfig& config) : config_(config), chase_position_(0)
+{
+	config_.blocks = std::max(1u, config_.blocks);
+	config_.block_length = std::max(1u, config_.block_length);
+	config_.asids = std::max(1u, config_.asids);
+	config_.access_width = std::max(1u, config_.access_width);
+	config_.working_set = std::max<uint64_t>(config_.working_set, std::max(kChaseLineSize, config_.access_width));
+
+	std::mt19937_64 rng (config_.seed);
+	std::uniform_real_distribution<double> uniform (0, 1);
+
+	for(uint32_t b = 0; b < config_.blocks; ++b) {
+		Block block;
+		block.first = instructions_.size();
+		block.length = 1 + rng() % (2 * config_.block_length - 1);
+		block.target = b + 1;
+		block.taken_probability = 0;
+
+		// loops branch back to the start of this block or one of the few
+		// before it, so they can nest
+		double kind = uniform(rng);
+		if(kind < config_.loop_fraction) {
+			block.terminator = Terminator_Loop;
+			block.target = b - rng() % std::min(b + 1, kMaxLoopDepth);
+		} else if(kind < config_.loop_fraction + config_.branch_fraction) {
+			block.terminator = Terminator_Branch;
+			block.target = rng() % config_.blocks;
+			block.taken_probability = rng();
+		} else {
+			block.terminator = Terminator_FallThrough;
+		}
+		blocks_.push_back(block);
+
+		for(uint32_t i = 0; i < block.length; ++i) {
+			StaticInstruction insn;
+			insn.code = rng();
+			insn.reg_reads = DrawCount(config_.reg_reads, rng);
+			insn.reg_writes = DrawCount(config_.reg_writes, rng);
+			insn.mem_reads = DrawCount(config_.mem_reads, rng);
+			insn.mem_writes = DrawCount(config_.mem_writes, rng);
+			insn.first_reg = rng() % kRegisters;
+			instructions_.push_back(insn);
+		}
+	}
+
+	if(config_.pattern == Address_Stride) {
+		stride_offsets_.resize(instructions_.size());
+		for(auto &i : stride_offsets_) i = (rng() % config_.working_set) & ~(uint64_t)(config_.access_width - 1);
+	} else if(config_.pattern == Address_PointerChase) {
+		// Sattolo's algorithm, which gives a single cycle through every line
+		uint32_t lines = config_.working_set / kChaseLineSize;
+		chase_next_.resize(lines);
+		for(uint32_t i = 0; i < lines; ++i) chase_next_[i] = i;
+		for(uint32_t i = lines - 1; i > 0; --i) std::swap(chase_next_[i], chase_next_[rng() % i]);
+	}
+}
+
+template<typename word_t> word_t TraceGenerator::NextAddress(uint32_t insn, uint64_t &state)
+{
+	const word_t base = sizeof(word_t) == 8 ? 0x00007f0000000000ULL : 0x40000000;
+	const uint64_t alignment_mask = ~(uint64_t)(config_.access_width - 1);
+
+	switch(config_.pattern) {
+		case Address_Stride: {
+			uint64_t offset = stride_offsets_[insn];
+			stride_offsets_[insn] = (offset + config_.stride) % config_.working_set;
+			return base + (offset & alignment_mask);
+		}
+		case Address_Random:
+			return base + ((NextRandom(state) % config_.working_set) & alignment_mask);
+		case Address_PointerChase:
+			chase_position_ = chase_next_[chase_position_];
+			return base + (uint64_t)chase_position_ * kChaseLineSize;
+	}
+	return base;
+}
+
+template<typename word_t> void TraceGenerator::Run(TraceSource& source)
+{
+	const word_t base_pc = sizeof(word_t) == 8 ? 0xffff000000010000ULL : 0x10000;
+
+	uint64_t state = config_.seed * 0x9e3779b97f4a7c15ULL | 1;
+	std::vector<uint32_t> loop_counts (blocks_.size(), 0);
+	uint32_t block_index = 0;
+	uint64_t asid = 0;
+
+	for(uint64_t executed = 0; executed < config_.instructions; ) {
+		const Block &block = blocks_[block_index];
+
+		for(uint32_t i = block.first; i < block.first + block.length && executed < config_.instructions; ++i) {
+			const StaticInstruction &insn = instructions_[i];
+
+			source.Trace_End_Insn();
+			source.Trace_Insn((word_t)(base_pc + (word_t)i * kInstructionSize), insn.code, false, 0, 0, 1);
+
+			for(uint32_t r = 0; r < insn.reg_reads; ++r) source.Trace_Reg_Read(true, (insn.first_reg + r) % kRegisters, (word_t)NextRandom(state));
+			for(uint32_t r = 0; r < insn.reg_writes; ++r) source.Trace_Reg_Write(true, (insn.first_reg + insn.reg_reads + r) % kRegisters, (word_t)NextRandom(state));
+			for(uint32_t m = 0; m < insn.mem_reads; ++m) source.Trace_Mem_Read(true, NextAddress<word_t>(i, state), (word_t)NextRandom(state), config_.access_width);
+			for(uint32_t m = 0; m < insn.mem_writes; ++m) source.Trace_Mem_Write(true, NextAddress<word_t>(i, state), (word_t)NextRandom(state), config_.access_width);
+
+			executed++;
+			if(config_.asid_interval && executed % config_.asid_interval == 0) {
+				asid = (asid + 1 + NextRandom(state) % std::max(1u, config_.asids - 1)) % config_.asids;
+				source.Trace_Reg_Write(true, kASIDRegister, (word_t)asid);
+			}
+		}
+
+		uint32_t next = (block_index + 1) % blocks_.size();
+		switch(block.terminator) {
+			case Terminator_FallThrough:
+				break;
+			case Terminator_Branch:
+				if((uint32_t)NextRandom(state) < block.taken_probability) next = block.target;
+				break;
+			case Terminator_Loop: {
+				// a loop runs between 1 and twice the mean iterations each
+				// time it is entered
+				uint32_t &count = loop_counts[block_index];
+				if(count == 0) count = 1 + NextRandom(state) % (2 * std::max(1u, config_.loop_iterations));
+				if(--count) next = block.target;
+				break;
+			}
+		}
+		block_index = next;
+	}
+
+	source.Trace_End_Insn();
+}
+
+void TraceGenerator::Generate(TraceSource& source)
+{
+	if(config_.wide) Run<uint64_t>(source);
+	else Run<uint32_t>(source);
+}
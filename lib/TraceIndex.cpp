@@ -0,0 +1,276 @@
+#include "libtrace/TraceIndex.h"
+#include "libtrace/PCStream.h"
+#include "libtrace/RecordTypes.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+using namespace libtrace;
+
+namespace {
+	const uint64_t kIndexMagic = 0x3230584449544c00ULL; // "\0LTIDX02"
+	const uint64_t kHashMultiplier = 0x9e3779b97f4a7c15ULL;
+	const size_t kScanRecords = 1 << 16;
+
+	struct IndexHeader {
+		uint64_t magic;
+		uint64_t block_size;
+		uint64_t record_count;
+		uint64_t trace_hash;
+		uint64_t instruction_count;
+		uint64_t block_count;
+	};
+
+	// A run of consecutive instructions from one block, hashed by one thread
+	struct HashSegment {
+		uint64_t block;
+		uint64_t hash;
+		uint64_t count;
+	};
+
+	uint64_t MixPC(uint64_t pc)
+	{
+		pc ^= pc >> 33;
+		pc *= 0xff51afd7ed558ccdULL;
+		pc ^= pc >> 33;
+		pc *= 0xc4ceb9fe1a85ec53ULL;
+		pc ^= pc >> 33;
+		return pc;
+	}
+
+	uint64_t MultiplierPower(uint64_t n)
+	{
+		uint64_t result = 1, base = kHashMultiplier;
+		while(n) {
+			if(n & 1) result *= base;
+			base *= base;
+			n >>= 1;
+		}
+		return result;
+	}
+
+	uint64_t CountInstructions(const RecordBlockReader &reader, uint64_t begin, uint64_t end)
+	{
+		std::vector<Record> buffer (kScanRecords);
+		uint64_t count = 0;
+
+		for(uint64_t pos = begin; pos < end; pos += kScanRecords) {
+			size_t n = reader.Read(pos, buffer.data(), std::min<uint64_t>(kScanRecords, end - pos));
+			for(size_t i = 0; i < n; ++i) {
+				count += (buffer[i].GetHeader() >> 24) == InstructionHeader;
+			}
+		}
+		return count;
+	}
+}
+
+TraceIndex::TraceIndex(uint64_t block_size) : block_size_(block_size), record_count_(0), instruction_count_(0)
+{
+	assert(block_size_ > 0);
+}
+
+uint64_t TraceIndex::HashStep(uint64_t hash, uint64_t pc)
+{
+	return hash * kHashMultiplier + MixPC(pc);
+}
+
+uint64_t TraceIndex::Append(uint64_t hash, uint64_t count, uint64_t tail_hash)
+{
+	return hash * MultiplierPower(count) + tail_hash;
+}
+
+uint64_t TraceIndex::GetBlockInstructionCount(size_t i) const
+{
+	return std::min(instruction_count_, (i+1) * block_size_) - i * block_size_;
+}
+
+bool TraceIndex::GetInstructionRecord(const RecordBlockReader& reader, uint64_t insn, uint64_t& record_idx) const
+{
+	if(insn >= instruction_count_) return false;
+
+	record_idx = blocks_[insn / block_size_].record_idx;
+	uint64_t remaining = insn % block_size_;
+
+	std::vector<Record> buffer (kScanRecords);
+	uint64_t pos = record_idx + 1;
+	while(remaining) {
+		size_t n = reader.Read(pos, buffer.data(), kScanRecords);
+		if(n == 0) return false;
+
+		for(size_t i = 0; i < n; ++i) {
+			if((buffer[i].GetHeader() >> 24) == InstructionHeader && --remaining == 0) {
+				record_idx = pos + i;
+				return true;
+			}
+		}
+		pos += n;
+	}
+	return true;
+}
+
+uint64_t TraceIndex::GetRangeHash(size_t first, size_t last) const
+{
+	assert(first <= last && last < prefix_.size());
+	uint64_t count = std::min(instruction_count_, last * block_size_) - std::min(instruction_count_, first * block_size_);
+	return prefix_[last] - prefix_[first] * MultiplierPower(count);
+}
+
+uint64_t TraceIndex::GetPrefixHash(const RecordBlockReader& reader, uint64_t insn) const
+{
+	assert(insn <= instruction_count_);
+	uint64_t block = insn / block_size_;
+	uint64_t remaining = insn % block_size_;
+	if(remaining == 0) return prefix_[block];
+
+	PCStreamReader stream (reader, blocks_[block].record_idx);
+	std::vector<uint64_t> pcs (remaining);
+	size_t n = stream.Read(pcs.data(), remaining);
+
+	uint64_t hash = 0;
+	for(size_t i = 0; i < n; ++i) hash = HashStep(hash, pcs[i]);
+	return Append(prefix_[block], n, hash);
+}
+
+uint64_t TraceIndex::GetInstructionRangeHash(const RecordBlockReader& reader, uint64_t first, uint64_t last) const
+{
+	assert(first <= last && last <= instruction_count_);
+	return GetPrefixHash(reader, last) - GetPrefixHash(reader, first) * MultiplierPower(last - first);
+}
+
+void TraceIndex::BuildPrefixHashes()
+{
+	prefix_.resize(blocks_.size() + 1);
+	prefix_[0] = 0;
+	for(size_t i = 0; i < blocks_.size(); ++i) {
+		prefix_[i+1] = Append(prefix_[i], GetBlockInstructionCount(i), blocks_[i].pc_hash);
+	}
+}
+
+void TraceIndex::Build(const RecordBlockReader& reader, unsigned threads)
+{
+	record_count_ = reader.Size();
+	if(threads == 0) threads = 1;
+
+	// Records can be classified without any context, so the trace is split
+	// into equal ranges of records. The first pass counts the instructions
+	// in each range so that the second pass knows the global instruction
+	// number (and so the block) of each header it finds.
+	uint64_t chunks = std::max<uint64_t>(1, std::min<uint64_t>(threads, record_count_ / kScanRecords));
+	std::vector<uint64_t> chunk_start (chunks + 1);
+	for(uint64_t i = 0; i <= chunks; ++i) chunk_start[i] = (record_count_ * i) / chunks;
+
+	auto run = [chunks](const std::function<void(uint64_t)> &fn) {
+		std::vector<std::thread> workers;
+		for(uint64_t i = 1; i < chunks; ++i) workers.push_back(std::thread(fn, i));
+		fn(0);
+		for(auto &i : workers) i.join();
+	};
+
+	std::vector<uint64_t> chunk_insns (chunks + 1);
+	run([&](uint64_t chunk) {
+		chunk_insns[chunk+1] = CountInstructions(reader, chunk_start[chunk], chunk_start[chunk+1]);
+	});
+
+	chunk_insns[0] = 0;
+	for(uint64_t i = 0; i < chunks; ++i) chunk_insns[i+1] += chunk_insns[i];
+	instruction_count_ = chunk_insns[chunks];
+
+	blocks_.assign((instruction_count_ + block_size_ - 1) / block_size_, Block {0, 0});
+
+	std::vector<std::vector<HashSegment>> segments (chunks);
+	run([&](uint64_t chunk) {
+		std::vector<Record> buffer (kScanRecords + 1);
+		std::vector<HashSegment> &chunk_segments = segments[chunk];
+		uint64_t insn = chunk_insns[chunk];
+		uint64_t end = chunk_start[chunk+1];
+
+		for(uint64_t pos = chunk_start[chunk]; pos < end; pos += kScanRecords) {
+			// read one record past the range so that a trailing header's
+			// extension is available
+			size_t want = std::min<uint64_t>(kScanRecords, end - pos);
+			reader.Read(pos, buffer.data(), want + 1);
+
+			for(size_t i = 0; i < want; ++i) {
+				const TraceRecord &tr = (const TraceRecord&)buffer[i];
+				if(tr.GetType() != InstructionHeader) continue;
+
+				uint64_t pc = tr.GetData32();
+				if(tr.GetExtensionCount()) pc |= (uint64_t)buffer[i+1].GetData() << 32;
+
+				uint64_t block = insn / block_size_;
+				if((insn % block_size_) == 0) blocks_[block].record_idx = pos + i;
+				if(chunk_segments.empty() || chunk_segments.back().block != block) chunk_segments.push_back(HashSegment {block, 0, 0});
+
+				HashSegment &segment = chunk_segments.back();
+				segment.hash = HashStep(segment.hash, pc);
+				segment.count++;
+				insn++;
+			}
+		}
+	});
+
+	// blocks which straddle ranges are stitched back together in order
+	for(const auto &chunk_segments : segments) {
+		for(const auto &segment : chunk_segments) {
+			Block &block = blocks_[segment.block];
+			block.pc_hash = Append(block.pc_hash, segment.count, segment.hash);
+		}
+	}
+
+	BuildPrefixHashes();
+}
+
+bool TraceIndex::Load(FILE* f, const RecordBlockReader &reader)
+{
+	IndexHeader header;
+	if(fread(&header, sizeof(header), 1, f) != 1) return false;
+	if(header.magic != kIndexMagic || header.block_size != block_size_ || header.record_count != reader.Size()) return false;
+	if(header.trace_hash != reader.GetIdentityHash()) return false;
+
+	std::vector<Block> blocks (header.block_count);
+	if(fread(blocks.data(), sizeof(Block), blocks.size(), f) != blocks.size()) return false;
+
+	record_count_ = header.record_count;
+	instruction_count_ = header.instruction_count;
+	blocks_.swap(blocks);
+	BuildPrefixHashes();
+	return true;
+}
+
+bool TraceIndex::Save(FILE* f, const RecordBlockReader &reader) const
+{
+	if(reader.Size() != record_count_) return false;
+
+	IndexHeader header { kIndexMagic, block_size_, record_count_, reader.GetIdentityHash(), instruction_count_, blocks_.size() };
+	if(fwrite(&header, sizeof(header), 1, f) != 1) return false;
+	return fwrite(blocks_.data(), sizeof(Block), blocks_.size(), f) == blocks_.size();
+}
+
+std::string TraceIndex::GetSidecarPath(const std::string& trace_path)
+{
+	return trace_path + ".idx";
+}
+
+void TraceIndex::LoadOrBuild(const std::string& trace_path, const RecordBlockReader& reader, unsigned threads)
+{
+	std::string sidecar = GetSidecarPath(trace_path);
+
+	FILE *f = fopen(sidecar.c_str(), "r");
+	if(f) {
+		bool loaded = Load(f, reader);
+		fclose(f);
+		if(loaded) return;
+	}
+
+	Build(reader, threads);
+
+	// the index is still usable if the sidecar cannot be written
+	f = fopen(sidecar.c_str(), "w");
+	if(f) {
+		bool saved = Save(f, reader);
+		fclose(f);
+		if(!saved) remove(sidecar.c_str());
+	}
+}
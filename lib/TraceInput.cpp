@@ -0,0 +1,53 @@
+#include "libtrace/TraceInput.h"
+
+#include <cstring>
+#include <string>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+const char *TraceInput::kFollowUsage = "  -f             wait for a trace which is still being written to grow, like tail -f\n";
+
+TraceInput::TraceInput() : follow_(false), file_(nullptr)
+{
+
+}
+
+TraceInput::~TraceInput()
+{
+	if(file_ && file_ != stdin) fclose(file_);
+}
+
+bool TraceInput::ParseOptions(int argc, char** argv, const char* options, const option_handler_t& handler)
+{
+	std::string optstring = std::string("f") + options;
+
+	int opt;
+	while((opt = getopt(argc, argv, optstring.c_str())) != -1) {
+		if(opt == 'f') follow_ = true;
+		else if(opt == '?' || !handler || !handler(opt, optarg)) return false;
+	}
+	return true;
+}
+
+bool TraceInput::Open(const char* path)
+{
+	if(!strcmp(path, "-")) {
+		if(follow_) {
+			fprintf(stderr, "Cannot follow standard input\n");
+			return false;
+		}
+		file_ = stdin;
+		return true;
+	}
+
+	file_ = fopen(path, "r");
+	if(!file_) {
+		perror("Could not open file");
+		return false;
+	}
+
+	if(follow_) follower_.reset(new TraceFollower(path));
+	return true;
+}
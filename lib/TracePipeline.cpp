@@ -0,0 +1,207 @@
+#include "libtrace/TracePipeline.h"
+
+#include <algorithm>
+#include <memory>
+#include <thread>
+
+using namespace libtrace;
+
+namespace {
+	// yields before a full or empty queue blocks, as the other side is
+	// usually about to move
+	const unsigned kSpinLimit = 64;
+
+	bool IsInstructionHeader(const Record &record)
+	{
+		return ((const TraceRecord&)record).GetType() == InstructionHeader;
+	}
+}
+
+BatchQueue::BatchQueue(size_t capacity) : slots_(capacity), head_(0), tail_(0), waiters_(0)
+{
+
+}
+
+void BatchQueue::Wait(const std::atomic<size_t>& position, size_t value)
+{
+	for(unsigned spins = 0; spins < kSpinLimit; ++spins) {
+		if(position.load(std::memory_order_acquire) != value) return;
+		std::this_thread::yield();
+	}
+
+	// The waiter count and the positions are sequentially consistent, so
+	// either the other side sees this waiter after moving, or this waiter
+	// sees the move before blocking
+	std::unique_lock<std::mutex> guard (lock_);
+	waiters_.fetch_add(1);
+	changed_.wait(guard, [&]() { return position.load() != value; });
+	waiters_.fetch_sub(1);
+}
+
+void BatchQueue::Wake()
+{
+	if(!waiters_.load()) return;
+
+	std::lock_guard<std::mutex> guard (lock_);
+	changed_.notify_all();
+}
+
+void BatchQueue::Push(RecordBatch* batch)
+{
+	size_t tail = tail_.load(std::memory_order_relaxed);
+	size_t head = head_.load(std::memory_order_acquire);
+	if(tail - head == slots_.size()) Wait(head_, head);
+
+	slots_[tail % slots_.size()] = batch;
+	tail_.store(tail + 1);
+	Wake();
+}
+
+RecordBatch* BatchQueue::Pop()
+{
+	size_t head = head_.load(std::memory_order_relaxed);
+	if(head == tail_.load(std::memory_order_acquire)) Wait(tail_, head);
+
+	RecordBatch *batch = slots_[head % slots_.size()];
+	head_.store(head + 1);
+	Wake();
+	return batch;
+}
+
+PipelineStage::~PipelineStage()
+{
+
+}
+
+void PipelineStage::Finish()
+{
+
+}
+
+InstructionFilterStage::InstructionFilterStage(const predicate_t& predicate) : predicate_(predicate)
+{
+
+}
+
+void InstructionFilterStage::Process(RecordBatch& batch)
+{
+	Record *records = batch.records.data();
+	size_t count = batch.records.size();
+	size_t kept = 0;
+
+	for(size_t begin = 0; begin < count; ) {
+		size_t end = begin + 1;
+		while(end < count && !IsInstructionHeader(records[end])) end++;
+
+		// anything before the first header of the trace is kept
+		if(!IsInstructionHeader(records[begin]) || predicate_(records + begin, records + end)) {
+			if(kept != begin) std::copy(records + begin, records + end, records + kept);
+			kept += end - begin;
+		}
+		begin = end;
+	}
+
+	batch.records.resize(kept);
+}
+
+TracePipeline::TracePipeline(const RecordBlockReader& reader, size_t batch_records, size_t queue_depth) : reader_(reader), batch_records_(batch_records), queue_depth_(queue_depth), sink_(nullptr)
+{
+
+}
+
+void TracePipeline::AddStage(PipelineStage* stage)
+{
+	stages_.push_back(stage);
+}
+
+void TracePipeline::SetSink(TraceSink* sink)
+{
+	sink_ = sink;
+}
+
+void TracePipeline::Run(uint64_t first, uint64_t last)
+{
+	last = std::min(last, reader_.Size());
+
+	// enough batches for every queue to be full, and every queue big enough
+	// for every batch plus the end of stream marker
+	std::vector<RecordBatch> batches (queue_depth_ * (stages_.size() + 2));
+	std::vector<std::unique_ptr<BatchQueue>> queues;
+	for(size_t i = 0; i < stages_.size() + 2; ++i) queues.push_back(std::unique_ptr<BatchQueue>(new BatchQueue(batches.size() + 1)));
+
+	// queues[0] returns batches from the sink to the source, and queues[i]
+	// feeds stage i - 1
+	BatchQueue &free = *queues[0];
+	for(auto &i : batches) {
+		i.records.reserve(batch_records_ * 2);
+		free.Push(&i);
+	}
+
+	std::vector<std::thread> threads;
+	threads.push_back(std::thread(&TracePipeline::RunSource, this, std::ref(free), std::ref(*queues[1]), first, last));
+	for(size_t i = 0; i < stages_.size(); ++i) threads.push_back(std::thread(&TracePipeline::RunStage, this, stages_[i], std::ref(*queues[i + 1]), std::ref(*queues[i + 2])));
+
+	RunSink(*queues.back(), free);
+	for(auto &i : threads) i.join();
+}
+
+void TracePipeline::RunSource(BatchQueue& free, BatchQueue& out, uint64_t first, uint64_t last)
+{
+	// the records of an instruction which was cut off by the end of the
+	// previous read
+	std::vector<Record> partial;
+	uint64_t position = first;
+
+	while(position < last) {
+		RecordBatch *batch = free.Pop();
+		batch->first_record = position - partial.size();
+		batch->records.assign(partial.begin(), partial.end());
+		partial.clear();
+
+		// read until the batch has a whole instruction, and hold back the
+		// last instruction unless it is the end of the range
+		size_t header = 0;
+		do {
+			size_t existing = batch->records.size();
+			batch->records.resize(existing + batch_records_);
+			size_t count = reader_.Read(position, batch->records.data() + existing, std::min<uint64_t>(batch_records_, last - position));
+			batch->records.resize(existing + count);
+			position += count;
+			if(!count) position = last;
+
+			header = batch->records.empty() ? 0 : batch->records.size() - 1;
+			while(header > 0 && !IsInstructionHeader(batch->records[header])) header--;
+		} while(position < last && header == 0);
+
+		if(position < last) {
+			partial.assign(batch->records.begin() + header, batch->records.end());
+			batch->records.resize(header);
+		}
+
+		out.Push(batch);
+	}
+
+	out.Push(nullptr);
+}
+
+void TracePipeline::RunStage(PipelineStage* stage, BatchQueue& in, BatchQueue& out)
+{
+	while(RecordBatch *batch = in.Pop()) {
+		stage->Process(*batch);
+		out.Push(batch);
+	}
+	stage->Finish();
+	out.Push(nullptr);
+}
+
+void TracePipeline::RunSink(BatchQueue& in, BatchQueue& free)
+{
+	while(RecordBatch *batch = in.Pop()) {
+		if(sink_ && !batch->records.empty()) {
+			const TraceRecord *records = (const TraceRecord*)batch->records.data();
+			sink_->SinkPackets(records, records + batch->records.size());
+		}
+		free.Push(batch);
+	}
+	if(sink_) sink_->Flush();
+}
@@ -0,0 +1,122 @@
+#include "libtrace/TraceProfile.h"
+
+#include <algorithm>
+#include <cstring>
+#include <thread>
+
+using namespace libtrace;
+
+namespace {
+	const size_t kScanRecords = 1 << 16;
+	const size_t kInvalidType = DataExtension + 1;
+}
+
+TraceProfile::TraceProfile() : records(0), instructions(0)
+{
+	memset(record_types, 0, sizeof(record_types));
+}
+
+void TraceProfile::Build(const RecordBlockReader& reader, unsigned threads)
+{
+	uint64_t record_count = reader.Size();
+	if(threads == 0) threads = 1;
+
+	uint64_t chunks = std::max<uint64_t>(1, std::min<uint64_t>(threads, record_count / kScanRecords));
+	std::vector<TraceProfile> profiles (chunks);
+
+	std::vector<std::thread> workers;
+	for(uint64_t i = 1; i < chunks; ++i) {
+		workers.push_back(std::thread([&, i]() {
+			profiles[i].Accumulate(reader, (record_count * i) / chunks, (record_count * (i+1)) / chunks);
+		}));
+	}
+	profiles[0].Accumulate(reader, 0, record_count / chunks);
+	for(auto &i : workers) i.join();
+
+	for(auto &profile : profiles) Merge(profile);
+}
+
+void TraceProfile::Accumulate(const RecordBlockReader& reader, uint64_t first, uint64_t last)
+{
+	std::vector<Record> buffer (kScanRecords + 1);
+
+	for(uint64_t pos = first; pos < last; pos += kScanRecords) {
+		// read one record past the range so that a trailing packet's
+		// extension is available
+		size_t want = std::min<uint64_t>(kScanRecords, last - pos);
+		size_t read = reader.Read(pos, buffer.data(), want + 1);
+		if(read < want) want = read;
+		records += want;
+
+		for(size_t i = 0; i < want; ++i) {
+			const TraceRecord &tr = (const TraceRecord&)buffer[i];
+			size_t type = std::min<size_t>(tr.GetType(), kInvalidType);
+			record_types[type]++;
+
+			uint64_t value = tr.GetData32();
+			if(tr.GetExtensionCount() && i + 1 < read) value |= (uint64_t)buffer[i+1].GetData() << 32;
+
+			switch(tr.GetType()) {
+				case InstructionHeader:
+					instructions++;
+					pcs[value]++;
+					break;
+				case InstructionCode:
+					codes[value]++;
+					exception_modes[tr.GetData16()]++;
+					break;
+				case MemReadAddr:
+				case MemWriteAddr: {
+					uint32_t width = tr.GetData16();
+					MemStats &stats = (tr.GetType() == MemReadAddr ? mem_reads : mem_writes)[width];
+					stats.accesses++;
+					if(width && (value % width)) stats.misaligned++;
+
+					// count every page which the access touches
+					uint64_t last_byte = value + (width ? width - 1 : 0);
+					for(uint64_t page = value >> kPageBits; page <= (last_byte >> kPageBits); ++page) pages.insert(page);
+					break;
+				}
+				default:
+					break;
+			}
+		}
+	}
+}
+
+void TraceProfile::Merge(const TraceProfile& other)
+{
+	records += other.records;
+	instructions += other.instructions;
+	for(size_t i = 0; i <= kInvalidType; ++i) record_types[i] += other.record_types[i];
+
+	for(auto &i : other.pcs) pcs[i.first] += i.second;
+	for(auto &i : other.codes) codes[i.first] += i.second;
+
+	for(auto &i : other.mem_reads) {
+		MemStats &stats = mem_reads[i.first];
+		stats.accesses += i.second.accesses;
+		stats.misaligned += i.second.misaligned;
+	}
+	for(auto &i : other.mem_writes) {
+		MemStats &stats = mem_writes[i.first];
+		stats.accesses += i.second.accesses;
+		stats.misaligned += i.second.misaligned;
+	}
+	pages.insert(other.pages.begin(), other.pages.end());
+
+	for(auto &i : other.exception_modes) exception_modes[i.first] += i.second;
+}
+
+TraceProfile::histogram_t TraceProfile::GetTop(const std::unordered_map<uint64_t, uint64_t>& counts, size_t n)
+{
+	histogram_t top (counts.begin(), counts.end());
+	auto order = [](const std::pair<uint64_t, uint64_t> &a, const std::pair<uint64_t, uint64_t> &b) {
+		return a.second != b.second ? a.second > b.second : a.first < b.first;
+	};
+
+	n = std::min(n, top.size());
+	std::partial_sort(top.begin(), top.begin() + n, top.end(), order);
+	top.resize(n);
+	return top;
+}
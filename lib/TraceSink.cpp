@@ -4,16 +4,48 @@
 #include "libtrace/TraceRecordStream.h"
 #include "libtrace/TraceRecordPacketVisitor.h"
 
+#include <cerrno>
+#include <cstdlib>
 #include <string.h>
 
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
 using namespace libtrace;
 
+namespace {
+	// O_DIRECT needs buffers, offsets and lengths aligned to the block size
+	const size_t kDirectAlignment = 4096;
+	const uint64_t kReserveBytes = 64 << 20;
+
+	void WriteAll(int fd, const char *data, size_t bytes, uint64_t offset)
+	{
+		while(bytes) {
+			ssize_t written = pwrite(fd, data, bytes, offset);
+			if(written < 0) {
+				if(errno == EINTR) continue;
+				perror("Could not write trace");
+				abort();
+			}
+			data += written;
+			bytes -= written;
+			offset += written;
+		}
+	}
+}
+
 
 TraceSink::TraceSink()
 {
 
 }
 
+TraceSink::~TraceSink()
+{
+
+}
+
 BinaryFileTraceSink::BinaryFileTraceSink(FILE *outfile) : TraceSink(), outfile_(outfile)
 {
 
@@ -44,31 +76,223 @@ void BinaryFileTraceSink::SinkPackets(const TraceRecord* start, const TraceRecor
 	}
 }
 
-TextFileTraceSink::TextFileTraceSink(FILE *outfile, ArchInterface *interface) : TraceSink(), outfile_(outfile), interface_(interface)
+AsyncFileTraceSink::AsyncFileTraceSink(FILE* outfile, size_t buffer_records, size_t buffer_count) : TraceSink(), file_(outfile), fd_(fileno(outfile)), direct_fd_(-1)
+{
+	fflush(file_);
+	off_t position = ftello(file_);
+	offset_ = position < 0 ? 0 : position;
+	Start(buffer_records, buffer_count);
+}
+
+AsyncFileTraceSink::AsyncFileTraceSink(const std::string& path, bool direct, size_t buffer_records, size_t buffer_count) : TraceSink(), file_(nullptr), direct_fd_(-1), offset_(0)
+{
+	fd_ = open(path.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0666);
+	if(fd_ < 0) {
+		perror(path.c_str());
+		abort();
+	}
+
+	// not every filesystem supports O_DIRECT, in which case every write goes
+	// through the page cache
+	if(direct) direct_fd_ = open(path.c_str(), O_WRONLY | O_DIRECT);
+
+	Start(buffer_records, buffer_count);
+}
+
+void AsyncFileTraceSink::Start(size_t buffer_records, size_t buffer_count)
+{
+	const size_t alignment_records = kDirectAlignment / sizeof(TraceRecord);
+	buffer_records_ = std::max(alignment_records, (buffer_records + alignment_records - 1) & ~(alignment_records - 1));
+
+	buffers_.resize(std::max<size_t>(2, buffer_count));
+	for(auto &buffer : buffers_) {
+		void *memory;
+		if(posix_memalign(&memory, kDirectAlignment, buffer_records_ * sizeof(TraceRecord))) {
+			perror("Could not allocate trace buffer");
+			abort();
+		}
+		buffer.records = (TraceRecord*)memory;
+		buffer.count = 0;
+		buffer.offset = 0;
+	}
+
+	current_ = &buffers_[0];
+	for(size_t i = 1; i < buffers_.size(); ++i) free_.push_back(&buffers_[i]);
+
+	reserved_ = offset_;
+	reserve_failed_ = false;
+	writing_ = false;
+	stopping_ = false;
+	writer_ = std::thread(&AsyncFileTraceSink::RunWriter, this);
+}
+
+AsyncFileTraceSink::~AsyncFileTraceSink()
+{
+	Flush();
+
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		stopping_ = true;
+	}
+	changed_.notify_all();
+	writer_.join();
+
+	// give back any space reserved past the end of the trace
+	uint64_t end = offset_ + current_->count * sizeof(TraceRecord);
+	struct stat st;
+	if(!fstat(fd_, &st) && (uint64_t)st.st_size == end) {
+		if(ftruncate(fd_, end)) perror("Could not trim trace");
+	}
+
+	for(auto &buffer : buffers_) free(buffer.records);
+	if(direct_fd_ >= 0) close(direct_fd_);
+	if(file_) fclose(file_);
+	else close(fd_);
+}
+
+void AsyncFileTraceSink::SinkPackets(const TraceRecord* start, const TraceRecord* end)
+{
+	while(start != end) {
+		size_t count = std::min<size_t>(end - start, buffer_records_ - current_->count);
+		std::copy(start, start + count, current_->records + current_->count);
+		current_->count += count;
+		start += count;
+
+		if(current_->count == buffer_records_) Submit();
+	}
+}
+
+void AsyncFileTraceSink::Submit()
+{
+	current_->offset = offset_;
+	offset_ += current_->count * sizeof(TraceRecord);
+
+	std::unique_lock<std::mutex> guard (lock_);
+	pending_.push_back(current_);
+	changed_.notify_all();
+
+	// only blocks if every other buffer is still being written
+	changed_.wait(guard, [this]() { return !free_.empty(); });
+	current_ = free_.front();
+	free_.pop_front();
+	current_->count = 0;
+}
+
+void AsyncFileTraceSink::WaitIdle()
+{
+	std::unique_lock<std::mutex> guard (lock_);
+	changed_.wait(guard, [this]() { return pending_.empty() && !writing_; });
+}
+
+void AsyncFileTraceSink::Flush()
+{
+	if(current_->count == 0) {
+		WaitIdle();
+		return;
+	}
+
+	Buffer *flushed = current_;
+	size_t count = flushed->count;
+	Submit();
+	WaitIdle();
+
+	// O_DIRECT writes have to start on a block boundary, so an unaligned
+	// tail is kept and written again at the start of the next buffer
+	if(direct_fd_ >= 0) {
+		size_t tail = count % (kDirectAlignment / sizeof(TraceRecord));
+		// the flushed buffer may already have been reused as the current one
+		const TraceRecord *tail_start = flushed->records + count - tail;
+		if(tail_start != current_->records) std::copy(tail_start, tail_start + tail, current_->records);
+		current_->count = tail;
+		offset_ -= tail * sizeof(TraceRecord);
+	}
+}
+
+void AsyncFileTraceSink::RunWriter()
+{
+	std::unique_lock<std::mutex> guard (lock_);
+	while(true) {
+		changed_.wait(guard, [this]() { return !pending_.empty() || stopping_; });
+		if(pending_.empty()) break;
+
+		Buffer *buffer = pending_.front();
+		pending_.pop_front();
+		writing_ = true;
+
+		guard.unlock();
+		WriteBuffer(*buffer);
+		guard.lock();
+
+		writing_ = false;
+		free_.push_back(buffer);
+		changed_.notify_all();
+	}
+}
+
+void AsyncFileTraceSink::WriteBuffer(const Buffer& buffer)
+{
+	size_t bytes = buffer.count * sizeof(TraceRecord);
+	const char *data = (const char*)buffer.records;
+
+	// reserve extents well ahead of the writes, without changing the file
+	// size seen by readers
+	if(!reserve_failed_ && buffer.offset + bytes > reserved_) {
+		uint64_t length = std::max<uint64_t>(kReserveBytes, buffer.offset + bytes - reserved_);
+		if(fallocate(fd_, FALLOC_FL_KEEP_SIZE, reserved_, length)) reserve_failed_ = true;
+		else reserved_ += length;
+	}
+
+	size_t direct_bytes = direct_fd_ >= 0 ? bytes & ~(kDirectAlignment - 1) : 0;
+	if(direct_bytes) WriteAll(direct_fd_, data, direct_bytes, buffer.offset);
+	if(bytes > direct_bytes) WriteAll(fd_, data + direct_bytes, bytes - direct_bytes, buffer.offset + direct_bytes);
+}
+
+TextFileTraceSink::TextFileTraceSink(FILE *outfile, ArchInterface *interface) : TraceSink(), outfile_(outfile), interface_(interface), isa_mode_(0), pc_(0)
 {
 
 }
 
 TextFileTraceSink::~TextFileTraceSink()
 {
+	// the trace ended part way through a packet
+	if(!partial_.empty()) WritePacket(partial_.data(), partial_.size());
 	Flush();
 }
 
 void TextFileTraceSink::SinkPackets(const TraceRecord* start, const TraceRecord* end)
 {
-	while(start != end) {
-		record_output_stream_->Put(*start++);
+	// sinks are given records as they are buffered, so a packet can be
+	// split between calls
+	while(!partial_.empty() && start != end) {
+		partial_.push_back(*start++);
+		if(partial_.size() > partial_.front().GetExtensionCount()) {
+			WritePacket(partial_.data(), partial_.size());
+			partial_.clear();
+		}
 	}
-	
-	while(packet_input_stream_->Good()) {
-		TraceRecordPacket packet = packet_input_stream_->Get();
-		WritePacket(packet);
+
+	while(start != end) {
+		size_t length = 1 + start->GetExtensionCount();
+		if((size_t)(end - start) < length) {
+			partial_.assign(start, end);
+			break;
+		}
+
+		WritePacket(start, length);
+		start += length;
 	}
+	fflush(outfile_);
+}
+
+void TextFileTraceSink::WritePacket(const TraceRecord* start, size_t length)
+{
+	const DataExtensionRecord *extensions = (const DataExtensionRecord*)(start + 1);
+	WritePacket(TraceRecordPacket(*start, std::vector<DataExtensionRecord>(extensions, extensions + length - 1)));
 }
 
 class TextTraceSinkVisitor : public TraceRecordPacketVisitor {
 public:
-	TextTraceSinkVisitor(FILE *outfile, ArchInterface *interface) : outfile_(outfile), interface_(interface) {}
+	TextTraceSinkVisitor(FILE *outfile, ArchInterface &interface, uint32_t &isa_mode) : outfile_(outfile), interface_(interface), isa_mode_(isa_mode) {}
 	
 	virtual ~TextTraceSinkVisitor()
 	{
@@ -78,10 +302,11 @@ public:
 	void VisitBankRegRead(const BankRegReadReader& record) override {}
 	void VisitBankRegWrite(const BankRegWriteReader& record) override {}
 	void VisitInstructionCode(const InstructionCodeReader& record) override {
-		std::string disasm = interface_->DisassembleInstruction(record.GetRecord());
+		std::string disasm = interface_.DisassembleInstruction(isa_mode_, record.GetRecord());
 		fprintf(outfile_, "%08x %s\t\t", record.GetCode().AsU32(), disasm.c_str());
 	}
 	void VisitInstructionHeader(const InstructionHeaderReader& record) override {
+		isa_mode_ = record.GetIsaMode();
 		fprintf(outfile_, "\n[%08x] ", record.GetPC().AsU32());
 	}
 	void VisitMemReadAddr(const MemReadAddrReader& record) override {}
@@ -93,12 +318,13 @@ public:
 
 private:
 	FILE *outfile_;
-	ArchInterface *interface_;
+	ArchInterface &interface_;
+	uint32_t &isa_mode_;
 };
 
 void TextFileTraceSink::WritePacket(const TraceRecordPacket& pkt)
 {
-	TextTraceSinkVisitor visitor(outfile_, interface_);
+	TextTraceSinkVisitor visitor(outfile_, interface_, isa_mode_);
 	visitor.Visit(pkt);
 	
 	/*
@@ -134,7 +360,6 @@ void TextFileTraceSink::WritePacket(const TraceRecordPacket& pkt)
 			WriteMemWriteData((MemWriteDataRecord*)pkt);
 			return;
 	}*/
-	Flush();
 }
 
 void TextFileTraceSink::Flush()
@@ -154,8 +379,8 @@ void TextFileTraceSink::WriteInstructionCode(const InstructionCodeRecord* record
 
 void TextFileTraceSink::WriteRegRead(const RegReadRecord* record)
 {
-	const std::string &regname = interface_->GetRegisterSlotName(record->GetRegNum());
-	uint32_t width = interface_->GetRegisterSlotWidth(record->GetRegNum());
+	const std::string &regname = interface_.GetRegisterSlotName(record->GetRegNum());
+	uint32_t width = interface_.GetRegisterSlotWidth(record->GetRegNum());
 	switch(width) {
 		case 1:
 			fprintf(outfile_, "(R[%s] => %02x)", regname.c_str(), record->GetData());
@@ -172,8 +397,8 @@ void TextFileTraceSink::WriteRegRead(const RegReadRecord* record)
 
 void TextFileTraceSink::WriteRegWrite(const RegWriteRecord* record)
 {
-	const std::string &regname = interface_->GetRegisterSlotName(record->GetRegNum());
-	uint32_t width = interface_->GetRegisterSlotWidth(record->GetRegNum());
+	const std::string &regname = interface_.GetRegisterSlotName(record->GetRegNum());
+	uint32_t width = interface_.GetRegisterSlotWidth(record->GetRegNum());
 
 	switch(width) {
 		case 1:
@@ -191,14 +416,14 @@ void TextFileTraceSink::WriteRegWrite(const RegWriteRecord* record)
 
 void TextFileTraceSink::WriteBankRegRead(const BankRegReadRecord* record)
 {
-	const std::string &regname = interface_->GetRegisterSlotName(record->GetBank());
+	const std::string &regname = interface_.GetRegisterSlotName(record->GetBank());
 	// TODO: handle banks of registers which are not 32 bit
 	fprintf(outfile_, "(R[%s][%x] => %08x)", regname.c_str(), record->GetRegNum(), record->GetData());
 }
 
 void TextFileTraceSink::WriteBankRegWrite(const BankRegWriteRecord* record)
 {
-	const std::string &regname = interface_->GetRegisterSlotName(record->GetBank());
+	const std::string &regname = interface_.GetRegisterSlotName(record->GetBank());
 	// TODO: handle banks of registers which are not 32 bit
 	fprintf(outfile_, "(R[%s][%x] <= %08x)", regname.c_str(), record->GetRegNum(), record->GetData());
 }
@@ -0,0 +1,41 @@
+#include "libtrace/TraceSlicer.h"
+#include "libtrace/ReverseInstructionScanner.h"
+
+using namespace libtrace;
+
+TraceSlicer::TraceSlicer(const RecordBlockReader& reader, const TraceIndex& index) : reader_(reader), index_(index)
+{
+
+}
+
+bool TraceSlicer::GetPacketStart(uint64_t insn, uint64_t& record_idx) const
+{
+	if(insn == 0) {
+		record_idx = 0;
+		return true;
+	}
+	if(insn >= index_.GetInstructionCount()) {
+		record_idx = reader_.Size();
+		return true;
+	}
+
+	if(!index_.GetInstructionRecord(reader_, insn, record_idx)) return false;
+	record_idx = ReverseInstructionScanner::GetPacketStart(reader_, record_idx);
+	return true;
+}
+
+bool TraceSlicer::Locate(uint64_t first, uint64_t end, TraceSlice& slice) const
+{
+	if(first >= index_.GetInstructionCount() || end < first) return false;
+	return GetPacketStart(first, slice.first_record) && GetPacketStart(end, slice.end_record);
+}
+
+uint64_t TraceSlicer::CopyTo(const TraceSlice& slice, int out_fd, uint64_t out_offset) const
+{
+	return reader_.CopyTo(slice.first_record, slice.GetRecordCount(), out_fd, out_offset);
+}
+
+uint64_t TraceSlicer::WriteTo(const TraceSlice& slice, int out_fd) const
+{
+	return reader_.WriteTo(slice.first_record, slice.GetRecordCount(), out_fd);
+}
@@ -16,9 +16,12 @@
 #include "libtrace/TraceSource.h"
 #include "libtrace/ArchInterface.h"
 
+#include <chrono>
 #include <cstdint>
+#include <cstdlib>
 #include <cassert>
 #include <errno.h>
+#include <algorithm>
 #include <map>
 #include <string>
 #include <streambuf>
@@ -28,11 +31,24 @@
 
 using namespace libtrace;
 
+namespace {
+	uint64_t NowNS()
+	{
+		return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+	}
+}
+
 TraceSource::TraceSource(uint32_t BufferSize)
 	:
-	is_terminated_(false),
+	IO_Packet_Count(0),
+	Tracing_Packet_Count(0),
+	packet_open_(false),
 	sink_(nullptr),
-	aggressive_flushing_(true)
+	is_terminated_(false),
+	aggressive_flushing_(true),
+	statistics_enabled_(getenv("LIBTRACE_STATISTICS") != nullptr),
+	statistics_file_(stderr),
+	statistics_()
 {
 	packet_buffer_ = (TraceRecord*)malloc(PacketBufferSize * sizeof(TraceRecord));
 	packet_buffer_end_ = packet_buffer_+PacketBufferSize;
@@ -46,13 +62,39 @@ TraceSource::~TraceSource()
 
 void TraceSource::EmitPackets()
 {
-	sink_->SinkPackets(packet_buffer_, packet_buffer_pos_);
+	size_t count = packet_buffer_pos_ - packet_buffer_;
+	IO_Packet_Count++;
+	Tracing_Packet_Count += count;
+
+	if(!statistics_enabled_) {
+		if(sink_) sink_->SinkPackets(packet_buffer_, packet_buffer_pos_);
+		else statistics_.dropped_records += count;
+		packet_buffer_pos_ = packet_buffer_;
+		return;
+	}
+
+	uint64_t start = NowNS();
+	for(const TraceRecord *record = packet_buffer_; record != packet_buffer_pos_; ++record) {
+		statistics_.records[std::min<size_t>(record->GetType(), DataExtension + 1)]++;
+	}
+	statistics_.bytes += count * sizeof(TraceRecord);
+
+	if(sink_) {
+		uint64_t sink_start = NowNS();
+		sink_->SinkPackets(packet_buffer_, packet_buffer_pos_);
+		statistics_.sink.Add(NowNS() - sink_start);
+	} else {
+		statistics_.dropped_records += count;
+	}
 	packet_buffer_pos_ = packet_buffer_;
+
+	statistics_.emit.Add(NowNS() - start);
 }
 
 void TraceSource::Terminate()
 {
 	is_terminated_ = true;
+	if(statistics_enabled_ && statistics_file_) statistics_.Print(statistics_file_);
 }
 
 
@@ -60,5 +102,9 @@ void TraceSource::Terminate()
 void TraceSource::Flush()
 {
 	EmitPackets();
+	if(!sink_) return;
+
+	uint64_t start = statistics_enabled_ ? NowNS() : 0;
 	sink_->Flush();
+	if(statistics_enabled_) statistics_.flush.Add(NowNS() - start);
 }
@@ -0,0 +1,71 @@
+#include "libtrace/TraceStatistics.h"
+
+using namespace libtrace;
+
+namespace {
+	const char *GetTypeName(size_t type)
+	{
+		switch(type) {
+			case Unknown: return "unknown";
+			case InstructionHeader: return "instruction header";
+			case InstructionCode: return "instruction code";
+			case RegRead: return "reg read";
+			case RegWrite: return "reg write";
+			case BankRegRead: return "bank reg read";
+			case BankRegWrite: return "bank reg write";
+			case MemReadAddr: return "mem read addr";
+			case MemReadData: return "mem read data";
+			case MemWriteAddr: return "mem write addr";
+			case MemWriteData: return "mem write data";
+			case InstructionBundleHeader: return "bundle header";
+			case DataExtension: return "data extension";
+			default: return "invalid";
+		}
+	}
+
+	void PrintLatency(FILE *f, const char *name, const LatencyHistogram &histogram)
+	{
+		fprintf(f, "  %-14s %12lu calls", name, histogram.count);
+		if(histogram.count) {
+			fprintf(f, ", mean %lu ns, p50 < %lu ns, p99 < %lu ns, max %lu ns, total %.3f s",
+				histogram.total_ns / histogram.count, histogram.GetQuantile(0.5), histogram.GetQuantile(0.99), histogram.max_ns, histogram.total_ns / 1e9);
+		}
+		fprintf(f, "\n");
+	}
+}
+
+void LatencyHistogram::Add(uint64_t ns)
+{
+	size_t bucket = ns ? 63 - __builtin_clzll(ns) : 0;
+	if(bucket >= kBuckets) bucket = kBuckets - 1;
+
+	buckets[bucket]++;
+	count++;
+	total_ns += ns;
+	if(ns > max_ns) max_ns = ns;
+}
+
+uint64_t LatencyHistogram::GetQuantile(double quantile) const
+{
+	uint64_t target = quantile * count;
+	uint64_t seen = 0;
+	for(size_t i = 0; i < kBuckets; ++i) {
+		seen += buckets[i];
+		if(seen > target) return 2ULL << i;
+	}
+	return max_ns;
+}
+
+void TraceStatistics::Print(FILE* f) const
+{
+	fprintf(f, "Trace statistics:\n");
+	fprintf(f, "  %lu bytes emitted\n", bytes);
+	for(size_t i = 0; i < DataExtension + 2; ++i) {
+		if(records[i]) fprintf(f, "  %-20s %14lu records\n", GetTypeName(i), records[i]);
+	}
+	fprintf(f, "  %lu emits with a full buffer\n", buffer_full_emits);
+	fprintf(f, "  %lu operations outside an instruction, %lu records emitted without a sink\n", dropped_operations, dropped_records);
+	PrintLatency(f, "EmitPackets", emit);
+	PrintLatency(f, "SinkPackets", sink);
+	PrintLatency(f, "Flush", flush);
+}
@@ -0,0 +1,388 @@
+#include "libtrace/TraceSummary.h"
+
+#include <algorithm>
+#include <cassert>
+#include <functional>
+#include <thread>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+namespace {
+	const uint64_t kSummaryMagic = 0x32304d5553544c00ULL; // "\0LTSUM02"
+	const size_t kScanRecords = 1 << 16;
+	const uint32_t kBloomBits = TraceSummary::kBloomWords * 64;
+	const uint32_t kPCTypes = 1u << InstructionHeader;
+	const uint32_t kAddressTypes = (1u << MemReadAddr) | (1u << MemWriteAddr);
+
+	struct SummaryHeader {
+		uint64_t magic;
+		uint64_t chunk_records;
+		uint64_t asid_register;
+		uint64_t record_count;
+		uint64_t trace_hash;
+		uint64_t chunk_count;
+	};
+
+	uint64_t Mix(uint64_t key)
+	{
+		key ^= key >> 33;
+		key *= 0xff51afd7ed558ccdULL;
+		key ^= key >> 33;
+		key *= 0xc4ceb9fe1a85ec53ULL;
+		key ^= key >> 33;
+		return key;
+	}
+
+	// two probes per key, taken from different bits of one hash
+	void BloomInsert(uint64_t *bloom, uint32_t key)
+	{
+		uint64_t hash = Mix(key);
+		uint32_t a = hash % kBloomBits, b = (hash >> 32) % kBloomBits;
+		bloom[a / 64] |= 1ULL << (a % 64);
+		bloom[b / 64] |= 1ULL << (b % 64);
+	}
+
+	bool BloomTest(const uint64_t *bloom, uint32_t key)
+	{
+		uint64_t hash = Mix(key);
+		uint32_t a = hash % kBloomBits, b = (hash >> 32) % kBloomBits;
+		return (bloom[a / 64] >> (a % 64)) & (bloom[b / 64] >> (b % 64)) & 1;
+	}
+
+	TraceSummary::Chunk EmptyChunk()
+	{
+		TraceSummary::Chunk chunk = {};
+		chunk.min_pc = chunk.min_address = ~0ULL;
+		return chunk;
+	}
+}
+
+TraceSummary::TraceSummary(uint64_t chunk_records, uint32_t asid_register) : chunk_records_(chunk_records), asid_register_(asid_register), record_count_(0)
+{
+	assert(chunk_records_ > 0);
+	append_state_ = StartScan(0, true, 0);
+}
+
+TraceSummary::ScanState TraceSummary::StartScan(uint64_t position, bool asid_known, uint64_t asid) const
+{
+	ScanState state;
+	state.position = position;
+	state.asid_known = asid_known;
+	state.asid = asid;
+	state.pending_type = Unknown;
+	state.pending_chunk = 0;
+	state.pending_value = 0;
+	return state;
+}
+
+TraceSummary::Chunk& TraceSummary::GetChunkForUpdate(uint64_t chunk)
+{
+	if(chunk >= chunks_.size()) chunks_.resize(chunk + 1, EmptyChunk());
+	return chunks_[chunk];
+}
+
+void TraceSummary::Apply(ScanState& state, TraceRecordType type, uint64_t chunk, uint64_t value)
+{
+	Chunk &c = chunks_[chunk];
+
+	switch(type) {
+		case InstructionHeader:
+			c.last_pc = value;
+			c.min_pc = std::min(c.min_pc, value);
+			c.max_pc = std::max(c.max_pc, value);
+			BloomInsert(c.pc_bloom, (uint32_t)value);
+			break;
+		case MemReadAddr:
+		case MemWriteAddr:
+			c.min_address = std::min(c.min_address, value);
+			c.max_address = std::max(c.max_address, value);
+			BloomInsert(c.line_bloom, (uint32_t)value >> kLineBits);
+			break;
+		case RegWrite:
+			c.asids |= 1ULL << (value % 64);
+			c.last_asid = value;
+			c.wrote_asid = 1;
+			state.asid = value;
+			state.asid_known = true;
+			break;
+		default:
+			break;
+	}
+}
+
+void TraceSummary::Scan(ScanState& state, const Record* records, size_t count)
+{
+	for(size_t i = 0; i < count; ++i) {
+		const TraceRecord &tr = (const TraceRecord&)records[i];
+		uint64_t chunk = state.position / chunk_records_;
+		Chunk &c = GetChunkForUpdate(chunk);
+
+		if((state.position++ % chunk_records_) == 0 && state.asid_known) c.asids |= 1ULL << (state.asid % 64);
+
+		TraceRecordType type = tr.GetType();
+		if(type < 32) c.types |= 1u << type;
+
+		if(type == DataExtension) {
+			if(state.pending_type != Unknown) {
+				Apply(state, state.pending_type, state.pending_chunk, state.pending_value | ((uint64_t)tr.GetData32() << 32));
+				state.pending_type = Unknown;
+			}
+			continue;
+		}
+
+		// an extension which never arrived
+		if(state.pending_type != Unknown) {
+			Apply(state, state.pending_type, state.pending_chunk, state.pending_value);
+			state.pending_type = Unknown;
+		}
+
+		bool tracked = false;
+		switch(type) {
+			case InstructionHeader:
+				c.instructions++;
+				tracked = true;
+				break;
+			case MemReadAddr:
+			case MemWriteAddr:
+				tracked = true;
+				break;
+			case RegWrite:
+				tracked = tr.GetData16() == asid_register_;
+				break;
+			default:
+				break;
+		}
+		if(!tracked) continue;
+
+		if(tr.GetExtensionCount()) {
+			state.pending_type = type;
+			state.pending_chunk = chunk;
+			state.pending_value = tr.GetData32();
+		} else {
+			Apply(state, type, chunk, tr.GetData32());
+		}
+	}
+}
+
+void TraceSummary::FinishScan(ScanState& state, const Record* next)
+{
+	if(state.pending_type == Unknown) return;
+
+	uint64_t value = state.pending_value;
+	if(next && ((const TraceRecord*)next)->GetType() == DataExtension) value |= (uint64_t)next->GetData() << 32;
+	Apply(state, state.pending_type, state.pending_chunk, value);
+	state.pending_type = Unknown;
+}
+
+void TraceSummary::ResolveASIDs()
+{
+	// ASIDs are only ever written, so the ASID at the start of each chunk
+	// is the last one written before it
+	uint64_t asid = 0;
+	for(auto &chunk : chunks_) {
+		chunk.asids |= 1ULL << (asid % 64);
+		if(chunk.wrote_asid) asid = chunk.last_asid;
+	}
+
+	append_state_ = StartScan(record_count_, true, asid);
+}
+
+void TraceSummary::Build(const RecordBlockReader& reader, unsigned threads)
+{
+	record_count_ = reader.Size();
+	chunks_.assign((record_count_ + chunk_records_ - 1) / chunk_records_, EmptyChunk());
+	if(threads == 0) threads = 1;
+
+	// each thread summarises a range of whole chunks. Only the first range
+	// knows the ASID it starts with, the rest are filled in afterwards.
+	uint64_t ranges = std::max<uint64_t>(1, std::min<uint64_t>(threads, chunks_.size()));
+	std::vector<uint64_t> range_start (ranges + 1);
+	for(uint64_t i = 0; i <= ranges; ++i) range_start[i] = std::min(record_count_, ((chunks_.size() * i) / ranges) * chunk_records_);
+
+	std::function<void(uint64_t)> fn = [&](uint64_t range) {
+		std::vector<Record> buffer (kScanRecords + 1);
+		uint64_t end = range_start[range+1];
+		ScanState state = StartScan(range_start[range], range == 0, 0);
+		const Record *next = nullptr;
+
+		for(uint64_t pos = range_start[range]; pos < end; pos += kScanRecords) {
+			// read one record past the range so that a trailing value's
+			// extension is available
+			size_t want = std::min<uint64_t>(kScanRecords, end - pos);
+			size_t n = reader.Read(pos, buffer.data(), want + 1);
+			Scan(state, buffer.data(), std::min(n, want));
+			next = n > want ? &buffer[want] : nullptr;
+			if(n < want) break;
+		}
+		FinishScan(state, next);
+	};
+
+	std::vector<std::thread> workers;
+	for(uint64_t i = 1; i < ranges; ++i) workers.push_back(std::thread(fn, i));
+	fn(0);
+	for(auto &i : workers) i.join();
+
+	ResolveASIDs();
+}
+
+void TraceSummary::Append(const Record* records, size_t count)
+{
+	Scan(append_state_, records, count);
+	record_count_ += count;
+}
+
+bool TraceSummary::IsComplete(size_t chunk) const
+{
+	return chunk < chunks_.size() && (chunk + 1) * chunk_records_ <= record_count_;
+}
+
+bool TraceSummary::MayContainType(size_t chunk, TraceRecordType type) const
+{
+	if(!IsComplete(chunk)) return true;
+	return type >= 32 || (chunks_[chunk].types & (1u << type));
+}
+
+bool TraceSummary::MayContainPC(size_t chunk, uint64_t pc) const
+{
+	if(!IsComplete(chunk)) return true;
+
+	const Chunk &c = chunks_[chunk];
+	return pc >= c.min_pc && pc <= c.max_pc && BloomTest(c.pc_bloom, (uint32_t)pc);
+}
+
+bool TraceSummary::MayContainAddress(size_t chunk, uint64_t address) const
+{
+	if(!IsComplete(chunk)) return true;
+
+	const Chunk &c = chunks_[chunk];
+	if(c.min_address > c.max_address) return false;
+
+	uint64_t line = address >> kLineBits;
+	return line >= (c.min_address >> kLineBits) && line <= (c.max_address >> kLineBits) && BloomTest(c.line_bloom, (uint32_t)address >> kLineBits);
+}
+
+bool TraceSummary::MayContainASID(size_t chunk, uint64_t asid) const
+{
+	if(!IsComplete(chunk)) return true;
+	return (chunks_[chunk].asids >> (asid % 64)) & 1;
+}
+
+bool TraceSummary::MayMatch(size_t chunk, uint32_t value, uint32_t mask, uint32_t types) const
+{
+	if(!IsComplete(chunk)) return true;
+
+	const Chunk &c = chunks_[chunk];
+	if(!(c.types & types)) return false;
+
+	// every matching value lies in [value, value | ~mask]. The ranges are
+	// of whole values, so they can only be compared with record data when
+	// every value in the chunk fits in 32 bits.
+	value &= mask;
+	uint32_t top = value | ~mask;
+	const uint32_t line_mask = (1u << kLineBits) - 1;
+
+	if(!(types & ~kPCTypes)) {
+		if(c.max_pc <= 0xffffffffULL && (top < c.min_pc || value > c.max_pc)) return false;
+		if(mask == ~0u && !BloomTest(c.pc_bloom, value)) return false;
+	} else if(!(types & ~kAddressTypes)) {
+		if(c.max_address <= 0xffffffffULL && (top < c.min_address || value > c.max_address)) return false;
+		if((mask | line_mask) == ~0u && !BloomTest(c.line_bloom, value >> kLineBits)) return false;
+	}
+	return true;
+}
+
+bool TraceSummary::Load(FILE* f, const RecordBlockReader &reader)
+{
+	uint64_t record_count = reader.Size();
+
+	SummaryHeader header;
+	if(fread(&header, sizeof(header), 1, f) != 1) return false;
+	if(header.magic != kSummaryMagic || header.chunk_records != chunk_records_ || header.asid_register != asid_register_ || header.record_count != record_count) return false;
+	if(header.chunk_count != (record_count + chunk_records_ - 1) / chunk_records_) return false;
+	if(header.trace_hash != reader.GetIdentityHash()) return false;
+
+	std::vector<Chunk> chunks (header.chunk_count);
+	if(fread(chunks.data(), sizeof(Chunk), chunks.size(), f) != chunks.size()) return false;
+
+	record_count_ = header.record_count;
+	chunks_.swap(chunks);
+	ResolveASIDs();
+	return true;
+}
+
+bool TraceSummary::Save(FILE* f, const RecordBlockReader &reader) const
+{
+	if(reader.Size() != record_count_) return false;
+
+	SummaryHeader header { kSummaryMagic, chunk_records_, asid_register_, record_count_, reader.GetIdentityHash(), chunks_.size() };
+	if(fwrite(&header, sizeof(header), 1, f) != 1) return false;
+	return fwrite(chunks_.data(), sizeof(Chunk), chunks_.size(), f) == chunks_.size();
+}
+
+std::string TraceSummary::GetSidecarPath(const std::string& trace_path)
+{
+	return trace_path + ".summary";
+}
+
+bool TraceSummary::LoadSidecar(const std::string& trace_path, const RecordBlockReader &reader)
+{
+	FILE *f = fopen(GetSidecarPath(trace_path).c_str(), "r");
+	if(!f) return false;
+
+	bool loaded = Load(f, reader);
+	fclose(f);
+	return loaded;
+}
+
+bool TraceSummary::SaveSidecar(const std::string& trace_path, const RecordBlockReader &reader) const
+{
+	std::string sidecar = GetSidecarPath(trace_path);
+
+	FILE *f = fopen(sidecar.c_str(), "w");
+	if(!f) return false;
+
+	bool saved = Save(f, reader);
+	fclose(f);
+	if(!saved) remove(sidecar.c_str());
+	return saved;
+}
+
+bool TraceSummary::SaveSidecar(const std::string& trace_path) const
+{
+	int fd = open(trace_path.c_str(), O_RDONLY);
+	if(fd < 0) return false;
+
+	bool saved = SaveSidecar(trace_path, RecordBlockReader(fd));
+	close(fd);
+	return saved;
+}
+
+void TraceSummary::LoadOrBuild(const std::string& trace_path, const RecordBlockReader& reader, unsigned threads)
+{
+	if(LoadSidecar(trace_path, reader)) return;
+
+	Build(reader, threads);
+
+	// the summary is still usable if the sidecar cannot be written
+	SaveSidecar(trace_path, reader);
+}
+
+SummaryTraceSink::SummaryTraceSink(TraceSink* sink, const std::string& trace_path, uint64_t chunk_records) : TraceSink(), sink_(sink), trace_path_(trace_path), summary_(chunk_records)
+{
+
+}
+
+void SummaryTraceSink::SinkPackets(const TraceRecord* start, const TraceRecord* end)
+{
+	summary_.Append(start, end - start);
+	sink_->SinkPackets(start, end);
+}
+
+void SummaryTraceSink::Flush()
+{
+	sink_->Flush();
+	summary_.SaveSidecar(trace_path_);
+}
@@ -0,0 +1,82 @@
+#include "libtrace/SharedMemoryTrace.h"
+#include "libtrace/InstructionPrinter.h"
+
+#include <chrono>
+#include <iostream>
+#include <thread>
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-c] [-n instructions] [-w seconds] [name]\n", name);
+	fprintf(stderr, "Follows a trace published to shared memory (RecordGenerate -P) and prints its instructions.\n");
+	fprintf(stderr, "  -c             only count records and instructions\n");
+	fprintf(stderr, "  -n <count>     detach after this many instructions\n");
+	fprintf(stderr, "  -w <seconds>   wait this long for the trace to appear (0)\n");
+}
+
+int main(int argc, char **argv)
+{
+	bool count_only = false;
+	uint64_t limit = 0;
+	unsigned wait_seconds = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "cn:w:")) != -1) {
+		switch(opt) {
+			case 'c':
+				count_only = true;
+				break;
+			case 'n':
+				limit = strtoull(optarg, NULL, 0);
+				break;
+			case 'w':
+				wait_seconds = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	SharedMemoryTraceReader reader;
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(wait_seconds);
+	while(!reader.Attach(argv[optind])) {
+		if(std::chrono::steady_clock::now() >= deadline) {
+			fprintf(stderr, "Could not attach to %s\n", argv[optind]);
+			return 1;
+		}
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+
+	uint64_t records = 0, instructions = 0;
+	if(count_only) {
+		while(reader.Good() && (!limit || instructions < limit || (reader.Peek().GetHeader() >> 24) != InstructionHeader)) {
+			instructions += (reader.Get().GetHeader() >> 24) == InstructionHeader;
+			records++;
+		}
+	} else {
+		TracePacketStreamAdaptor tpsa (&reader);
+		InstructionPrinter ip;
+		while(reader.Good() && (!limit || instructions < limit)) {
+			std::cout << ip(&tpsa) << std::endl;
+			instructions++;
+		}
+	}
+
+	reader.Detach();
+	if(count_only) fprintf(stderr, "%lu records, %lu instructions, ", records, instructions);
+	fprintf(stderr, "%lu records lost\n", reader.GetLostRecords());
+	return 0;
+}
@@ -0,0 +1,400 @@
+#include "libtrace/InstructionBatch.h"
+#include "libtrace/InstructionState.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/RecordFile.h"
+#include "libtrace/InstructionPrinter.h"
+#include "libtrace/TraceRecordPacketVisitor.h"
+#include "libtrace/TraceRecordStream.h"
+#include "libtrace/TraceSink.h"
+#include "libtrace/TraceSource.h"
+
+#include <algorithm>
+#include <chrono>
+#include <functional>
+#include <string>
+#include <vector>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <ctime>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+// Micro benchmarks of the libtrace hot paths. Each benchmark reports the best
+// of several repetitions, and the results are written as JSON so that they
+// can be compared between builds.
+
+static volatile uint64_t benchmark_sink;
+
+struct Benchmark {
+	std::string name;
+	std::string unit;
+	std::function<uint64_t()> run;	// returns the number of operations
+};
+
+struct Result {
+	std::string name, unit;
+	uint64_t operations;
+	double best, mean;
+};
+
+class CountingSink : public TraceSink
+{
+public:
+	CountingSink() : records_(0) {}
+
+	void SinkPackets(const TraceRecord *start, const TraceRecord *end) override { records_ += end - start; }
+	void Flush() override { benchmark_sink = records_; }
+
+private:
+	uint64_t records_;
+};
+
+class CountingVisitor : public TraceRecordPacketVisitor
+{
+public:
+	CountingVisitor() : count_(0) {}
+
+	void VisitInstructionHeader(const InstructionHeaderReader &record) override { count_++; }
+	void VisitInstructionCode(const InstructionCodeReader &record) override { count_++; }
+	void VisitRegRead(const RegReadReader &record) override { count_++; }
+	void VisitRegWrite(const RegWriteReader &record) override { count_++; }
+	void VisitBankRegRead(const BankRegReadReader &record) override { count_++; }
+	void VisitBankRegWrite(const BankRegWriteReader &record) override { count_++; }
+	void VisitMemReadAddr(const MemReadAddrReader &record) override { count_++; }
+	void VisitMemReadData(const MemReadDataReader &record) override { count_++; }
+	void VisitMemWriteAddr(const MemWriteAddrReader &record) override { count_++; }
+	void VisitMemWriteData(const MemWriteDataReader &record) override { count_++; }
+
+	uint64_t GetCount() const { return count_; }
+
+private:
+	uint64_t count_;
+};
+
+enum RecordMix {
+	Mix_Instructions,	// header and code only
+	Mix_Registers,		// plus two register reads and a write
+	Mix_Memory,		// plus a register write, a memory read and a memory write
+	Mix_Wide		// the memory mix with 64 bit PCs, values and addresses
+};
+
+const char *GetMixName(RecordMix mix)
+{
+	switch(mix) {
+		case Mix_Instructions: return "insn";
+		case Mix_Registers: return "reg";
+		case Mix_Memory: return "mem";
+		case Mix_Wide: return "wide";
+		default: return "unknown";
+	}
+}
+
+void TraceInstructions(TraceSink *sink, RecordMix mix, bool aggressive_flush, uint64_t instructions)
+{
+	TraceSource source (TraceSource::RecordBufferSize);
+	source.SetSink(sink);
+	source.SetAggressiveFlush(aggressive_flush);
+
+	for(uint64_t i = 0; i < instructions; ++i) {
+		uint32_t pc = 0x1000 + (i & 0xfff) * 4;
+		source.Trace_End_Insn();
+
+		if(mix == Mix_Wide) {
+			source.Trace_Insn((uint64_t)(pc | 0xffff000000000000ULL), (uint32_t)i, false, 0, 0, 1);
+			source.Trace_Reg_Write(true, 1, (uint64_t)i << 20);
+			source.Trace_Mem_Read(true, (uint64_t)(0x7fff00000000ULL + (i & 0xffff) * 8), (uint64_t)i, 8);
+			source.Trace_Mem_Write(true, (uint64_t)(0x7fff00100000ULL + (i & 0xffff) * 8), (uint64_t)i, 8);
+			continue;
+		}
+
+		source.Trace_Insn(pc, (uint32_t)i, false, 0, 0, 1);
+		if(mix == Mix_Registers) {
+			source.Trace_Reg_Read(true, 1, (uint32_t)i);
+			source.Trace_Reg_Read(true, 2, (uint32_t)(i + 1));
+			source.Trace_Reg_Write(true, 3, (uint32_t)(i * 3));
+		} else if(mix == Mix_Memory) {
+			source.Trace_Reg_Write(true, 1, (uint32_t)i);
+			source.Trace_Mem_Read(true, (uint32_t)(0x100000 + (i & 0xffff) * 4), (uint32_t)i, 4);
+			source.Trace_Mem_Write(true, (uint32_t)(0x200000 + (i & 0xffff) * 4), (uint32_t)i, 4);
+		}
+	}
+	source.Trace_End_Insn();
+	source.Flush();
+	source.Terminate();
+}
+
+double Now()
+{
+	return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+Result RunBenchmark(const Benchmark &benchmark, unsigned repetitions)
+{
+	Result result {benchmark.name, benchmark.unit, 0, 0, 0};
+	double total = 0;
+
+	for(unsigned i = 0; i < repetitions; ++i) {
+		double start = Now();
+		result.operations = benchmark.run();
+		double elapsed = Now() - start;
+
+		total += elapsed;
+		if(i == 0 || elapsed < result.best) result.best = elapsed;
+	}
+	result.mean = total / repetitions;
+
+	fprintf(stderr, "%-40s %12.1f ns/%s\n", result.name.c_str(), result.best * 1e9 / std::max<uint64_t>(1, result.operations), result.unit.c_str());
+	return result;
+}
+
+void WriteJSON(FILE *f, const std::vector<Result> &results, uint64_t instructions, uint64_t records, unsigned repetitions)
+{
+	char date[64];
+	time_t now = time(NULL);
+	strftime(date, sizeof(date), "%Y-%m-%dT%H:%M:%SZ", gmtime(&now));
+
+	fprintf(f, "{\n");
+	fprintf(f, "  \"context\": {\n");
+	fprintf(f, "    \"date\": \"%s\",\n", date);
+	fprintf(f, "    \"instructions\": %lu,\n", instructions);
+	fprintf(f, "    \"trace_records\": %lu,\n", records);
+	fprintf(f, "    \"repetitions\": %u\n", repetitions);
+	fprintf(f, "  },\n");
+	fprintf(f, "  \"benchmarks\": [\n");
+	for(size_t i = 0; i < results.size(); ++i) {
+		const Result &r = results[i];
+		double ops = std::max<uint64_t>(1, r.operations);
+		fprintf(f, "    {\"name\": \"%s\", \"unit\": \"%s\", \"operations\": %lu, \"best_seconds\": %.9f, \"mean_seconds\": %.9f, \"ns_per_operation\": %.3f, \"operations_per_second\": %.1f}%s\n",
+			r.name.c_str(), r.unit.c_str(), r.operations, r.best, r.mean, r.best * 1e9 / ops, r.best > 0 ? ops / r.best : 0, i + 1 < results.size() ? "," : "");
+	}
+	fprintf(f, "  ]\n");
+	fprintf(f, "}\n");
+}
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n instructions] [-r repetitions] [-f name filter] [-d temporary directory] [-o output JSON file]\n", name);
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t instructions = 1000000;
+	unsigned repetitions = 3;
+	std::string filter, directory = "/tmp";
+	const char *output = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:r:f:d:o:")) != -1) {
+		switch(opt) {
+			case 'n':
+				instructions = strtoull(optarg, NULL, 0);
+				break;
+			case 'r':
+				repetitions = std::max(1ul, strtoul(optarg, NULL, 0));
+				break;
+			case 'f':
+				filter = optarg;
+				break;
+			case 'd':
+				directory = optarg;
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	// a trace of the memory mix for the read side benchmarks
+	std::string trace_path = directory + "/tracebench.XXXXXX";
+	int trace_fd = mkstemp(&trace_path[0]);
+	if(trace_fd < 0) {
+		perror("Could not create temporary trace");
+		return 1;
+	}
+	{
+		BinaryFileTraceSink sink (fdopen(dup(trace_fd), "w"));
+		TraceInstructions(&sink, Mix_Memory, false, instructions);
+	}
+	unlink(trace_path.c_str());
+
+	FILE *trace = fdopen(trace_fd, "r");
+	RecordFile record_file (trace);
+	RecordBlockReader block_reader (trace_fd);
+	const uint64_t records = record_file.Size();
+
+	std::vector<Benchmark> benchmarks;
+
+	for(int mix = Mix_Instructions; mix <= Mix_Wide; ++mix) {
+		for(int aggressive = 1; aggressive >= 0; --aggressive) {
+			std::string name = std::string("source/") + GetMixName((RecordMix)mix) + (aggressive ? "/aggressive_flush" : "/buffered");
+			benchmarks.push_back(Benchmark {name, "instruction", [=]() {
+				CountingSink sink;
+				TraceInstructions(&sink, (RecordMix)mix, aggressive, instructions);
+				return instructions;
+			}});
+		}
+	}
+
+	benchmarks.push_back(Benchmark {"sink/binary_file", "record", [=]() {
+		std::vector<TraceRecord> buffer (TraceSource::PacketBufferSize);
+		BinaryFileTraceSink sink (fopen("/dev/null", "w"));
+		for(uint64_t i = 0; i < records; i += buffer.size()) {
+			size_t count = std::min<uint64_t>(buffer.size(), records - i);
+			sink.SinkPackets(buffer.data(), buffer.data() + count);
+		}
+		sink.Flush();
+		return records;
+	}});
+
+	// the same records written to a real file, synchronously and from a
+	// writer thread
+	auto sink_to_disk = [=](std::function<TraceSink*(const std::string &path)> create) {
+		std::string path = directory + "/tracebench_sink.XXXXXX";
+		int fd = mkstemp(&path[0]);
+		if(fd < 0) {
+			perror("Could not create temporary file");
+			abort();
+		}
+		close(fd);
+
+		std::vector<TraceRecord> buffer (TraceSource::PacketBufferSize);
+		TraceSink *sink = create(path);
+		for(uint64_t i = 0; i < records; i += buffer.size()) {
+			size_t count = std::min<uint64_t>(buffer.size(), records - i);
+			sink->SinkPackets(buffer.data(), buffer.data() + count);
+		}
+		sink->Flush();
+		delete sink;
+		unlink(path.c_str());
+		return records;
+	};
+
+	benchmarks.push_back(Benchmark {"sink/binary_file/disk", "record", [=]() {
+		return sink_to_disk([](const std::string &path) { return new BinaryFileTraceSink(fopen(path.c_str(), "w")); });
+	}});
+
+	for(int direct = 0; direct <= 1; ++direct) {
+		benchmarks.push_back(Benchmark {direct ? "sink/async_file/direct" : "sink/async_file/disk", "record", [=]() {
+			return sink_to_disk([=](const std::string &path) { return new AsyncFileTraceSink(path, direct); });
+		}});
+	}
+
+	benchmarks.push_back(Benchmark {"record_file/sequential", "record", [&]() {
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < records; ++i) sum += record_file.Get(i).GetData();
+		benchmark_sink = sum;
+		return records;
+	}});
+
+	benchmarks.push_back(Benchmark {"record_file/reverse", "record", [&]() {
+		uint64_t sum = 0;
+		for(uint64_t i = records; i > 0; --i) sum += record_file.Get(i - 1).GetData();
+		benchmark_sink = sum;
+		return records;
+	}});
+
+	benchmarks.push_back(Benchmark {"record_file/random", "record", [&]() {
+		// every access is likely to reload the buffer, so do fewer of them
+		uint64_t operations = std::min<uint64_t>(records, 10000);
+		uint64_t sum = 0, state = 1;
+		for(uint64_t i = 0; i < operations && records; ++i) {
+			state = state * 6364136223846793005ULL + 1442695040888963407ULL;
+			sum += record_file.Get((state >> 17) % records).GetData();
+		}
+		benchmark_sink = sum;
+		return operations;
+	}});
+
+	benchmarks.push_back(Benchmark {"record_block_reader/sequential", "record", [&]() {
+		std::vector<Record> buffer (1 << 16);
+		uint64_t sum = 0;
+		for(uint64_t i = 0; i < records; ) {
+			size_t count = block_reader.Read(i, buffer.data(), buffer.size());
+			if(!count) break;
+			for(size_t j = 0; j < count; ++j) sum += buffer[j].GetData();
+			i += count;
+		}
+		benchmark_sink = sum;
+		return records;
+	}});
+
+	benchmarks.push_back(Benchmark {"decode/instruction_state", "instruction", [&]() {
+		InstructionStateReader reader (block_reader, 0, 0);
+		uint64_t count = 0, sum = 0;
+		while(const InstructionStateBatch *batch = reader.Next()) {
+			for(const auto &insn : batch->instructions) sum += insn.pc;
+			count += batch->instructions.size();
+		}
+		benchmark_sink = sum;
+		return count;
+	}});
+
+	benchmarks.push_back(Benchmark {"decode/instruction_batch", "instruction", [&]() {
+		InstructionBatchReader reader (block_reader);
+		InstructionBatch batch;
+		uint64_t count = 0, sum = 0;
+		while(reader.Next(batch)) {
+			for(size_t i = 0; i < batch.instructions; ++i) sum += batch.pc[i];
+			count += batch.instructions;
+		}
+		benchmark_sink = sum;
+		return count;
+	}});
+
+	benchmarks.push_back(Benchmark {"packet_adaptor", "packet", [&]() {
+		RecordBufferStreamAdaptor records_stream (&record_file);
+		TracePacketStreamAdaptor packets (&records_stream);
+		uint64_t count = 0, sum = 0;
+		while(packets.Good()) {
+			sum += packets.Get().GetRecord().GetData32();
+			count++;
+		}
+		benchmark_sink = sum;
+		return count;
+	}});
+
+	benchmarks.push_back(Benchmark {"packet_visitor", "packet", [&]() {
+		RecordBufferStreamAdaptor records_stream (&record_file);
+		TracePacketStreamAdaptor packets (&records_stream);
+		CountingVisitor visitor;
+		while(packets.Good()) visitor.Visit(packets.Get());
+		benchmark_sink = visitor.GetCount();
+		return visitor.GetCount();
+	}});
+
+	benchmarks.push_back(Benchmark {"instruction_printer", "line", [&]() {
+		RecordBufferStreamAdaptor records_stream (&record_file);
+		TracePacketStreamAdaptor packets (&records_stream);
+		InstructionPrinter printer;
+		uint64_t lines = 0, length = 0;
+		while(packets.Good()) {
+			length += printer(&packets).size();
+			lines++;
+		}
+		benchmark_sink = length;
+		return lines;
+	}});
+
+	std::vector<Result> results;
+	for(auto &i : benchmarks) {
+		if(!filter.empty() && i.name.find(filter) == std::string::npos) continue;
+		results.push_back(RunBenchmark(i, repetitions));
+	}
+
+	FILE *f = output ? fopen(output, "w") : stdout;
+	if(!f) {
+		perror("Could not open output file");
+		return 1;
+	}
+	WriteJSON(f, results, instructions, records, repetitions);
+	if(output) fclose(f);
+
+	return 0;
+}
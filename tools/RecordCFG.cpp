@@ -0,0 +1,111 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/ControlFlowGraph.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <algorithm>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s max instruction size] [-j threads] [-n top blocks] [-o graph file] [-d low:high] [record file]\n", name);
+	fprintf(stderr, "  -o writes the graph in binary form, -d writes the blocks starting in [low, high) as DOT\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t max_instruction_size = ControlFlowGraph::kDefaultMaxInstructionSize;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	size_t top = 20;
+	const char *output = nullptr;
+	bool dot = false;
+	uint64_t dot_low = 0, dot_high = 0;
+
+	int opt;
+	while((opt = getopt(argc, argv, "s:j:n:o:d:")) != -1) {
+		switch(opt) {
+			case 's':
+				max_instruction_size = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				threads = strtoul(optarg, NULL, 0);
+				break;
+			case 'n':
+				top = strtoull(optarg, NULL, 0);
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			case 'd': {
+				char *end;
+				dot_low = strtoull(optarg, &end, 16);
+				if(*end != ':') {
+					PrintUsage(argv[0]);
+					return 1;
+				}
+				dot_high = strtoull(end + 1, NULL, 16);
+				dot = true;
+				break;
+			}
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	ControlFlowGraph cfg (max_instruction_size);
+	cfg.Build(reader, threads);
+
+	if(output) {
+		FILE *out = fopen(output, "w");
+		if(!out) {
+			perror("Could not open output file");
+			return 1;
+		}
+		bool saved = cfg.Save(out);
+		fclose(out);
+		if(!saved) {
+			fprintf(stderr, "Could not write graph\n");
+			return 1;
+		}
+	}
+
+	if(dot) {
+		cfg.WriteDot(stdout, dot_low, dot_high);
+		return 0;
+	}
+
+	const auto &blocks = cfg.GetBlocks();
+	printf("%lu instructions, %lu basic blocks, %lu edges\n", cfg.GetInstructionCount(), blocks.size(), cfg.GetEdges().size());
+
+	std::vector<ControlFlowGraph::BasicBlock> hottest (blocks.begin(), blocks.end());
+	top = std::min(top, hottest.size());
+	std::partial_sort(hottest.begin(), hottest.begin() + top, hottest.end(), [](const ControlFlowGraph::BasicBlock &a, const ControlFlowGraph::BasicBlock &b) {
+		return a.executions * a.instructions > b.executions * b.instructions;
+	});
+
+	printf("\nHottest blocks:\n");
+	for(size_t i = 0; i < top; ++i) {
+		const auto &block = hottest[i];
+		printf("  %016lx-%016lx %6lu insns %14lu executions\n", block.start, block.end, block.instructions, block.executions);
+	}
+
+	return 0;
+}
@@ -0,0 +1,143 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/CacheSimulator.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <algorithm>
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-c <l1i|l1d|l2|l3>=<config>]... [-n top PCs] [-p level to rank PCs by] [record file]\n", name);
+	fprintf(stderr, "Cache configs have the form '<size>[k|m]:<ways>:<line size>[:<lru|plru|rrip>][:<wb|wt>][:<wa|nwa>]' or 'none'\n");
+	fprintf(stderr, "Defaults: l1i=32k:8:64 l1d=32k:8:64 l2=256k:8:64 l3=2m:16:64, LRU, write back, write allocate\n");
+}
+
+bool ParseLevel(const std::string &name, CacheHierarchy::Level &level)
+{
+	for(int i = 0; i < CacheHierarchy::Level_Count; ++i) {
+		if(name == CacheHierarchy::GetLevelName((CacheHierarchy::Level)i)) {
+			level = (CacheHierarchy::Level)i;
+			return true;
+		}
+	}
+	return false;
+}
+
+const char *GetPolicyName(ReplacementPolicy policy)
+{
+	switch(policy) {
+		case Replacement_LRU: return "lru";
+		case Replacement_PLRU: return "plru";
+		case Replacement_RRIP: return "rrip";
+		default: return "unknown";
+	}
+}
+
+double Percent(uint64_t count, uint64_t total)
+{
+	return total ? (count * 100.0) / total : 0;
+}
+
+int main(int argc, char **argv)
+{
+	const char *defaults[CacheHierarchy::Level_Count] = { "32k:8:64", "32k:8:64", "256k:8:64", "2m:16:64" };
+	CacheConfig configs[CacheHierarchy::Level_Count];
+	std::string error;
+	for(int i = 0; i < CacheHierarchy::Level_Count; ++i) configs[i].Parse(defaults[i], error);
+
+	size_t top = 20;
+	CacheHierarchy::Level rank_level = CacheHierarchy::Level_L1D;
+
+	int opt;
+	while((opt = getopt(argc, argv, "c:n:p:")) != -1) {
+		switch(opt) {
+			case 'c': {
+				std::string arg (optarg);
+				size_t equals = arg.find('=');
+				CacheHierarchy::Level level;
+				if(equals == std::string::npos || !ParseLevel(arg.substr(0, equals), level)) {
+					PrintUsage(argv[0]);
+					return 1;
+				}
+				if(!configs[level].Parse(arg.substr(equals + 1), error)) {
+					fprintf(stderr, "%s\n", error.c_str());
+					return 1;
+				}
+				break;
+			}
+			case 'n':
+				top = strtoull(optarg, NULL, 0);
+				break;
+			case 'p':
+				if(!ParseLevel(optarg, rank_level)) {
+					PrintUsage(argv[0]);
+					return 1;
+				}
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	CacheHierarchy hierarchy (configs);
+	hierarchy.Run(reader);
+
+	printf("Instructions: %lu\n\n", hierarchy.GetInstructionCount());
+	printf("%-5s %10s %4s %4s %-6s %14s %14s %7s %14s %14s %7s %14s\n", "level", "size", "ways", "line", "policy", "reads", "read misses", "", "writes", "write misses", "", "writebacks");
+	for(int i = 0; i < CacheHierarchy::Level_Count; ++i) {
+		CacheHierarchy::Level level = (CacheHierarchy::Level)i;
+		if(!hierarchy.HasLevel(level)) continue;
+
+		const CacheConfig &config = hierarchy.GetCache(level).GetConfig();
+		const CacheStats &stats = hierarchy.GetCache(level).GetStats();
+		printf("%-5s %10lu %4u %4u %-6s %14lu %14lu %6.2f%% %14lu %14lu %6.2f%% %14lu\n", CacheHierarchy::GetLevelName(level), config.size, config.associativity, config.line_size, GetPolicyName(config.policy),
+			stats.reads, stats.read_misses, Percent(stats.read_misses, stats.reads),
+			stats.writes, stats.write_misses, Percent(stats.write_misses, stats.writes),
+			stats.writebacks);
+	}
+	printf("\nMemory reads: %lu, writes: %lu (lines)\n", hierarchy.GetMemoryReads(), hierarchy.GetMemoryWrites());
+
+	// rank PCs by the misses they caused at one level
+	typedef std::pair<uint64_t, CacheHierarchy::PCMisses> pc_misses_t;
+	std::vector<pc_misses_t> pcs (hierarchy.GetPCMisses().begin(), hierarchy.GetPCMisses().end());
+	top = std::min(top, pcs.size());
+	std::partial_sort(pcs.begin(), pcs.begin() + top, pcs.end(), [rank_level](const pc_misses_t &a, const pc_misses_t &b) {
+		return a.second.misses[rank_level] != b.second.misses[rank_level] ? a.second.misses[rank_level] > b.second.misses[rank_level] : a.first < b.first;
+	});
+
+	printf("\nPCs with the most %s misses:\n  %-16s", CacheHierarchy::GetLevelName(rank_level), "pc");
+	for(int i = 0; i < CacheHierarchy::Level_Count; ++i) {
+		if(hierarchy.HasLevel((CacheHierarchy::Level)i)) printf(" %14s", CacheHierarchy::GetLevelName((CacheHierarchy::Level)i));
+	}
+	printf("\n");
+	for(size_t i = 0; i < top && pcs[i].second.misses[rank_level]; ++i) {
+		printf("  %016lx", pcs[i].first);
+		for(int level = 0; level < CacheHierarchy::Level_Count; ++level) {
+			if(hierarchy.HasLevel((CacheHierarchy::Level)level)) printf(" %14lu", pcs[i].second.misses[level]);
+		}
+		printf("\n");
+	}
+
+	return 0;
+}
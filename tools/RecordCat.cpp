@@ -1,19 +1,53 @@
+#include "libtrace/ArchModule.h"
 #include "libtrace/RecordFile.h"
 #include "libtrace/InstructionPrinter.h"
 
 #include <iostream>
+#include <memory>
 #include <cstdio>
 
+#include <unistd.h>
+
 using namespace libtrace;
 
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a architecture module] [record file]\n", name);
+	fprintf(stderr, "  -a module      disassemble instructions with an architecture module (a shared object)\n");
+}
+
 int main(int argc, char **argv)
 {
-	if(argc == 1) {
-		fprintf(stderr, "Usage: %s [record file]\n", argv[0]);
+	const char *module_path = nullptr;
+	
+	int opt;
+	while((opt = getopt(argc, argv, "a:")) != -1) {
+		switch(opt) {
+			case 'a':
+				module_path = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+	
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
 		return 1;
 	}
 	
-	FILE *rfile = fopen(argv[1], "r");
+	ArchModule module;
+	std::unique_ptr<CachingArchInterface> arch;
+	if(module_path) {
+		if(!module.Load(module_path)) {
+			fprintf(stderr, "Could not load architecture module: %s\n", module.GetError().c_str());
+			return 1;
+		}
+		arch.reset(new CachingArchInterface(module.GetInterface()));
+	}
+	
+	FILE *rfile = fopen(argv[optind], "r");
 	if(!rfile) {
 		perror("Could not open file");
 		return 1;
@@ -23,12 +57,10 @@ int main(int argc, char **argv)
 	RecordBufferStreamAdaptor rbsa (&rf);
 	TracePacketStreamAdaptor tpsa(&rbsa);
 	
-	auto begin = rf.begin();
-	auto end = rf.end();
-	
 	InstructionPrinter ip;
+	ip.SetArchInterface(arch.get());
 	
-	while(begin != end) {
+	while(tpsa.Good()) {
 		std::cout << ip(&tpsa) << std::endl;
 	}
 	
@@ -0,0 +1,117 @@
+#include "libtrace/RecordBlockReader.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+// inputs are copied in chunks of this many records, so that a few large
+// inputs still spread over all of the threads
+static const uint64_t kChunkRecords = 1 << 26;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-j threads] [-o output file] [record file]...\n", name);
+	fprintf(stderr, "Concatenates traces, each of which must start at an instruction boundary\n");
+}
+
+struct Chunk {
+	size_t input;
+	uint64_t first, count;
+	uint64_t out_offset;
+};
+
+int main(int argc, char **argv)
+{
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	const char *output = NULL;
+
+	int opt;
+	while((opt = getopt(argc, argv, "j:o:")) != -1) {
+		switch(opt) {
+			case 'j':
+				threads = std::max(1ul, strtoul(optarg, NULL, 0));
+				break;
+			case 'o':
+				output = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(!output || argc - optind < 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::vector<RecordBlockReader> readers;
+	for(int i = optind; i < argc; ++i) {
+		FILE *f = fopen(argv[i], "r");
+		if(!f) {
+			perror(argv[i]);
+			return 1;
+		}
+		readers.push_back(RecordBlockReader(f));
+
+		Record first;
+		if(readers.back().Read(0, &first, 1) == 1 && ((TraceRecord*)&first)->GetType() != InstructionHeader) {
+			fprintf(stderr, "%s does not start with an instruction header\n", argv[i]);
+			return 1;
+		}
+	}
+
+	// every input has a fixed place in the output, so chunks can be
+	// written in any order
+	std::vector<Chunk> chunks;
+	uint64_t out_offset = 0;
+	for(size_t i = 0; i < readers.size(); ++i) {
+		for(uint64_t first = 0; first < readers[i].Size(); first += kChunkRecords) {
+			uint64_t count = std::min(kChunkRecords, readers[i].Size() - first);
+			chunks.push_back(Chunk {i, first, count, out_offset});
+			out_offset += count * sizeof(Record);
+		}
+	}
+
+	int fd = open(output, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+	if(fd < 0) {
+		perror(output);
+		return 1;
+	}
+	if(ftruncate(fd, out_offset)) {
+		perror(output);
+		return 1;
+	}
+
+	std::atomic<size_t> next_chunk (0);
+	std::atomic<bool> failed (false);
+	auto worker = [&]() {
+		size_t i;
+		while((i = next_chunk++) < chunks.size()) {
+			const Chunk &chunk = chunks[i];
+			if(readers[chunk.input].CopyTo(chunk.first, chunk.count, fd, chunk.out_offset) != chunk.count) failed = true;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 1; i < std::min<size_t>(threads, chunks.size()); ++i) workers.push_back(std::thread(worker));
+	worker();
+	for(auto &i : workers) i.join();
+
+	close(fd);
+
+	if(failed) {
+		fprintf(stderr, "Short copy while concatenating traces\n");
+		return 1;
+	}
+
+	return 0;
+}
@@ -1,178 +1,191 @@
 #include "libtrace/RecordTypes.h"
 #include "libtrace/RecordFile.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/InstructionPrinter.h"
+#include "libtrace/InstructionState.h"
+#include "libtrace/StateDiff.h"
+#include "libtrace/TraceIndex.h"
 
 #include <cstdio>
 #include <cstdlib>
 
-#include <algorithm>
-#include <map>
-#include <set>
+#include <string>
+#include <thread>
 
-using namespace libtrace;
-
-TraceRecord TR(Record r) {
-	return *(TraceRecord*)&r;
-}
+#include <unistd.h>
 
-InstructionHeaderRecord IH(Record r) {
-	return *(InstructionHeaderRecord*)&r;
-}
-InstructionCodeRecord IC(Record r) {
-	return *(InstructionCodeRecord*)&r;
-}
+using namespace libtrace;
 
-MemReadAddrRecord MRA(Record r) {
-	return *(MemReadAddrRecord*)&r;
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-i rule file] [-r rule] [-n max divergences] [record file 1] [record file 2] ([start] | [start 1] [start 2])\n", name);
+	fprintf(stderr, "Rules have the form '<pc|code|reg|addr> <value>[/<mask>] [<pc|code|reg|memread|memwrite|all>,...]'\n");
 }
 
-MemReadDataRecord MRD(Record r) {
-	return *(MemReadDataRecord*)&r;
-}
+std::string PrintInstruction(RecordFile &file, uint64_t record_idx)
+{
+	RecordBufferStreamAdaptor adaptor (&file);
+	adaptor.Skip(record_idx);
+	TracePacketStreamAdaptor tpsa (&adaptor);
 
-MemWriteAddrRecord MWA(Record r) {
-	return *(MemWriteAddrRecord*)&r;
+	InstructionPrinter ip;
+	return ip(&tpsa);
 }
 
-MemWriteDataRecord MWD(Record r) {
-	return *(MemWriteDataRecord*)&r;
+void PrintValue(const Divergence &divergence, uint64_t value, bool present)
+{
+	if(!present) printf("(none)");
+	else if(divergence.divergence_class == Divergence_MemRead || divergence.divergence_class == Divergence_MemWrite) printf("%02lx", value);
+	else printf("%08lx", value);
 }
 
 int main(int argc, char **argv)
 {
-	FILE *f1 = fopen(argv[1], "r");
-	FILE *f2 = fopen(argv[2], "r");
-	
+	StateDiffRules rules;
+	uint64_t max_divergences = 0;
+	std::string error;
+
+	int opt;
+	while((opt = getopt(argc, argv, "i:r:n:")) != -1) {
+		switch(opt) {
+			case 'i': {
+				FILE *rule_file = fopen(optarg, "r");
+				if(!rule_file) {
+					perror("Could not open rule file");
+					return 1;
+				}
+				bool loaded = rules.LoadRules(rule_file, error);
+				fclose(rule_file);
+				if(!loaded) {
+					fprintf(stderr, "%s\n", error.c_str());
+					return 1;
+				}
+				break;
+			}
+			case 'r':
+				if(!rules.AddRule(optarg, error)) {
+					fprintf(stderr, "%s\n", error.c_str());
+					return 1;
+				}
+				break;
+			case 'n':
+				max_divergences = strtoull(optarg, NULL, 0);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	int positional = argc - optind;
+	if(positional < 2 || positional > 4) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	const char *name1 = argv[optind], *name2 = argv[optind+1];
+	FILE *f1 = fopen(name1, "r");
+	FILE *f2 = fopen(name2, "r");
+
 	if(!f1 || !f2) {
+		perror("Could not open file");
 		return 1;
 	}
-	
-	RecordFile rf1 (f1);
-	RecordFile rf2 (f2);
-	
+
 	uint64_t start1 = 0;
 	uint64_t start2 = 0;
-	
-	if(argc == 4) {
-		start1 = atoi(argv[3]);
+
+	if(positional >= 3) {
+		start1 = strtoull(argv[optind+2], NULL, 0);
 		start2 = start1;
 	}
-	if(argc == 5) {
-		start1 = atoi(argv[3]);
-		start2 = atoi(argv[4]);
+	if(positional == 4) {
+		start2 = strtoull(argv[optind+3], NULL, 0);
 	}
-	
-	auto it1 = rf1.begin();
-	auto it2 = rf2.begin();
-	
-	uint64_t ctr1 = start1, ctr2 = start2;
-	
-	// seek to starts
-	while(start1) {
-		if(TR(*it1).GetType() == InstructionHeader) start1--;
-		it1++;
-	}
-	
-	while(start2) {
-		if(TR(*it2).GetType() == InstructionHeader) start2--;
-		it2++;
+
+	RecordBlockReader rf1 (f1);
+	RecordBlockReader rf2 (f2);
+
+	// seek to the starts using the trace indices
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	TraceIndex index1, index2;
+	std::thread index_thread ([&]() { index2.LoadOrBuild(name2, rf2, threads); });
+	index1.LoadOrBuild(name1, rf1, threads);
+	index_thread.join();
+
+	uint64_t record1, record2;
+	if(!index1.GetInstructionRecord(rf1, start1, record1) || !index2.GetInstructionRecord(rf2, start2, record2)) {
+		fprintf(stderr, "Start instruction is beyond the end of the trace\n");
+		return 1;
 	}
-	
-	std::map<uint32_t, uint32_t> file1_mem, file2_mem;
-	
-	// make sure we are at an instruction header
-	while(TR(*it1).GetType() != InstructionHeader) it1++;
-	while(TR(*it2).GetType() != InstructionHeader) it2++;
-
-	std::set<uint32_t> ignore_codes { 0x180cf93, 0x1841f93, 0x1830f91, 0x1824f9c, 0x1820f91, 0x1831f92, 0x1892f93, 0x1812f93, 0x18c0f91, 0x1821f93, 0x180ef9c, 0x1801f92, 0x181cf90, 0x18c1f92, 0x1802f93, 0x1842f93, 0x180cf91, 0x1a32f96, 0x1821f95, 0x1830f92, 0x181cf92, 0x1841f92 };
-
-	uint64_t counter = 0;
-
-	// scan until PC divergence
-	while(true) {
-	
-		file1_mem.clear();
-		file2_mem.clear();
-		
-		ctr1++;
-		ctr2++;
-		counter++;
-		
-		if((counter % 10000000) == 0) printf("%lu...\n", counter);
-
-		if(IH(*it1).GetPC() != IH(*it2).GetPC()) {
-			printf("Divergence detected at instruction %lu %lu\n", ctr1, ctr2);
-			return 1;
+
+	// used to print the context of each divergence
+	RecordFile print_file1 (f1), print_file2 (f2);
+
+	uint64_t class_counts[Divergence_ClassCount] = {0};
+	uint64_t divergent_instructions = 0;
+	uint64_t last_reported = ~0ULL;
+
+	StateDiff diff (rules);
+	auto reporter = [&](const Divergence &divergence) {
+		if(divergence.instruction_idx1 != last_reported) {
+			last_reported = divergence.instruction_idx1;
+			divergent_instructions++;
+
+			printf("Divergence detected at instruction %lu %lu\n", divergence.instruction_idx1 + 1, divergence.instruction_idx2 + 1);
+			printf("  1: %s\n", PrintInstruction(print_file1, divergence.instruction1->record_idx).c_str());
+			printf("  2: %s\n", PrintInstruction(print_file2, divergence.instruction2->record_idx).c_str());
 		}
-		
-		it1++;
-		it2++;
-		uint32_t code = IC(*it1).GetIR();
-		bool check = true;
-		             
-//		if((code & 0xff00ff0) == 0x1800f90) check = false;
-//		else if((code & 0xff00ff0) == 0x1a00f90) check = false;
-//		else if(ignore_codes.count(code & 0x0fffffff)) check = false;
-
-		do {
-			if(TR(*it1).GetType() == MemReadAddr) {
-				MemReadAddrRecord mra = MRA(*it1++);
-				MemReadDataRecord mrd = MRD(*it1++);
-				
-				for(uint32_t i = 0; i < mra.GetWidth(); ++i) file1_mem.insert({mra.GetAddress() + i, (mrd.GetData() >> (i*8)) & 0xff});
-				//file1_mem.insert({mra.GetAddress(), mrd.GetData()});
-				
-			} else if(TR(*it1).GetType() == MemWriteAddr) {
-				MemWriteAddrRecord mwa = MWA(*it1++);
-				MemWriteDataRecord mwd = MWD(*it1++);
-				
-				for(uint32_t i = 0; i < mwa.GetWidth(); ++i) file1_mem.insert({mwa.GetAddress() + i, (mwd.GetData() >> (i*8)) & 0xff});
-				//file1_mem.insert({mwa.GetAddress(), mwd.GetData()});
-				
-			} else {
-				it1++;
-			}
-		} while(TR(*it1).GetType() != InstructionHeader);
-
-		do {
-			if(TR(*it2).GetType() == MemReadAddr) {
-				MemReadAddrRecord mra = MRA(*it2++);
-				MemReadDataRecord mrd = MRD(*it2++);
-				
-				for(uint32_t i = 0; i < mra.GetWidth(); ++i) file2_mem.insert({mra.GetAddress() + i, (mrd.GetData() >> (i*8)) & 0xff});
-				
-				//file2_mem.insert({mra.GetAddress(), mrd.GetData()});
-				
-			} else if(TR(*it2).GetType() == MemWriteAddr) {
-				MemWriteAddrRecord mwa = MWA(*it2++);
-				MemWriteDataRecord mwd = MWD(*it2++);
-				
-				for(uint32_t i = 0; i < mwa.GetWidth(); ++i) file2_mem.insert({mwa.GetAddress() + i, (mwd.GetData() >> (i*8)) & 0xff});
-				
-				//file2_mem.insert({mwa.GetAddress(), mwd.GetData()});
-				
-			} else {
-				it2++;
-			}
-		} while(TR(*it2).GetType() != InstructionHeader);
-
-		if(check) {
-			if(file1_mem.size() && file2_mem.size()) {
-				if(file1_mem != file2_mem) {
-					printf("Memory divergence detected at instruction %lu %lu\n", ctr1, ctr2);
-					
-					std::set<uint32_t> addrs;
-					for(auto i : file1_mem) addrs.insert(i.first);
-					for(auto i : file2_mem) addrs.insert(i.first);
-					
-					for(auto i : addrs) {
-						printf("%08x %08x %08x\n", i, file1_mem[i], file2_mem[i]);
-					}
-					
-					return 1;
-				}
-			}
+		class_counts[divergence.divergence_class]++;
+
+		printf("  %-8s ", GetDivergenceClassName(divergence.divergence_class));
+		switch(divergence.divergence_class) {
+			case Divergence_RegWrite:
+				if(divergence.key & kBankedRegister) printf("R[%lu][%lu] ", (divergence.key >> 8) & 0xff, divergence.key & 0xff);
+				else printf("R[%lu] ", divergence.key);
+				break;
+			case Divergence_MemRead:
+			case Divergence_MemWrite:
+				printf("[%08lx] ", divergence.key);
+				break;
+			default:
+				break;
+		}
+		PrintValue(divergence, divergence.value1, divergence.present1);
+		printf(" ");
+		PrintValue(divergence, divergence.value2, divergence.present2);
+		printf("\n");
+	};
+
+	InstructionStateReader reader1 (rf1, record1, start1);
+	InstructionStateReader reader2 (rf2, record2, start2);
+
+	const InstructionStateBatch *batch1 = reader1.Next(), *batch2 = reader2.Next();
+	size_t i1 = 0, i2 = 0;
+	uint64_t compared = 0;
+
+	while(batch1 && batch2) {
+		if(i1 == batch1->instructions.size()) {
+			batch1 = reader1.Next();
+			i1 = 0;
+			continue;
+		}
+		if(i2 == batch2->instructions.size()) {
+			batch2 = reader2.Next();
+			i2 = 0;
+			continue;
 		}
 
+		compared++;
+		if(!diff.Compare(*batch1, i1++, *batch2, i2++, reporter)) break;
+		if(max_divergences && divergent_instructions >= max_divergences) break;
 	}
-	
+
+	printf("Compared %lu instructions, %lu divergent:", compared, divergent_instructions);
+	for(int c = 0; c < Divergence_ClassCount; ++c) {
+		printf(" %s=%lu", GetDivergenceClassName((DivergenceClass)c), class_counts[c]);
+	}
+	printf("\n");
+
+	return divergent_instructions ? 1 : 0;
 }
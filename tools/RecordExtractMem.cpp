@@ -1,8 +1,12 @@
 #include "libtrace/RecordTypes.h"
-#include "libtrace/RecordFile.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceSummary.h"
 
+#include <algorithm>
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
+#include <vector>
 
 using namespace libtrace;
 
@@ -10,10 +14,6 @@ TraceRecord TR(Record r) {
 	return *(TraceRecord*)&r;
 }
 
-InstructionHeaderRecord IH(Record r) {
-	return *(InstructionHeaderRecord*)&r;
-}
-
 MemReadAddrRecord MRA(Record r) {
 	return *(MemReadAddrRecord*)&r;
 }
@@ -22,37 +22,38 @@ MemReadDataRecord MRD(Record r) {
 	return *(MemReadDataRecord*)&r;
 }
 
-MemWriteAddrRecord MWA(Record r) {
-	return *(MemWriteAddrRecord*)&r;
-}
-
-MemWriteDataRecord MWD(Record r) {
-	return *(MemWriteDataRecord*)&r;
-}
-
 
 
 int main(int argc, char **argv)
 {
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s [record file] [address]\n", argv[0]);
+		return 1;
+	}
+
 	FILE *f = fopen(argv[1], "r");
-	RecordFile rf (f);
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
 	
 	uint32_t seek_addr = strtol(argv[2], NULL, 16);
 	
-	auto it = rf.begin();
-	auto end = rf.end();
+	RecordBlockReader reader(f);
+	TraceSummary summary;
+	summary.LoadOrBuild(argv[1], reader, std::thread::hardware_concurrency());
 	
-	while(it != end) 
-	{
-		if(TR(*it).GetType() == MemReadAddr) {
-			if(seek_addr == MRA(*it).GetAddress()) {
-				it++;
-				printf("%u\n", MRD(*it).GetData());
-			} else {
-				it++;
+	// one extra record, for the data of a read at the end of a chunk
+	std::vector<Record> buffer (summary.GetChunkRecords() + 1);
+	for(size_t chunk = 0; chunk < summary.GetChunkCount(); ++chunk) {
+		if(!summary.MayMatch(chunk, seek_addr, ~0u, 1u << MemReadAddr)) continue;
+		
+		size_t n = reader.Read(chunk * summary.GetChunkRecords(), buffer.data(), buffer.size());
+		size_t end = std::min<size_t>(n, summary.GetChunkRecords());
+		for(size_t i = 0; i < end; ++i) {
+			if(TR(buffer[i]).GetType() == MemReadAddr && seek_addr == MRA(buffer[i]).GetAddress() && i + 1 < n) {
+				printf("%u\n", MRD(buffer[i+1]).GetData());
 			}
-		} else {
-			it++;
 		}
 	}
 
@@ -0,0 +1,120 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/InstructionState.h"
+#include "libtrace/FilterExpression.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+static const size_t kCopyRecords = 1 << 16;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-v] [-c | -l] [-a ASID register] [expression] [record file]\n", name);
+	fprintf(stderr, "Writes the records of every instruction matching the expression to stdout.\n");
+	fprintf(stderr, "  -v  select instructions which do not match\n");
+	fprintf(stderr, "  -c  only print the number of matching instructions\n");
+	fprintf(stderr, "  -l  list the index and PC of matching instructions instead\n");
+	fprintf(stderr, "Fields: pc code isa mode asid index reg_writes mem_reads mem_writes\n");
+	fprintf(stderr, "Functions: reg(n) writes_reg(n) reads_mem(lo, hi) writes_mem(lo, hi) accesses_mem(lo, hi)\n");
+	fprintf(stderr, "e.g. \"(pc & 0xf0000000) != 0xc0000000 && asid == 3\"\n");
+}
+
+void CopyRecords(const RecordBlockReader &reader, uint64_t first, uint64_t last, std::vector<Record> &buffer)
+{
+	while(first < last) {
+		size_t count = reader.Read(first, buffer.data(), std::min<uint64_t>(buffer.size(), last - first));
+		if(!count) break;
+		fwrite(buffer.data(), sizeof(Record), count, stdout);
+		first += count;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	bool invert = false, count_only = false, list = false;
+	FilterExpression filter;
+
+	int opt;
+	while((opt = getopt(argc, argv, "vcla:")) != -1) {
+		switch(opt) {
+			case 'v':
+				invert = true;
+				break;
+			case 'c':
+				count_only = true;
+				break;
+			case 'l':
+				list = true;
+				break;
+			case 'a':
+				filter.SetASIDRegister(strtoul(optarg, NULL, 0));
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 2) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::string error;
+	if(!filter.Compile(argv[optind], error)) {
+		fprintf(stderr, "%s\n", error.c_str());
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind + 1], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	InstructionStateReader states (reader, 0, 0);
+	std::vector<uint8_t> matches;
+	std::vector<Record> buffer (kCopyRecords);
+
+	// consecutive matching instructions are copied as a single run of records
+	uint64_t matched = 0;
+	bool in_run = false;
+	uint64_t run_start = 0;
+
+	while(const InstructionStateBatch *batch = states.Next()) {
+		filter.Evaluate(*batch, matches);
+
+		for(size_t i = 0; i < matches.size(); ++i) {
+			const InstructionState &insn = batch->instructions[i];
+			bool match = matches[i] != invert;
+			matched += match;
+
+			if(list) {
+				if(match) printf("%lu %016lx\n", batch->first_instruction + i, insn.pc);
+				continue;
+			}
+			if(count_only) continue;
+
+			if(match && !in_run) {
+				run_start = insn.record_idx;
+				in_run = true;
+			} else if(!match && in_run) {
+				CopyRecords(reader, run_start, insn.record_idx, buffer);
+				in_run = false;
+			}
+		}
+	}
+	if(in_run) CopyRecords(reader, run_start, reader.Size(), buffer);
+
+	if(count_only) printf("%lu\n", matched);
+
+	return 0;
+}
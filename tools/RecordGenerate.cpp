@@ -0,0 +1,167 @@
+#include "libtrace/SegmentedTrace.h"
+#include "libtrace/SharedMemoryTrace.h"
+#include "libtrace/TraceGenerator.h"
+#include "libtrace/TraceIndex.h"
+#include "libtrace/TraceSink.h"
+#include "libtrace/TraceSummary.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <string>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	TraceGeneratorConfig defaults = TraceGenerator::GetDefaultConfig();
+
+	fprintf(stderr, "Usage: %s [options] [output file]\n", name);
+	fprintf(stderr, "       %s [options] -P <name>\n", name);
+	fprintf(stderr, "  -n <count>     instructions (%lu)\n", defaults.instructions);
+	fprintf(stderr, "  -s <seed>      random seed (%lu)\n", defaults.seed);
+	fprintf(stderr, "  -w             64 bit PCs, values and addresses\n");
+	fprintf(stderr, "  -b <count>     basic blocks in the program (%u)\n", defaults.blocks);
+	fprintf(stderr, "  -l <count>     mean instructions per block (%u)\n", defaults.block_length);
+	fprintf(stderr, "  -B <fraction>  blocks ending in a conditional branch (%g)\n", defaults.branch_fraction);
+	fprintf(stderr, "  -L <fraction>  blocks ending in a loop (%g)\n", defaults.loop_fraction);
+	fprintf(stderr, "  -i <count>     mean loop iterations (%u)\n", defaults.loop_iterations);
+	fprintf(stderr, "  -r <mean>      register reads per instruction (%g)\n", defaults.reg_reads);
+	fprintf(stderr, "  -R <mean>      register writes per instruction (%g)\n", defaults.reg_writes);
+	fprintf(stderr, "  -m <mean>      memory reads per instruction (%g)\n", defaults.mem_reads);
+	fprintf(stderr, "  -M <mean>      memory writes per instruction (%g)\n", defaults.mem_writes);
+	fprintf(stderr, "  -p <pattern>   address pattern: stride, random or chase (stride)\n");
+	fprintf(stderr, "  -W <bytes>     working set size (%lu)\n", defaults.working_set);
+	fprintf(stderr, "  -S <bytes>     stride (%u)\n", defaults.stride);
+	fprintf(stderr, "  -x <bytes>     access width (%u)\n", defaults.access_width);
+	fprintf(stderr, "  -a <count>     instructions between ASID switches, 0 for none (%lu)\n", defaults.asid_interval);
+	fprintf(stderr, "  -A <count>     number of ASIDs (%u)\n", defaults.asids);
+	fprintf(stderr, "  -z             write a chunk summary next to the output\n");
+	fprintf(stderr, "  -D             write with O_DIRECT where supported\n");
+	fprintf(stderr, "  -k <records>   write segments of about this many records, with a manifest\n");
+	fprintf(stderr, "  -K <count>     write segments of this many instructions, with a manifest\n");
+	fprintf(stderr, "  -P <name>      publish to shared memory for live readers instead of a file\n");
+	fprintf(stderr, "  -y             wait for slow live readers instead of letting them lose records\n");
+}
+
+int main(int argc, char **argv)
+{
+	TraceGeneratorConfig config = TraceGenerator::GetDefaultConfig();
+	bool summarise = false, direct = false;
+	uint64_t segment_records = 0, segment_insns = 0;
+	std::string shared_name;
+	bool blocking = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:s:wb:l:B:L:i:r:R:m:M:p:W:S:x:a:A:zDk:K:P:y")) != -1) {
+		switch(opt) {
+			case 'n': config.instructions = strtoull(optarg, NULL, 0); break;
+			case 's': config.seed = strtoull(optarg, NULL, 0); break;
+			case 'w': config.wide = true; break;
+			case 'b': config.blocks = strtoul(optarg, NULL, 0); break;
+			case 'l': config.block_length = strtoul(optarg, NULL, 0); break;
+			case 'B': config.branch_fraction = strtod(optarg, NULL); break;
+			case 'L': config.loop_fraction = strtod(optarg, NULL); break;
+			case 'i': config.loop_iterations = strtoul(optarg, NULL, 0); break;
+			case 'r': config.reg_reads = strtod(optarg, NULL); break;
+			case 'R': config.reg_writes = strtod(optarg, NULL); break;
+			case 'm': config.mem_reads = strtod(optarg, NULL); break;
+			case 'M': config.mem_writes = strtod(optarg, NULL); break;
+			case 'p':
+				if(!TraceGeneratorConfig::ParsePattern(optarg, config.pattern)) {
+					PrintUsage(argv[0]);
+					return 1;
+				}
+				break;
+			case 'W': config.working_set = strtoull(optarg, NULL, 0); break;
+			case 'S': config.stride = strtoul(optarg, NULL, 0); break;
+			case 'x': config.access_width = strtoul(optarg, NULL, 0); break;
+			case 'a': config.asid_interval = strtoull(optarg, NULL, 0); break;
+			case 'A': config.asids = strtoul(optarg, NULL, 0); break;
+			case 'z': summarise = true; break;
+			case 'D': direct = true; break;
+			case 'k': segment_records = strtoull(optarg, NULL, 0); break;
+			case 'K': segment_insns = strtoull(optarg, NULL, 0); break;
+			case 'P': shared_name = optarg; break;
+			case 'y': blocking = true; break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	bool shared = !shared_name.empty();
+	if(argc - optind != (shared ? 0 : 1)) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::string path = shared ? "" : argv[optind];
+	bool segmented = segment_records || segment_insns;
+	if(shared && (summarise || segmented || direct)) {
+		fprintf(stderr, "Only records can be published to shared memory\n");
+		return 1;
+	}
+	if((summarise || segmented) && path == "-") {
+		fprintf(stderr, "A summary or segments can only be written for an output file\n");
+		return 1;
+	}
+	if(summarise && segmented) {
+		fprintf(stderr, "Summaries are not supported for segmented output\n");
+		return 1;
+	}
+
+	// files are written from a background thread, but stdout may not be
+	// seekable so it is written directly
+	std::unique_ptr<BinaryFileTraceSink> stdout_sink;
+	std::unique_ptr<AsyncFileTraceSink> file_sink;
+	std::unique_ptr<SegmentedFileTraceSink> segment_sink;
+	std::unique_ptr<SharedMemoryTraceSink> shared_sink;
+	TraceSink *output;
+	if(shared) {
+		shared_sink.reset(new SharedMemoryTraceSink(shared_name, SharedMemoryTraceSink::kDefaultCapacity, blocking));
+		output = shared_sink.get();
+	} else if(segmented) {
+		segment_sink.reset(new SegmentedFileTraceSink(path, segment_records, segment_insns));
+		output = segment_sink.get();
+	} else if(path == "-") {
+		stdout_sink.reset(new BinaryFileTraceSink(stdout));
+		output = stdout_sink.get();
+	} else {
+		FILE *f = fopen(path.c_str(), "w");
+		if(!f) {
+			perror("Could not open output file");
+			return 1;
+		}
+		fclose(f);
+
+		// anything built from an earlier trace at this path is now stale
+		remove(TraceIndex::GetSidecarPath(path).c_str());
+		if(!summarise) remove(TraceSummary::GetSidecarPath(path).c_str());
+
+		file_sink.reset(new AsyncFileTraceSink(path, direct));
+		output = file_sink.get();
+	}
+
+	SummaryTraceSink summary_sink (output, path);
+	TraceSource source (TraceSource::RecordBufferSize);
+	source.SetSink(summarise ? &summary_sink : output);
+	source.SetAggressiveFlush(false);
+
+	TraceGenerator generator (config);
+	generator.Generate(source);
+
+	source.Flush();
+	source.Terminate();
+
+	// closing the file modifies it after the summary was last saved
+	if(summarise) {
+		file_sink.reset();
+		summary_sink.GetSummary().SaveSidecar(path);
+	}
+
+	return 0;
+}
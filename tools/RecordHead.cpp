@@ -1,5 +1,6 @@
 #include "libtrace/RecordTypes.h"
 #include "libtrace/RecordStream.h"
+#include "libtrace/TraceInput.h"
 
 #include <vector>
 
@@ -7,20 +8,28 @@
 #include <cstdlib>
 #include <cstring>
 
+#include <unistd.h>
+
 using namespace libtrace;
 
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f] [record file] [instructions]\n", name);
+	fprintf(stderr, "%s", TraceInput::kFollowUsage);
+}
+
 int main(int argc, char **argv)
 {
-	FILE *f;
-	
-	if(!strcmp(argv[1], "-")) f = stdin;
-	else f = fopen(argv[1], "r");	
-	
-	if(!f) return 1;
+	TraceInput input;
+	if(!input.ParseOptions(argc, argv) || argc - optind != 2) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	if(!input.Open(argv[optind])) return 1;
 	
-	RecordStream rf(f);
+	RecordStream rf(input.GetFile(), input.GetFollower());
 	
-	uint64_t count = strtol(argv[2], NULL, 0);
+	uint64_t count = strtol(argv[optind+1], NULL, 0);
 	
 	std::vector<Record> buffer;
 	while(count > 0 && rf.good()) {
@@ -5,15 +5,44 @@
  */
 
 #include <libtrace/RecordFile.h>
+#include <libtrace/SegmentedTrace.h>
+
+#include <memory>
+#include <string>
 
 using namespace libtrace;
 
 int main(int argc, char **argv) {
-	char *filename = argv[1];
+	if(argc != 2) {
+		fprintf(stderr, "Usage: %s [record file or segment manifest]\n", argv[0]);
+		return 1;
+	}
+	
+	std::string filename = argv[1];
+	std::unique_ptr<SegmentedTraceReader> segments;
+	std::unique_ptr<RecordFile> file;
+	RecordBufferInterface *buffer;
 	
-	RecordFile file(fopen(filename, "r"));
+	// a segmented trace is read through its manifest as one trace
+	const std::string suffix = ".manifest";
+	if(filename.size() > suffix.size() && filename.compare(filename.size() - suffix.size(), suffix.size(), suffix) == 0) {
+		segments.reset(new SegmentedTraceReader());
+		buffer = segments.get();
+		if(!segments->Open(filename)) {
+			fprintf(stderr, "Could not open manifest %s\n", filename.c_str());
+			return 1;
+		}
+	} else {
+		FILE *f = fopen(filename.c_str(), "r");
+		if(!f) {
+			perror("Could not open file");
+			return 1;
+		}
+		file.reset(new RecordFile(f));
+		buffer = file.get();
+	}
 	
-	RecordBufferStreamAdaptor rbsa(&file);
+	RecordBufferStreamAdaptor rbsa(buffer);
 	while(rbsa.Good()) {
 		Record r = rbsa.Get();
 		
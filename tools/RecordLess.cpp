@@ -1,30 +1,63 @@
 #include "libtrace/RecordFile.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/InstructionIndexer.h"
+#include "libtrace/RecordSearch.h"
+#include "libtrace/TraceSummary.h"
+#include "libtrace/TraceFollower.h"
 #include "libtrace/InstructionPrinter.h"
 
+#include <chrono>
+#include <condition_variable>
 #include <map>
+#include <mutex>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include <cstdio>
 #include <iostream>
 
 #include <ncurses.h>
+#include <unistd.h>
 
 using namespace libtrace;
 
 #define BOOKMARK_WIDTH 10000
 
+// how often to redraw while waiting for the indexer, in ms
+#define POLL_INTERVAL 100
+
+// number of screens of lines to format ahead of the viewport in each direction
+#define LINE_CACHE_PAGES 4
+
 int64_t top_index = 0;
 int64_t left_offset = 0;
 
 RecordFile *open_file = nullptr;
+RecordBlockReader *block_reader = nullptr;
+InstructionIndexer *indexer = nullptr;
+RecordSearch *searcher = nullptr;
+TraceSummary *summary = nullptr;
+TraceFollower *follower = nullptr;
+
+// set while new instructions are being picked up as the trace is written
+bool following = false;
 
 uint32_t terminal_height, terminal_width;
 
-std::map<uint64_t, uint64_t> instruction_header_bookmarks;
+// instruction to jump to once it has been indexed
+int64_t goto_target = 0;
+
+// set when part of the screen could not be drawn because it has not been
+// indexed yet
+bool screen_incomplete = false;
+uint64_t drawn_instruction_count = 0;
 
 std::string input_buffer;
 
+// shown in the status bar until the next key press
+std::string status_message;
+
 std::vector<std::string> search_history;
 int32_t search_history_index;
 
@@ -32,7 +65,9 @@ enum InputMode {
 	Input_Command,
 	Input_Goto,
 	Input_Goto_Waiting,
-	Input_Search
+	Input_End_Waiting,
+	Input_Search,
+	Input_Search_Waiting
 };
 
 enum DisplayMode {
@@ -43,22 +78,164 @@ enum DisplayMode {
 InputMode mode = Input_Command;
 DisplayMode display_mode = Display_All;
 
-bool DrawStatus();
-bool ExecuteSearch(bool);
+void ConfigurePrinter(InstructionPrinter &ip, DisplayMode display)
+{
+	if(display == Display_OnlyMem) {
+		ip.SetDisplayNone();
+		ip.SetDisplayMem();
+	} else {
+		ip.SetDisplayAll();
+	}
+}
 
-bool GetInstructionHeaderIndex(uint64_t instruction_idx, uint64_t &record_idx)
+// Formatted lines around the viewport, keyed by instruction and display
+// mode. A worker thread fills the viewport and a few screens either side of
+// it, so that scrolling and paging usually only have to update the terminal.
+class LineCache
 {
-	uint64_t bookmark = (instruction_idx / BOOKMARK_WIDTH) * BOOKMARK_WIDTH;
-	record_idx = 0;
+public:
+	LineCache(const RecordBlockReader &reader, InstructionIndexer &indexer) : reader_(reader), indexer_(indexer), top_(0), height_(0), display_(Display_All), changed_(false), stopping_(false)
+	{
+		thread_ = std::thread(&LineCache::Run, this);
+	}
+	
+	~LineCache()
+	{
+		{
+			std::lock_guard<std::mutex> guard (lock_);
+			stopping_ = true;
+		}
+		cond_.notify_one();
+		thread_.join();
+	}
+	
+	bool Get(uint64_t insn, DisplayMode display, std::string &line)
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		auto i = lines_[display].find(insn);
+		if(i == lines_[display].end()) return false;
+		line = i->second;
+		return true;
+	}
+	
+	void Put(uint64_t insn, DisplayMode display, const std::string &line)
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		lines_[display][insn] = line;
+	}
+	
+	void SetViewport(uint64_t top, uint64_t height, DisplayMode display)
+	{
+		std::lock_guard<std::mutex> guard (lock_);
+		if(top == top_ && height == height_ && display == display_) return;
+		
+		top_ = top;
+		height_ = height;
+		display_ = display;
+		changed_ = true;
+		
+		// forget lines which are well outside the area being filled
+		uint64_t margin = 2 * height * LINE_CACHE_PAGES;
+		uint64_t low = top > margin ? top - margin : 0;
+		uint64_t high = top + height + margin;
+		for(auto &lines : lines_) {
+			lines.erase(lines.begin(), lines.lower_bound(low));
+			lines.erase(lines.upper_bound(high), lines.end());
+		}
+		
+		cond_.notify_one();
+	}
+	
+private:
+	void Run()
+	{
+		RecordBlockBuffer buffer (reader_);
+		
+		std::unique_lock<std::mutex> guard (lock_);
+		while(!stopping_) {
+			changed_ = false;
+			uint64_t top = top_, height = height_, ahead = height_ * LINE_CACHE_PAGES;
+			DisplayMode display = display_;
+			guard.unlock();
+			
+			// the viewport and the screens below it first, then those above
+			bool complete = Fill(buffer, top, top + height + ahead, display);
+			if(complete) complete = Fill(buffer, top > ahead ? top - ahead : 0, top, display);
+			
+			// wait for the viewport to move, or for more of the trace to be
+			// indexed if some lines could not be filled
+			guard.lock();
+			if(changed_ || stopping_) continue;
+			if(complete) cond_.wait(guard);
+			else cond_.wait_for(guard, std::chrono::milliseconds(POLL_INTERVAL));
+		}
+	}
+	
+	// Format the lines in [first, last) which are not already cached. Returns
+	// false if the viewport changed or part of the range is not indexed yet.
+	bool Fill(RecordBlockBuffer &buffer, uint64_t first, uint64_t last, DisplayMode display)
+	{
+		{
+			std::lock_guard<std::mutex> guard (lock_);
+			while(first < last && lines_[display].count(first)) first++;
+		}
+		if(first >= last) return true;
+		
+		uint64_t insn, record_idx;
+		if(!indexer_.GetBookmark(first, insn, record_idx)) return indexer_.IsComplete();
+		
+		// walk from the bookmark to the first instruction to format
+		uint64_t size = buffer.Size();
+		while(insn < first) {
+			record_idx++;
+			while(record_idx < size && TraceRecord(buffer.Get(record_idx)).GetType() != InstructionHeader) record_idx++;
+			if(record_idx >= size) return indexer_.IsComplete();
+			insn++;
+		}
+		
+		RecordBufferStreamAdaptor adaptor (&buffer);
+		adaptor.Skip(record_idx);
+		TracePacketStreamAdaptor tpsa (&adaptor);
+		
+		InstructionPrinter ip;
+		ConfigurePrinter(ip, display);
+		
+		for(; insn < last; ++insn) {
+			if(!tpsa.Good()) return indexer_.IsComplete();
+			std::string line = ip(&tpsa);
+			
+			std::lock_guard<std::mutex> guard (lock_);
+			if(changed_ || stopping_) return false;
+			lines_[display][insn] = line;
+		}
+		return true;
+	}
 	
-	auto bookmark_it = instruction_header_bookmarks.upper_bound(bookmark);
-	bookmark_it--;
+	const RecordBlockReader &reader_;
+	InstructionIndexer &indexer_;
 	
-	uint64_t current_idx = bookmark_it->first;
-	record_idx = bookmark_it->second;
+	std::mutex lock_;
+	std::condition_variable cond_;
+	std::map<uint64_t, std::string> lines_[2];
+	
+	uint64_t top_, height_;
+	DisplayMode display_;
+	bool changed_, stopping_;
+	
+	std::thread thread_;
+};
+
+LineCache *line_cache = nullptr;
+
+bool DrawStatus();
+bool ExecuteSearch(bool, bool);
+
+bool GetInstructionHeaderIndex(uint64_t instruction_idx, uint64_t &record_idx)
+{
+	uint64_t current_idx;
+	if(!indexer->GetBookmark(instruction_idx, current_idx, record_idx)) return false;
 	
 	while(current_idx < instruction_idx) {
-		if((current_idx % BOOKMARK_WIDTH) == 0) instruction_header_bookmarks[current_idx] = record_idx;
 		if(open_file->Size() <= record_idx) return false;
 		
 		Record r = open_file->Get(record_idx);
@@ -77,8 +254,6 @@ bool GetInstructionHeaderIndex(uint64_t instruction_idx, uint64_t &record_idx)
 		current_idx++;
 	}
 	
-	//fprintf(stderr, "For I %lu, got index %lu\n", instruction_idx, record_idx);
-	
 	assert(current_idx == instruction_idx);
 	
 	return true;
@@ -91,8 +266,9 @@ bool SetupScreen()
 	//raw();
 	keypad(stdscr, 1);
 	
-	// This is not true if we have metadata
-	instruction_header_bookmarks[0] = 0;
+	// wake up periodically so that indexing progress can be shown
+	timeout(POLL_INTERVAL);
+	set_escdelay(25);
 	return true;
 }
 
@@ -102,31 +278,102 @@ bool ReleaseScreen()
 	return true;
 }
 
+int64_t GetLastPageIndex()
+{
+	int64_t last = (int64_t)indexer->GetInstructionCount() - (terminal_height-1);
+	return last < 0 ? 0 : last;
+}
+
 void ScanToEnd()
 {
-	// first, check to see what our last bookmark is
-	top_index = instruction_header_bookmarks.rbegin()->first;
+	// jump to whatever has been indexed so far, and keep following the end
+	// of the index until it is complete (or, while following the trace,
+	// until a key is pressed)
+	top_index = GetLastPageIndex();
+	if(!indexer->IsComplete() || following) mode = Input_End_Waiting;
+}
+
+// Pick up anything written to the trace since the last check. Only complete
+// instructions are shown, so that one which is still being written is never
+// drawn. Returns true if the screen needs to be redrawn.
+bool UpdateFollow()
+{
+	bool grown = false;
+	if(follower->WaitForGrowth(0)) {
+		uint64_t size = block_reader->Size();
+		grown = block_reader->RefreshComplete() != size;
+		if(grown) open_file->Refresh(block_reader->Size());
+	}
 	
-	uint64_t record_idx = instruction_header_bookmarks.rbegin()->second;
+	// the indexer carries on from where it stopped, keeping its bookmarks
+	indexer->Update();
+	return grown;
+}
+
+void SetFollowing(bool follow)
+{
+	following = follow;
+	if(following) {
+		UpdateFollow();
+		ScanToEnd();
+		return;
+	}
 	
+	// show the rest of the trace, including any partly written instruction
+	block_reader->Refresh();
+	open_file->Refresh(block_reader->Size());
+	indexer->Update();
+}
+
+// Called when there has been no input for a while. Completes any jumps which
+// were waiting for the indexer, and returns true if the screen needs to be
+// redrawn.
+bool UpdatePending()
+{
+	uint64_t count = indexer->GetInstructionCount();
 	
-	while(true) {
-		if(record_idx >= open_file->Size()) break;
+	switch(mode) {
+		case Input_Goto_Waiting:
+			if((uint64_t)goto_target < count) {
+				top_index = goto_target;
+				mode = Input_Command;
+			} else if(indexer->IsComplete()) {
+				// the trace is shorter than the requested instruction
+				top_index = GetLastPageIndex();
+				mode = Input_Command;
+			}
+			return true;
 		
-		Record r = open_file->Get(record_idx);
-		TraceRecord *tr = (TraceRecord*)&r;
-		if(tr->GetType() == InstructionHeader) {
-			if((top_index % BOOKMARK_WIDTH) == 0) instruction_header_bookmarks[top_index] = record_idx;
-			top_index++;
+		case Input_End_Waiting:
+			top_index = GetLastPageIndex();
+			if(indexer->IsComplete() && !following) mode = Input_Command;
+			return true;
+		
+		case Input_Search_Waiting: {
+			if(searcher->IsRunning()) return true;
+			
+			uint64_t match_idx, instruction_idx;
+			if(!searcher->GetMatch(match_idx)) {
+				status_message = "Pattern not found";
+				mode = Input_Command;
+			} else if(indexer->GetInstruction(match_idx, instruction_idx)) {
+				top_index = instruction_idx;
+				mode = Input_Command;
+			}
+			// otherwise wait for the indexer to reach the match
+			return true;
 		}
-		record_idx++;
+		
+		default:
+			break;
 	}
+	
+	// fill in any lines which have been indexed since the last draw
+	return screen_incomplete && (count != drawn_instruction_count || indexer->IsComplete());
 }
 
-bool HandleInputCommand()
+bool HandleInputCommand(int ch)
 {
-	int ch = getch();
-	
 	switch(ch) {
 		case KEY_UP: 
 			if(top_index > 0) top_index--;
@@ -157,6 +404,11 @@ bool HandleInputCommand()
 			ScanToEnd();
 			break;
 		
+		case 'F':
+			SetFollowing(!following);
+			status_message = following ? "Following" : "Stopped following";
+			break;
+		
 		case 'm':
 			if(display_mode == Display_All) display_mode = Display_OnlyMem;
 			else display_mode = Display_All;
@@ -180,8 +432,7 @@ bool HandleInputCommand()
 		case 'n':
 			if(search_history.size()) {
 				input_buffer = search_history.back();
-				top_index++;
-				ExecuteSearch(ch == 'b');
+				ExecuteSearch(ch == 'b', true);
 			}
 			break;
 		
@@ -189,10 +440,8 @@ bool HandleInputCommand()
 	return true;
 }
 
-bool HandleInputGoto()
+bool HandleInputGoto(int ch)
 {
-	int ch = getch();
-	
 	switch(ch) {
 		case KEY_BACKSPACE:
 			if(input_buffer.empty()) mode = Input_Command;
@@ -204,13 +453,11 @@ bool HandleInputGoto()
 			break;
 		
 		case '\n':
-			top_index = strtol(input_buffer.c_str(), NULL, 10)-1;
+			// wait (without blocking input) for the target to be indexed
+			goto_target = strtol(input_buffer.c_str(), NULL, 10)-1;
+			if(goto_target < 0) goto_target = 0;
 			mode = Input_Goto_Waiting;
-			
-			// redraw status while we wait for the goto to complete
-			DrawStatus();
-			refresh();
-			
+			UpdatePending();
 			break;
 		default:
 			break;
@@ -218,12 +465,28 @@ bool HandleInputGoto()
 	return true;
 }
 
-bool ExecuteSearch(bool reverse)
+// Search patterns are hex digits with 'x' as a wildcard nibble, optionally
+// prefixed with the type of record to search, e.g. "pc:8000xxxx".
+bool ParseSearch(const std::string &input, uint32_t &search_data, uint32_t &search_mask, uint32_t &search_types)
 {
-	search_history.push_back(input_buffer);
+	std::string pattern = input;
+	search_types = RecordSearch::kAllTypes;
+	
+	size_t colon = input.find(':');
+	if(colon != std::string::npos) {
+		std::string type = input.substr(0, colon);
+		pattern = input.substr(colon+1);
+		
+		if(type == "pc") search_types = RecordSearch::TypeBit(InstructionHeader);
+		else if(type == "code") search_types = RecordSearch::TypeBit(InstructionCode);
+		else if(type == "reg") search_types = RecordSearch::TypeBit(RegRead) | RecordSearch::TypeBit(RegWrite) | RecordSearch::TypeBit(BankRegRead) | RecordSearch::TypeBit(BankRegWrite);
+		else if(type == "mem") search_types = RecordSearch::TypeBit(MemReadAddr) | RecordSearch::TypeBit(MemWriteAddr);
+		else if(type == "data") search_types = RecordSearch::TypeBit(MemReadData) | RecordSearch::TypeBit(MemWriteData);
+		else return false;
+	}
 	
 	std::string search_bits, search_mask_bits;
-	for(auto i : input_buffer) {
+	for(auto i : pattern) {
 		i = tolower(i);
 		switch(i){
 			case '0'...'9':
@@ -240,40 +503,46 @@ bool ExecuteSearch(bool reverse)
 		}
 	}
 	
-	uint32_t search_data = strtol(search_bits.c_str(), NULL, 16);
-	uint32_t search_mask = strtol(search_mask_bits.c_str(), NULL, 16);
+	search_data = strtoul(search_bits.c_str(), NULL, 16);
+	search_mask = strtoul(search_mask_bits.c_str(), NULL, 16);
+	return true;
+}
+
+// Start a search in the background. A new search includes the top
+// instruction, whereas searching again starts after it so that the current
+// match is skipped.
+bool ExecuteSearch(bool reverse, bool again)
+{
+	mode = Input_Command;
 	
-	int8_t addend = reverse ? -1 : 1;
+	uint32_t search_data, search_mask, search_types;
+	if(!ParseSearch(input_buffer, search_data, search_mask, search_types)) {
+		status_message = "Invalid search pattern";
+		return false;
+	}
 	
-	// start scanning through records for a match
 	uint64_t record_idx;
+	if(!GetInstructionHeaderIndex(top_index, record_idx)) return false;
 	
-	GetInstructionHeaderIndex(top_index, record_idx);
-	record_idx += addend;
-	
-	uint64_t instruction_match_idx = top_index;
-	
-	while(true) {
-		if(record_idx >= open_file->Size()) return false;
-		Record r = open_file->Get(record_idx);
-		TraceRecord *tr = (TraceRecord*)&r;
-		
-		if(tr->GetType() ==  InstructionHeader) instruction_match_idx += addend;
-		if((tr->GetData32() & search_mask) == search_data) break;
-		
-		record_idx += addend;		
+	uint64_t from = record_idx;
+	if(reverse) {
+		if(record_idx == 0) {
+			status_message = "Pattern not found";
+			return false;
+		}
+		from = record_idx - 1;
+	} else if(again) {
+		if(!GetInstructionHeaderIndex(top_index+1, from)) from = record_idx + 1;
 	}
 	
-	top_index = instruction_match_idx;
-	mode = Input_Command;
+	searcher->Start(search_data, search_mask, search_types, from, reverse);
+	mode = Input_Search_Waiting;
 	
 	return true;
 }
 
-bool HandleInputSearch()
+bool HandleInputSearch(int ch)
 {
-	int ch = getch();
-	
 	if(ch >= 32 && ch < 256) input_buffer.push_back(ch);
 	else {
 		switch(ch) {
@@ -282,7 +551,8 @@ bool HandleInputSearch()
 				else input_buffer.pop_back();
 				break;
 			case '\n':
-				ExecuteSearch(false);
+				search_history.push_back(input_buffer);
+				ExecuteSearch(false, false);
 				break;
 				
 			case KEY_UP:
@@ -306,19 +576,31 @@ bool HandleInputSearch()
 	return true;
 }
 
-bool HandleInput()
+bool HandleInput(int ch)
 {
+	status_message = "";
+	
 	switch(mode) {
+		case Input_Search_Waiting:
+			searcher->Cancel();
+			mode = Input_Command;
+			return true;
+		
 		case Input_Goto_Waiting:
-			mode = Input_Command; //fall through
+		case Input_End_Waiting:
+			// any key cancels a pending jump
+			mode = Input_Command;
+			if(following && ch == 'F') return HandleInputCommand(ch);
+			return true;
+		
 		case Input_Command:
-			return HandleInputCommand();
+			return HandleInputCommand(ch);
 			
 		case Input_Goto:
-			return HandleInputGoto();
+			return HandleInputGoto(ch);
 
 		case Input_Search:
-			return HandleInputSearch();
+			return HandleInputSearch(ch);
 
 		default:
 			assert(false && "Unknown mode");
@@ -330,83 +612,168 @@ bool DrawStatus()
 {
 	// Draw input/status bar
 	move(terminal_height-1, 0);
+	clrtoeol();
 	switch(mode) {
-		case Input_Command:	printw(":"); break;
+		case Input_Command:	printw(":%s", status_message.c_str()); break;
 		
 		case Input_Goto: printw("# %s", input_buffer.c_str()); break;
-		case Input_Goto_Waiting: printw("# %s...", input_buffer.c_str()); break;
+		case Input_Goto_Waiting: printw("# %s... (any key to cancel)", input_buffer.c_str()); break;
+		case Input_End_Waiting:
+			if(following) printw("FOLLOWING... (any key to stop scrolling, F to stop following)");
+			else printw("END... (any key to cancel)");
+			break;
 		
 		case Input_Search: printw("/ %s", input_buffer.c_str()); break;
+		case Input_Search_Waiting: {
+			uint64_t total = searcher->GetTotalRecords();
+			uint64_t percent = total ? (searcher->GetScannedRecords() * 100) / total : 100;
+			printw("/ %s... %lu%% (any key to cancel)", input_buffer.c_str(), percent);
+			break;
+		}
 	}
 	
-	// Draw current top line number (+1 since index is 0 based but humans are 1-based)
-	char buffer[16];
-	int chars = snprintf(buffer, 16, "%lu", top_index+1);
+	// Draw current top line number (+1 since index is 0 based but humans are 1-based),
+	// and the progress of the indexer if it is still running
+	char buffer[96];
+	int chars;
+	const char *follow_state = following ? "[following] " : "";
+	if(indexer->IsComplete()) {
+		chars = snprintf(buffer, sizeof(buffer), "%s%lu", follow_state, top_index+1);
+	} else {
+		uint64_t total = indexer->GetTotalRecords();
+		uint64_t percent = total ? (indexer->GetScannedRecords() * 100) / total : 100;
+		chars = snprintf(buffer, sizeof(buffer), "%s[indexing %lu%%, %lu insns] %lu", follow_state, percent, indexer->GetInstructionCount(), top_index+1);
+	}
 	move(terminal_height-1, terminal_width-chars);
-	printw(buffer);	
+	printw("%s", buffer);
 	return true;
 }
 
 bool DrawScreen()
 {
-	clear();
+	// erase rather than clear, so that curses only sends the lines which
+	// have changed
+	erase();
 	getmaxyx(stdscr, terminal_height, terminal_width);
 	
+	line_cache->SetViewport(top_index, terminal_height-1, display_mode);
+	
 	// Draw instruction info
 	InstructionPrinter ip;
+	ConfigurePrinter(ip, display_mode);
 	
-	if(display_mode == Display_OnlyMem) {
-		ip.SetDisplayNone();
-		ip.SetDisplayMem();
-	} else {
-		ip.SetDisplayAll();
-	}
+	drawn_instruction_count = indexer->GetInstructionCount();
+	screen_incomplete = false;
 	
 	for(uint64_t line = 0; line < terminal_height-1; ++line) {
 		uint64_t i = line + top_index;
 		
-		uint64_t target_idx = 0;
-		bool exists = GetInstructionHeaderIndex(i, target_idx);
+		std::string insn;
+		bool exists = line_cache->Get(i, display_mode, insn);
 		
-		if(exists) {
-			RecordBufferStreamAdaptor adaptor (open_file);
-			adaptor.Skip(target_idx);
-			TracePacketStreamAdaptor tpsa(&adaptor);
-			move(line, 0);
-			
-			std::string insn = ip(&tpsa);
+		if(!exists) {
+			// not cached yet, so format it here
+			uint64_t target_idx = 0;
+			exists = GetInstructionHeaderIndex(i, target_idx);
+			if(!exists && !indexer->IsComplete()) screen_incomplete = true;
 			
-			if(insn.size() > left_offset)
-				printw("%s", insn.substr(left_offset, terminal_width).c_str());
+			if(exists) {
+				RecordBufferStreamAdaptor adaptor (open_file);
+				adaptor.Skip(target_idx);
+				TracePacketStreamAdaptor tpsa(&adaptor);
+				
+				insn = ip(&tpsa);
+				line_cache->Put(i, display_mode, insn);
+			}
+		}
+		
+		if(exists && insn.size() > left_offset) {
+			move(line, 0);
+			printw("%s", insn.substr(left_offset, terminal_width).c_str());
 		}
 	}
 	
 	DrawStatus();
 	
-	refresh();
-	
-	return HandleInput();
+	return true;
+}
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f] [record file]\n", name);
+	fprintf(stderr, "  -f             follow a trace which is still being written (toggled with F)\n");
 }
 
 int main(int argc, char **argv)
 {
-	if(argc == 1) {
-		fprintf(stderr, "Usage: %s [record file]\n", argv[0]);
+	bool follow = false;
+	
+	int opt;
+	while((opt = getopt(argc, argv, "f")) != -1) {
+		switch(opt) {
+			case 'f':
+				follow = true;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+	
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
 		return 1;
 	}
+	const char *path = argv[optind];
 	
-	FILE *file = fopen(argv[1], "r");
+	FILE *file = fopen(path, "r");
 	if(!file) {
 		perror("Could not open file");
 		return 1;
 	}
 	
+	// when following, the end of the trace may be part way through being
+	// written, so only complete instructions are used from the start
+	block_reader = new RecordBlockReader(file, follow);
 	open_file = new RecordFile(file);
+	open_file->Refresh(block_reader->Size());
+	follower = new TraceFollower(path);
+	indexer = new InstructionIndexer(*block_reader, BOOKMARK_WIDTH);
+	searcher = new RecordSearch(*block_reader, std::thread::hardware_concurrency());
+	
+	// searches skip chunks using the trace's summary, if it has one
+	summary = new TraceSummary();
+	if(summary->LoadSidecar(path, *block_reader)) searcher->SetSummary(summary);
+	line_cache = new LineCache(*block_reader, *indexer);
 	
 	SetupScreen();
-	while(DrawScreen()) ;
+	if(follow) SetFollowing(true);
+	
+	bool redraw = true;
+	while(true) {
+		if(redraw) DrawScreen();
+		else DrawStatus();
+		refresh();
+		
+		int ch = getch();
+		if(ch == ERR) {
+			bool grown = following && UpdateFollow();
+			redraw = UpdatePending() || grown;
+			continue;
+		}
+		
+		if(!HandleInput(ch)) break;
+		redraw = true;
+	}
+	
 	ReleaseScreen();
 	
+	delete line_cache;
+	delete searcher;
+	delete summary;
+	delete follower;
+	delete indexer;
+	delete block_reader;
 	delete open_file;
 	return 0;
 }
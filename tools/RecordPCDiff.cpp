@@ -1,77 +1,173 @@
 #include "libtrace/RecordTypes.h"
-#include "libtrace/RecordFile.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/PCStream.h"
+#include "libtrace/TraceAligner.h"
+#include "libtrace/TraceIndex.h"
 
 #include <cstdio>
 #include <cstdlib>
 
+#include <thread>
+#include <vector>
+
+#include <unistd.h>
+
 using namespace libtrace;
 
-TraceRecord TR(Record r) {
-	return *(TraceRecord*)&r;
+static const size_t kCompareChunk = 4096;
+
+// Position a PC stream at the given instruction, using the index to skip
+// straight to the enclosing block
+void SeekInstruction(const TraceIndex &index, PCStreamReader &stream, uint64_t insn)
+{
+	uint64_t remaining = insn % index.GetBlockSize();
+	std::vector<uint64_t> discard (remaining);
+	stream.Read(discard.data(), remaining);
 }
 
-InstructionHeaderRecord IH(Record r) {
-	return *(InstructionHeaderRecord*)&r;
+// Compare the two PC streams directly until they diverge or one of them
+// ends. Returns true on divergence, with the offset (relative to the start
+// of the comparison) in position.
+bool CompareStreams(PCStreamReader &s1, PCStreamReader &s2, uint64_t &position, bool &ended1, bool &ended2)
+{
+	std::vector<uint64_t> pcs1 (kCompareChunk), pcs2 (kCompareChunk);
+	position = 0;
+
+	while(true) {
+		size_t n1 = s1.Read(pcs1.data(), kCompareChunk);
+		size_t n2 = s2.Read(pcs2.data(), kCompareChunk);
+		size_t n = std::min(n1, n2);
+
+		size_t mismatch = FindFirstMismatch(pcs1.data(), pcs2.data(), n);
+		position += mismatch;
+		if(mismatch != n) return true;
+
+		if(n1 != n2 || n < kCompareChunk) {
+			ended1 = n1 == n;
+			ended2 = n2 == n;
+			return false;
+		}
+	}
+}
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-a] [-w window] [-l anchor length] [record file 1] [record file 2] ([start 1] [start 2])\n", name);
+	fprintf(stderr, "  -a  align the traces after each divergence and report every divergent region\n");
 }
 
 int main(int argc, char **argv)
 {
-	FILE *f1 = fopen(argv[1], "r");
-	FILE *f2 = fopen(argv[2], "r");
-	
+	bool align = false;
+	size_t window = TraceAligner::kDefaultWindow;
+	size_t anchor_length = TraceAligner::kDefaultAnchorLength;
+
+	int opt;
+	while((opt = getopt(argc, argv, "aw:l:")) != -1) {
+		switch(opt) {
+			case 'a': align = true; break;
+			case 'w': window = strtoull(optarg, NULL, 0); break;
+			case 'l': anchor_length = strtoull(optarg, NULL, 0); break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	int positional = argc - optind;
+	if((positional != 2 && positional != 4) || window == 0 || anchor_length == 0) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	const char *name1 = argv[optind], *name2 = argv[optind+1];
+	FILE *f1 = fopen(name1, "r");
+	FILE *f2 = fopen(name2, "r");
+
 	if(!f1 || !f2) {
+		perror("Could not open file");
 		return 1;
 	}
-	
-	RecordFile rf1 (f1);
-	RecordFile rf2 (f2);
-	
+
+	RecordBlockReader rf1 (f1);
+	RecordBlockReader rf2 (f2);
+
 	uint64_t start1 = 0;
 	uint64_t start2 = 0;
-	
-	if(argc == 5) {
-		start1 = atoi(argv[3]);
-		start2 = atoi(argv[4]);
+
+	if(positional == 4) {
+		start1 = strtoull(argv[optind+2], NULL, 0);
+		start2 = strtoull(argv[optind+3], NULL, 0);
+	}
+
+	// index both traces at once (or pick up the indices stored next to them)
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	TraceIndex index1, index2;
+	std::thread index_thread ([&]() { index2.LoadOrBuild(name2, rf2, threads); });
+	index1.LoadOrBuild(name1, rf1, threads);
+	index_thread.join();
+
+	if(start1 >= index1.GetInstructionCount() || start2 >= index2.GetInstructionCount()) {
+		fprintf(stderr, "Start instruction is beyond the end of the trace\n");
+		return 1;
 	}
-	
-	auto it1 = rf1.begin();
-	auto it2 = rf2.begin();
-	
-	uint64_t ctr1 = start1, ctr2 = start2;
-	
-	// seek to starts
-	while(start1) {
-		if(TR(*it1).GetType() == InstructionHeader) start1--;
-		it1++;
+
+	const uint64_t block_size = index1.GetBlockSize();
+
+	// Bisect for the longest matching run by comparing the hashes of the
+	// instructions from each start. The candidate lengths end on block
+	// boundaries in the first trace, so only the second trace's partial
+	// blocks need to be read, whatever the two start offsets are.
+	uint64_t max_length = std::min(index1.GetInstructionCount() - start1, index2.GetInstructionCount() - start2);
+	uint64_t lead = (block_size - (start1 % block_size)) % block_size;
+	auto candidate = [&](uint64_t k) {
+		return k == 0 ? 0 : std::min(lead + (k - 1) * block_size, max_length);
+	};
+
+	uint64_t lo = 0, hi = 1;
+	if(max_length > lead) hi += (max_length - lead + block_size - 1) / block_size;
+	while(lo < hi) {
+		uint64_t mid = lo + (hi - lo + 1) / 2;
+		uint64_t length = candidate(mid);
+		if(index1.GetInstructionRangeHash(rf1, start1, start1 + length) == index2.GetInstructionRangeHash(rf2, start2, start2 + length)) lo = mid;
+		else hi = mid - 1;
 	}
-	
-	while(start2) {
-		if(TR(*it2).GetType() == InstructionHeader) start2--;
-		it2++;
+
+	uint64_t compare1 = start1 + candidate(lo), compare2 = start2 + candidate(lo);
+
+	PCStreamReader s1 (rf1, compare1 < index1.GetInstructionCount() ? index1.GetBlock(compare1 / block_size).record_idx : rf1.Size());
+	PCStreamReader s2 (rf2, compare2 < index2.GetInstructionCount() ? index2.GetBlock(compare2 / block_size).record_idx : rf2.Size());
+	SeekInstruction(index1, s1, compare1);
+	SeekInstruction(index2, s2, compare2);
+
+	if(align) {
+		// everything before the compare points is already known to match
+		uint64_t regions = 0;
+		TraceAligner aligner (window, anchor_length);
+		uint64_t matched = aligner.Align(s1, compare1, s2, compare2, [&](const DivergentRegion &region) {
+			regions++;
+			printf("Divergent region at instruction %lu %lu: %lu %lu instructions%s\n", region.start1 + 1, region.start2 + 1, region.length1, region.length2, region.resynchronised ? "" : " (not resynchronised)");
+		});
+
+		printf("%lu divergent regions, %lu instructions matched\n", regions, matched + (compare1 - start1));
+		return regions ? 1 : 0;
 	}
-	
-	uint64_t diffed_count = 0;
-	
-	// scan until PC divergence
-	while(true) {
-	
-		// make sure we are at an instruction header
-		while(TR(*it1).GetType() != InstructionHeader) it1++;
-		while(TR(*it2).GetType() != InstructionHeader) it2++;
 
-		ctr1++;
-		ctr2++;
-		diffed_count++;
+	// locate the exact divergence (or the end of one of the traces)
+	uint64_t position;
+	bool ended1 = false, ended2 = false;
+	bool diverged = CompareStreams(s1, s2, position, ended1, ended2);
 
-		if((diffed_count % 10000000) == 0) printf("%lu...\n", diffed_count);
+	if(diverged) {
+		printf("Divergence detected at instruction %lu %lu\n", compare1 + position + 1, compare2 + position + 1);
+		return 1;
+	}
 
-		if(IH(*it1).GetPC() != IH(*it2).GetPC()) {
-			printf("Divergence detected at instruction %lu %lu\n", ctr1, ctr2);
-			return 1;
-		}
-		
-		it1++;
-		it2++;
+	if(ended1 && ended2) {
+		printf("No divergence detected in %lu instructions\n", compare1 + position - start1);
+		return 0;
 	}
-	
+
+	printf("Trace %s ended after instruction %lu\n", ended1 ? name1 : name2, (ended1 ? compare1 : compare2) + position);
+	return 1;
 }
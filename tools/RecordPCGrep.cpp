@@ -1,8 +1,11 @@
 #include "libtrace/RecordTypes.h"
-#include "libtrace/RecordFile.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceSummary.h"
 
 #include <cstdio>
 #include <cstdlib>
+#include <thread>
+#include <vector>
 
 using namespace libtrace;
 
@@ -17,25 +20,46 @@ InstructionHeaderRecord IH(Record r) {
 
 int main(int argc, char **argv)
 {
+	if(argc != 3) {
+		fprintf(stderr, "Usage: %s [record file] [pc]\n", argv[0]);
+		return 1;
+	}
+
 	FILE *f = fopen(argv[1], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
 	uint32_t pc = strtol(argv[2], NULL, 16);
 	
-	RecordFile rf(f);
-	auto it = rf.begin();
-	auto end = rf.end();
+	RecordBlockReader reader(f);
+	TraceSummary summary;
+	summary.LoadOrBuild(argv[1], reader, std::thread::hardware_concurrency());
 	
 	uint64_t index = 0;
 	uint32_t prev_pc = 0;
 	
-	while(it != end) {
-		if(TR(*it).GetType() == InstructionHeader) {
-			index++;
-			if(IH(*it).GetPC() == pc) {
-				printf("%llu (%08x)\n", index, prev_pc);
+	// chunks without the PC only need their instructions counted, which
+	// the summary already has
+	std::vector<Record> buffer (summary.GetChunkRecords());
+	for(size_t chunk = 0; chunk < summary.GetChunkCount(); ++chunk) {
+		if(!summary.MayMatch(chunk, pc, ~0u, 1u << InstructionHeader)) {
+			const TraceSummary::Chunk &c = summary.GetChunk(chunk);
+			index += c.instructions;
+			if(c.instructions) prev_pc = c.last_pc;
+			continue;
+		}
+		
+		size_t n = reader.Read(chunk * summary.GetChunkRecords(), buffer.data(), buffer.size());
+		for(size_t i = 0; i < n; ++i) {
+			if(TR(buffer[i]).GetType() == InstructionHeader) {
+				index++;
+				if(IH(buffer[i]).GetPC() == pc) {
+					printf("%llu (%08x)\n", index, prev_pc);
+				}
+				prev_pc = IH(buffer[i]).GetPC();
 			}
-			prev_pc = IH(*it).GetPC();
 		}
-		it++;
 	}
 	
 	return 0;
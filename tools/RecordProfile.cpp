@@ -0,0 +1,117 @@
+#include "libtrace/RecordTypes.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceProfile.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <thread>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n top entries] [-j threads] [record file]\n", name);
+}
+
+const char *GetTypeName(size_t type)
+{
+	switch(type) {
+		case Unknown: return "Unknown";
+		case InstructionHeader: return "Instruction Header";
+		case InstructionCode: return "Instruction Code";
+		case RegRead: return "Reg Read";
+		case RegWrite: return "Reg Write";
+		case BankRegRead: return "Bank Reg Read";
+		case BankRegWrite: return "Bank Reg Write";
+		case MemReadAddr: return "Mem Read Addr";
+		case MemReadData: return "Mem Read Data";
+		case MemWriteAddr: return "Mem Write Addr";
+		case MemWriteData: return "Mem Write Data";
+		case InstructionBundleHeader: return "Instruction Bundle Header";
+		case DataExtension: return "Data Extension";
+		default: return "Invalid";
+	}
+}
+
+double Percent(uint64_t count, uint64_t total)
+{
+	return total ? (count * 100.0) / total : 0;
+}
+
+void PrintMemStats(const char *name, const std::map<uint32_t, TraceProfile::MemStats> &stats)
+{
+	printf("\n%s:\n", name);
+	for(auto &i : stats) {
+		printf("  width %-3u %14lu accesses %14lu misaligned (%5.1f%%)\n", i.first, i.second.accesses, i.second.misaligned, Percent(i.second.misaligned, i.second.accesses));
+	}
+}
+
+int main(int argc, char **argv)
+{
+	size_t top = 20;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:j:")) != -1) {
+		switch(opt) {
+			case 'n':
+				top = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				threads = strtoul(optarg, NULL, 0);
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	TraceProfile profile;
+	profile.Build(reader, threads);
+
+	printf("Records:      %lu\n", profile.records);
+	printf("Instructions: %lu\n", profile.instructions);
+	printf("Unique PCs:   %lu\n", profile.pcs.size());
+	printf("Pages:        %lu (%u byte pages touched by memory accesses)\n", profile.pages.size(), 1u << TraceProfile::kPageBits);
+
+	printf("\nRecord types:\n");
+	for(size_t i = 0; i < sizeof(profile.record_types) / sizeof(profile.record_types[0]); ++i) {
+		if(!profile.record_types[i]) continue;
+		printf("  %-26s %14lu (%5.1f%%)\n", GetTypeName(i), profile.record_types[i], Percent(profile.record_types[i], profile.records));
+	}
+
+	printf("\nHottest PCs:\n");
+	for(auto &i : TraceProfile::GetTop(profile.pcs, top)) {
+		printf("  %016lx %14lu (%5.1f%%)\n", i.first, i.second, Percent(i.second, profile.instructions));
+	}
+
+	printf("\nMost common instruction words:\n");
+	for(auto &i : TraceProfile::GetTop(profile.codes, top)) {
+		printf("  %08lx %14lu (%5.1f%%)\n", i.first, i.second, Percent(i.second, profile.instructions));
+	}
+
+	PrintMemStats("Memory reads", profile.mem_reads);
+	PrintMemStats("Memory writes", profile.mem_writes);
+
+	printf("\nException modes:\n");
+	for(auto &i : profile.exception_modes) {
+		printf("  mode %-4u %14lu instructions (%5.1f%%)\n", i.first, i.second, Percent(i.second, profile.instructions));
+	}
+
+	return 0;
+}
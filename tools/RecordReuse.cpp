@@ -0,0 +1,172 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/InstructionState.h"
+#include "libtrace/ReuseDistance.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#include <string>
+#include <vector>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+// RecordASIDCat tracks the current ASID as writes to this register
+static const uint32_t kASIDRegister = 0xf0;
+
+enum GroupBy {
+	Group_None,
+	Group_ASID,
+	Group_PCRegion
+};
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-g none|asid|pc:<region bits>] [-s sample rate] [-m max sampled blocks] [-l line bits] [-p page bits] [-H] [record file]\n", name);
+	fprintf(stderr, "Reports LRU miss ratio curves for cache line (default 64 byte) and page (default 4KB) granularity accesses,\n");
+	fprintf(stderr, "optionally grouped by ASID or by the region of code making the access. -H also prints the reuse distance histograms.\n");
+}
+
+void PrintHistogram(const ReuseDistance::Histogram &histogram)
+{
+	printf("  %-24s %16s %8s\n", "distance", "accesses", "");
+	printf("  %-24s %16.0f %7.2f%%\n", "cold", histogram.cold, histogram.cold * 100 / histogram.accesses);
+	for(size_t i = 0; i < ReuseDistance::kBuckets; ++i) {
+		if(histogram.buckets[i] == 0) continue;
+
+		char range[32];
+		if(i <= 1) snprintf(range, sizeof(range), "%lu", i);
+		else snprintf(range, sizeof(range), "%lu-%lu", 1UL << (i - 1), (2UL << (i - 1)) - 1);
+		printf("  %-24s %16.0f %7.2f%%\n", range, histogram.buckets[i], histogram.buckets[i] * 100 / histogram.accesses);
+	}
+}
+
+void PrintSize(uint64_t bytes)
+{
+	const char *units[] = { "B", "KB", "MB", "GB", "TB", "PB", "EB" };
+	int unit = 0;
+	while(bytes >= 1024 && !(bytes & 1023)) {
+		bytes >>= 10;
+		unit++;
+	}
+	char size[32];
+	snprintf(size, sizeof(size), "%lu%s", bytes, units[unit]);
+	printf("  %12s", size);
+}
+
+void PrintResults(const ReuseDistance &analysis, const char *name, GroupBy group_by, bool histograms)
+{
+	printf("%s (%u byte blocks, sample rate %g):\n", name, 1U << analysis.GetBlockBits(), analysis.GetSampleRate());
+
+	for(auto &group : analysis.GetHistograms()) {
+		const ReuseDistance::Histogram &histogram = group.second;
+
+		if(group_by == Group_ASID) printf(" ASID %lx: ", group.first);
+		else if(group_by == Group_PCRegion) printf(" PCs %016lx: ", group.first);
+		else printf(" ");
+		printf("%.0f accesses, %.0f blocks\n", histogram.accesses, histogram.cold);
+
+		if(histograms) PrintHistogram(histogram);
+
+		printf("  %12s %10s\n", "cache size", "miss ratio");
+		std::vector<double> curve = ReuseDistance::GetMissRatioCurve(histogram);
+		for(size_t k = 0; k < curve.size() && k + analysis.GetBlockBits() < 64; ++k) {
+			PrintSize(1ULL << (k + analysis.GetBlockBits()));
+			printf(" %9.4f%%\n", curve[k] * 100);
+		}
+		printf("\n");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	GroupBy group_by = Group_None;
+	unsigned region_bits = 0;
+	unsigned line_bits = 6, page_bits = 12;
+	double sample_rate = 1.0;
+	size_t max_blocks = 0;
+	bool histograms = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "g:s:m:l:p:H")) != -1) {
+		switch(opt) {
+			case 'g':
+				if(!strcmp(optarg, "none")) group_by = Group_None;
+				else if(!strcmp(optarg, "asid")) group_by = Group_ASID;
+				else if(!strncmp(optarg, "pc:", 3)) {
+					group_by = Group_PCRegion;
+					region_bits = strtoul(optarg + 3, NULL, 0);
+				} else {
+					PrintUsage(argv[0]);
+					return 1;
+				}
+				break;
+			case 's':
+				sample_rate = strtod(optarg, NULL);
+				break;
+			case 'm':
+				max_blocks = strtoull(optarg, NULL, 0);
+				break;
+			case 'l':
+				line_bits = strtoul(optarg, NULL, 0);
+				break;
+			case 'p':
+				page_bits = strtoul(optarg, NULL, 0);
+				break;
+			case 'H':
+				histograms = true;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1 || !(sample_rate > 0 && sample_rate <= 1) || region_bits >= 64 || line_bits >= 64 || page_bits >= 64) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	FILE *f = fopen(argv[optind], "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	ReuseDistance lines (line_bits, sample_rate, max_blocks);
+	ReuseDistance pages (page_bits, sample_rate, max_blocks);
+
+	// instruction fetches are not included: the analysis is of the data
+	// accesses made by each instruction
+	InstructionStateReader states (reader, 0, 0);
+	uint64_t asid = 0;
+	while(const InstructionStateBatch *batch = states.Next()) {
+		for(auto &insn : batch->instructions) {
+			uint64_t group = 0;
+			if(group_by == Group_ASID) group = asid;
+			else if(group_by == Group_PCRegion) group = (insn.pc >> region_bits) << region_bits;
+
+			for(auto access = batch->MemReadsBegin(insn); access != batch->MemReadsEnd(insn); ++access) {
+				lines.Access(access->address, group);
+				pages.Access(access->address, group);
+			}
+			for(auto access = batch->MemWritesBegin(insn); access != batch->MemWritesEnd(insn); ++access) {
+				lines.Access(access->address, group);
+				pages.Access(access->address, group);
+			}
+
+			// a change of ASID takes effect from the next instruction
+			for(auto write = batch->RegWritesBegin(insn); write != batch->RegWritesEnd(insn); ++write) {
+				if(write->index == kASIDRegister) asid = (uint32_t)write->value;
+			}
+		}
+	}
+
+	PrintResults(lines, "Lines", group_by, histograms);
+	PrintResults(pages, "Pages", group_by, histograms);
+
+	return 0;
+}
@@ -0,0 +1,184 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceIndex.h"
+#include "libtrace/TraceSlicer.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <memory>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s -r first:end [-r first:end ...] [-j threads] [-o output prefix] [record file...]\n", name);
+	fprintf(stderr, "Cuts instructions [first, end) out of each trace (to the end of the trace if end is left out).\n");
+	fprintf(stderr, "The slices are written to stdout one after another, or with -o to <prefix>.0000, <prefix>.0001, ...\n");
+}
+
+struct Range {
+	uint64_t first, end;
+};
+
+struct Job {
+	size_t trace;
+	TraceSlice slice;
+	uint64_t out_offset;
+	int fd;
+};
+
+bool ParseRange(const char *text, Range &range)
+{
+	char *colon;
+	range.first = strtoull(text, &colon, 0);
+	if(colon == text || *colon != ':') return false;
+	
+	const char *end = colon + 1;
+	if(*end == 0) {
+		range.end = UINT64_MAX;
+		return true;
+	}
+	
+	char *tail;
+	range.end = strtoull(end, &tail, 0);
+	return *tail == 0 && range.end >= range.first;
+}
+
+int main(int argc, char **argv)
+{
+	std::vector<Range> ranges;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string prefix;
+
+	int opt;
+	while((opt = getopt(argc, argv, "r:j:o:")) != -1) {
+		switch(opt) {
+			case 'r': {
+				Range range;
+				if(!ParseRange(optarg, range)) {
+					fprintf(stderr, "Invalid range '%s'\n", optarg);
+					return 1;
+				}
+				ranges.push_back(range);
+				break;
+			}
+			case 'j':
+				threads = std::max(1ul, strtoul(optarg, NULL, 0));
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind < 1 || ranges.empty()) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	// every range is cut from every trace, in that order
+	std::vector<std::unique_ptr<RecordBlockReader>> readers;
+	std::vector<std::unique_ptr<TraceIndex>> indices;
+	std::vector<Job> jobs;
+
+	for(int i = optind; i < argc; ++i) {
+		std::string path = argv[i];
+		FILE *f = fopen(path.c_str(), "r");
+		if(!f) {
+			perror("Could not open file");
+			return 1;
+		}
+
+		readers.emplace_back(new RecordBlockReader(f));
+		indices.emplace_back(new TraceIndex());
+		indices.back()->LoadOrBuild(path, *readers.back(), threads);
+
+		TraceSlicer slicer (*readers.back(), *indices.back());
+		for(const auto &range : ranges) {
+			Job job { readers.size() - 1, {0, 0}, 0, -1 };
+			if(!slicer.Locate(range.first, range.end, job.slice)) {
+				fprintf(stderr, "%s does not contain instruction %lu\n", path.c_str(), range.first);
+				return 1;
+			}
+			jobs.push_back(job);
+		}
+	}
+
+	// Slices can be copied at once when each has its own file, or when
+	// stdout is a file which they can be placed in side by side. Pipes and
+	// files opened for appending have to be written in order.
+	bool parallel = true;
+	if(prefix.empty()) {
+		struct stat st;
+		off_t position = lseek(STDOUT_FILENO, 0, SEEK_CUR);
+		parallel = !fstat(STDOUT_FILENO, &st) && S_ISREG(st.st_mode) && position >= 0 && !(fcntl(STDOUT_FILENO, F_GETFL) & O_APPEND);
+
+		uint64_t offset = parallel ? position : 0;
+		for(auto &job : jobs) {
+			job.fd = STDOUT_FILENO;
+			job.out_offset = offset;
+			offset += job.slice.GetRecordCount() * sizeof(Record);
+		}
+	} else {
+		for(size_t i = 0; i < jobs.size(); ++i) {
+			char suffix[32];
+			snprintf(suffix, sizeof(suffix), ".%04lu", i);
+			std::string name = prefix + suffix;
+
+			jobs[i].fd = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+			if(jobs[i].fd < 0) {
+				perror(name.c_str());
+				return 1;
+			}
+		}
+	}
+
+	std::atomic<size_t> next_job (0);
+	std::atomic<bool> failed (false);
+	auto worker = [&]() {
+		size_t i;
+		while((i = next_job++) < jobs.size()) {
+			const Job &job = jobs[i];
+			TraceSlicer slicer (*readers[job.trace], *indices[job.trace]);
+
+			uint64_t copied = parallel ? slicer.CopyTo(job.slice, job.fd, job.out_offset) : slicer.WriteTo(job.slice, job.fd);
+			if(copied != job.slice.GetRecordCount()) failed = true;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	if(parallel) {
+		for(unsigned i = 1; i < std::min<uint64_t>(threads, jobs.size()); ++i) workers.push_back(std::thread(worker));
+	}
+	worker();
+	for(auto &i : workers) i.join();
+
+	if(prefix.empty()) {
+		// leave stdout after the slices, as if they had been written to it
+		if(parallel) lseek(STDOUT_FILENO, jobs.back().out_offset + jobs.back().slice.GetRecordCount() * sizeof(Record), SEEK_SET);
+	} else {
+		for(auto &job : jobs) close(job.fd);
+	}
+
+	if(failed) {
+		fprintf(stderr, "Short copy while slicing trace\n");
+		return 1;
+	}
+
+	if(!prefix.empty()) {
+		for(size_t i = 0; i < jobs.size(); ++i) printf("%s.%04lu: records %lu-%lu\n", prefix.c_str(), i, jobs[i].slice.first_record, jobs[i].slice.end_record);
+	}
+
+	return 0;
+}
@@ -0,0 +1,125 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceIndex.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <atomic>
+#include <string>
+#include <thread>
+#include <vector>
+
+#include <fcntl.h>
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-n pieces | -i instructions per piece] [-j threads] [-o output prefix] [record file]\n", name);
+	fprintf(stderr, "Splits a trace at instruction boundaries into pieces named <prefix>.0000, <prefix>.0001, ...\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t pieces = 0, piece_insns = 0;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	std::string prefix;
+
+	int opt;
+	while((opt = getopt(argc, argv, "n:i:j:o:")) != -1) {
+		switch(opt) {
+			case 'n':
+				pieces = strtoull(optarg, NULL, 0);
+				break;
+			case 'i':
+				piece_insns = strtoull(optarg, NULL, 0);
+				break;
+			case 'j':
+				threads = std::max(1ul, strtoul(optarg, NULL, 0));
+				break;
+			case 'o':
+				prefix = optarg;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1 || (pieces == 0) == (piece_insns == 0)) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::string path = argv[optind];
+	if(prefix.empty()) prefix = path;
+
+	FILE *f = fopen(path.c_str(), "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	TraceIndex index;
+	index.LoadOrBuild(path, reader, threads);
+
+	uint64_t insns = index.GetInstructionCount();
+	if(piece_insns) pieces = std::max<uint64_t>(1, (insns + piece_insns - 1) / piece_insns);
+	if(pieces > insns) pieces = std::max<uint64_t>(1, insns);
+
+	// piece i starts at the header of instruction i * insns / pieces, and
+	// the first piece also takes anything before the first header
+	std::vector<uint64_t> starts (pieces + 1);
+	starts[0] = 0;
+	starts[pieces] = reader.Size();
+	for(uint64_t i = 1; i < pieces; ++i) {
+		uint64_t insn = piece_insns ? i * piece_insns : (i * insns) / pieces;
+		if(!index.GetInstructionRecord(reader, insn, starts[i])) {
+			fprintf(stderr, "Could not find instruction %lu\n", insn);
+			return 1;
+		}
+	}
+
+	std::vector<int> fds (pieces);
+	for(uint64_t i = 0; i < pieces; ++i) {
+		char suffix[32];
+		snprintf(suffix, sizeof(suffix), ".%04lu", i);
+		std::string name = prefix + suffix;
+
+		fds[i] = open(name.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+		if(fds[i] < 0) {
+			perror(name.c_str());
+			return 1;
+		}
+	}
+
+	// pieces are copied in parallel, entirely within the kernel where the
+	// filesystem allows it
+	std::atomic<uint64_t> next_piece (0);
+	std::atomic<bool> failed (false);
+	auto worker = [&]() {
+		uint64_t i;
+		while((i = next_piece++) < pieces) {
+			uint64_t count = starts[i + 1] - starts[i];
+			if(reader.CopyTo(starts[i], count, fds[i], 0) != count) failed = true;
+		}
+	};
+
+	std::vector<std::thread> workers;
+	for(unsigned i = 1; i < std::min<uint64_t>(threads, pieces); ++i) workers.push_back(std::thread(worker));
+	worker();
+	for(auto &i : workers) i.join();
+
+	for(auto fd : fds) close(fd);
+
+	if(failed) {
+		fprintf(stderr, "Short copy while splitting trace\n");
+		return 1;
+	}
+
+	for(uint64_t i = 0; i < pieces; ++i) printf("%s.%04lu: records %lu-%lu\n", prefix.c_str(), i, starts[i], starts[i + 1]);
+
+	return 0;
+}
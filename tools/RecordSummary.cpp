@@ -0,0 +1,84 @@
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/TraceSummary.h"
+
+#include <cstdio>
+#include <cstdlib>
+
+#include <string>
+#include <thread>
+
+#include <unistd.h>
+
+using namespace libtrace;
+
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-c chunk records] [-r asid register] [-j threads] [-p] [record file]\n", name);
+	fprintf(stderr, "Builds the chunk summary used to skip scans, and writes it next to the trace.\n");
+	fprintf(stderr, "  -p             print the summary of each chunk\n");
+}
+
+int main(int argc, char **argv)
+{
+	uint64_t chunk_records = TraceSummary::kDefaultChunkRecords;
+	uint32_t asid_register = TraceSummary::kDefaultASIDRegister;
+	unsigned threads = std::max(1u, std::thread::hardware_concurrency());
+	bool print = false;
+
+	int opt;
+	while((opt = getopt(argc, argv, "c:r:j:p")) != -1) {
+		switch(opt) {
+			case 'c':
+				chunk_records = strtoull(optarg, NULL, 0);
+				break;
+			case 'r':
+				asid_register = strtoul(optarg, NULL, 0);
+				break;
+			case 'j':
+				threads = std::max(1ul, strtoul(optarg, NULL, 0));
+				break;
+			case 'p':
+				print = true;
+				break;
+			default:
+				PrintUsage(argv[0]);
+				return 1;
+		}
+	}
+
+	if(argc - optind != 1 || chunk_records == 0) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+
+	std::string path = argv[optind];
+	FILE *f = fopen(path.c_str(), "r");
+	if(!f) {
+		perror("Could not open file");
+		return 1;
+	}
+
+	RecordBlockReader reader (f);
+	TraceSummary summary (chunk_records, asid_register);
+	summary.Build(reader, threads);
+
+	if(!summary.SaveSidecar(path, reader)) {
+		perror("Could not write summary");
+		return 1;
+	}
+
+	if(print) {
+		printf("chunk      insns      pc range                               address range                          asids            types\n");
+		for(size_t i = 0; i < summary.GetChunkCount(); ++i) {
+			const TraceSummary::Chunk &c = summary.GetChunk(i);
+			printf("%-10lu %-10lu ", i, c.instructions);
+			if(c.instructions) printf("%016lx-%016lx  ", c.min_pc, c.max_pc);
+			else printf("%-37s  ", "-");
+			if(c.min_address <= c.max_address) printf("%016lx-%016lx  ", c.min_address, c.max_address);
+			else printf("%-37s  ", "-");
+			printf("%016lx %08x\n", c.asids, c.types);
+		}
+	}
+
+	return 0;
+}
@@ -1,58 +1,160 @@
 #include "libtrace/RecordTypes.h"
 #include "libtrace/RecordStream.h"
+#include "libtrace/RecordBlockReader.h"
+#include "libtrace/ReverseInstructionScanner.h"
+#include "libtrace/TraceIndex.h"
+#include "libtrace/TraceInput.h"
+#include "libtrace/TraceSummary.h"
 
+#include <string>
 #include <vector>
 
 #include <cstdio>
 #include <cstdlib>
 #include <cstring>
 
+#include <unistd.h>
+
 using namespace libtrace;
 
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f] [-n instructions] [record file] [instructions to skip]\n", name);
+	fprintf(stderr, "  -n N           output the last N instructions instead of skipping from the start\n");
+	fprintf(stderr, "%s", TraceInput::kFollowUsage);
+}
+
+// Find where instruction insn starts without reading the trace up to it,
+// using the trace's index or summary if it has one
+bool FindFromSidecar(const std::string &path, const RecordBlockReader &reader, ReverseInstructionScanner &scanner, uint64_t insn, uint64_t &record_idx, bool &found)
+{
+	TraceIndex index;
+	FILE *f = fopen(TraceIndex::GetSidecarPath(path).c_str(), "r");
+	if(f) {
+		bool loaded = index.Load(f, reader);
+		fclose(f);
+		if(loaded) {
+			found = index.GetInstructionRecord(reader, insn, record_idx);
+			if(found) record_idx = ReverseInstructionScanner::GetPacketStart(reader, record_idx);
+			return true;
+		}
+	}
+	
+	TraceSummary summary;
+	if(summary.LoadSidecar(path, reader)) {
+		uint64_t count = 0;
+		for(size_t i = 0; i < summary.GetChunkCount(); ++i) count += summary.GetChunk(i).instructions;
+		found = scanner.FindInstruction(insn, count, record_idx);
+		return true;
+	}
+	
+	return false;
+}
+
 int main(int argc, char **argv)
 {
-	FILE *f;
+	bool last = false;
+	uint64_t count = 0;
 	
-	if(!strcmp(argv[1], "-")) f = stdin;
-	else f = fopen(argv[1], "r");	
+	TraceInput input;
+	bool parsed = input.ParseOptions(argc, argv, "n:", [&](int, const char *arg) {
+		last = true;
+		count = strtoull(arg, NULL, 0);
+		return true;
+	});
+	if(!parsed || argc - optind != (last ? 1 : 2)) {
+		PrintUsage(argv[0]);
+		return 1;
+	}
+	const char *path = argv[optind];
+	if(!last) count = strtol(argv[optind+1], NULL, 0);
 	
-	if(!f) return 1;
+	if(!input.Open(path)) return 1;
+	if(last && input.IsStdin()) {
+		fprintf(stderr, "Cannot scan backwards through standard input\n");
+		return 1;
+	}
 	
-	RecordStream rf(f);
+	bool follow = input.IsFollowing();
+	FILE *f = input.GetFile();
 	
-	uint64_t count = strtol(argv[2], NULL, 0);
-	fprintf(stderr, "Skipping %lu instructions\n", count);
+	std::vector<Record> buffer;
 	
-	while(count && rf.good()) {
-		Record r = rf.next();
-		TraceRecord *tr = (TraceRecord *)&r;
+	// Files can be scanned backwards from the end, which only has to read
+	// the part of the trace being output. When following, the instruction
+	// being written at the end is left for the stream below.
+	bool scanned = false;
+	if(f != stdin) {
+		RecordBlockReader reader (f, follow);
+		ReverseInstructionScanner scanner (reader);
+		uint64_t start = 0;
+		bool found = true;
 		
-		if(tr->GetType() == InstructionHeader) {
-			count--;
-			if(!(count % 10000000)) fprintf(stderr, "%lu remaining...\n",count);
+		if(last) {
+			uint64_t found_count = scanner.FindLast(count, start);
+			if(found_count < count) fprintf(stderr, "Trace only has %lu instructions\n", found_count);
+			scanned = true;
+		} else if(FindFromSidecar(path, reader, scanner, count, start, found)) {
+			fprintf(stderr, "Skipping %lu instructions\n", count);
+			scanned = true;
 		}
 		
+		if(scanned && !found) {
+			fprintf(stderr, "Reached end of stream before reaching instruction count\n");
+			return 1;
+		}
+		
+		if(scanned) {
+			uint64_t end = reader.Size();
+			buffer.resize(ReverseInstructionScanner::kDefaultBlockRecords);
+			for(uint64_t pos = start; pos < end; ) {
+				size_t n = reader.Read(pos, buffer.data(), std::min<uint64_t>(buffer.size(), end - pos));
+				if(n == 0) break;
+				fwrite(buffer.data(), sizeof(Record), n, stdout);
+				pos += n;
+			}
+			buffer.clear();
+			
+			if(!follow) return 0;
+			fflush(stdout);
+			fseek(f, end * sizeof(Record), SEEK_SET);
+		}
 	}
-	if(!rf.good()) {
-		fprintf(stderr, "Reached end of stream before reaching instruction count\n");
-		return 1;
-	}
 	
-	// advance to the next instruction header
-	while(true && rf.good()) {
-		Record r = rf.peek();
-		TraceRecord *tr = (TraceRecord *)&r;
+	RecordStream rf(f, input.GetFollower());
+	
+	if(!scanned) {
+		fprintf(stderr, "Skipping %lu instructions\n", count);
 		
-		if(tr->GetType() == InstructionHeader) break;
-		rf.next();
-	}
-	if(!rf.good()) {
-		fprintf(stderr, "Reached end of stream before reaching instruction head\n");
-		return 1;
+		while(count && rf.good()) {
+			Record r = rf.next();
+			TraceRecord *tr = (TraceRecord *)&r;
+			
+			if(tr->GetType() == InstructionHeader) {
+				count--;
+				if(!(count % 10000000)) fprintf(stderr, "%lu remaining...\n",count);
+			}
+			
+		}
+		if(!rf.good()) {
+			fprintf(stderr, "Reached end of stream before reaching instruction count\n");
+			return 1;
+		}
+		
+		// advance to the next instruction header
+		while(true && rf.good()) {
+			Record r = rf.peek();
+			TraceRecord *tr = (TraceRecord *)&r;
+			
+			if(tr->GetType() == InstructionHeader) break;
+			rf.next();
+		}
+		if(!rf.good()) {
+			fprintf(stderr, "Reached end of stream before reaching instruction head\n");
+			return 1;
+		}
 	}
 	
-	std::vector<Record> buffer;
-	
 	while(rf.good()) {
 		Record r = rf.next();
 		
@@ -62,6 +164,12 @@ int main(int argc, char **argv)
 			buffer.clear();
 		}
 		
+		// pass on what has been written so far before waiting for more
+		if(follow && !rf.available()) {
+			fwrite(buffer.data(), sizeof(Record), buffer.size(), stdout);
+			buffer.clear();
+			fflush(stdout);
+		}
 	}
 	
 	fprintf(stderr, "Reached end of stream.\n");
@@ -1,27 +1,34 @@
 #include "libtrace/RecordTypes.h"
 #include "libtrace/RecordStream.h"
+#include "libtrace/TraceInput.h"
 
 #include <cstdlib>
 #include <cstdio>
 #include <cstring>
 
+#include <unistd.h>
+
 using namespace libtrace;
 
 TraceRecord TR(Record r) { return *(TraceRecord*)&r; }
 InstructionHeaderRecord IHR(Record r) { return *(InstructionHeaderRecord*)&r; }
 
+void PrintUsage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-f] [record file]\n", name);
+	fprintf(stderr, "%s", TraceInput::kFollowUsage);
+}
+
 int main(int argc, char **argv)
 {
-	FILE *f;
-	if(!strcmp(argv[1], "-")) f = stdin;
-	else f = fopen(argv[1], "r");
-	
-	if(!f) {
-		fprintf(stderr, "Could not open file\n");
+	TraceInput input;
+	if(!input.ParseOptions(argc, argv) || argc - optind != 1) {
+		PrintUsage(argv[0]);
 		return 1;
 	}
+	if(!input.Open(argv[optind])) return 1;
 	
-	RecordStream rf(f);
+	RecordStream rf(input.GetFile(), input.GetFollower());
 	
 	uint32_t prev_pc = 0xffffffff;
 	uint64_t count = 0;
@@ -46,6 +53,8 @@ int main(int argc, char **argv)
 		} else {
 			fwrite(&r, sizeof(r), 1, stdout);	
 		}
+		
+		if(input.IsFollowing() && !rf.available()) fflush(stdout);
 	}
 	
 	return 0;